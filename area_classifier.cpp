@@ -0,0 +1,197 @@
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "area_classifier.hpp"
+
+void AreaClassifier::add_value(std::uint32_t key_index, const char* value, bool area) {
+    std::size_t length;
+    const std::uint64_t hash = KeySet::hash(value, length);
+    if (find_value(key_index, value, length, hash)) {
+        return;
+    }
+
+    const auto index = static_cast<std::uint32_t>(m_values.size());
+    m_values.push_back(value_rule{key_index, value, area});
+    m_key_rules[key_index].has_values = true;
+
+    // Keep the table at most half full.
+    if (m_values.size() * 2 > m_value_table.size()) {
+        std::vector<std::uint32_t> table(m_value_table.size() * 2);
+        m_value_table.swap(table);
+        ++m_value_table_bits;
+        for (std::uint32_t i = 0; i < m_values.size(); ++i) {
+            const value_rule& rule = m_values[i];
+            insert_value_slot(value_hash(rule.key_index, KeySet::hash(rule.value.c_str(), length)), i);
+        }
+    } else {
+        insert_value_slot(value_hash(key_index, hash), index);
+    }
+}
+
+void AreaClassifier::add(bool area, const char* key, const char* value) {
+    const std::uint32_t key_index = m_keys.insert(key);
+    if (key_index == m_key_rules.size()) {
+        m_key_rules.push_back(key_rule{key_result::none, false});
+    }
+
+    // After a rule for all values of the key, no other rule for it can
+    // match. A value that already has a rule is handled by add_value().
+    if (m_key_rules[key_index].result != key_result::none) {
+        return;
+    }
+
+    if (value) {
+        add_value(key_index, value, area);
+    } else {
+        m_key_rules[key_index].result = area ? key_result::area : key_result::no_area;
+    }
+}
+
+AreaClassifier default_area_rules() {
+    AreaClassifier rules;
+
+    rules.add(false, "aeroway", "gate");
+    rules.add(false, "aeroway", "taxiway");
+    rules.add(true, "aeroway");
+
+    rules.add(false, "amenity", "atm");
+    rules.add(false, "amenity", "bbq");
+    rules.add(false, "amenity", "bench");
+    rules.add(false, "amenity", "bureau_de_change");
+    rules.add(false, "amenity", "clock");
+    rules.add(false, "amenity", "drinking_water");
+    rules.add(false, "amenity", "grit_bin");
+    rules.add(false, "amenity", "parking_entrance");
+    rules.add(false, "amenity", "post_box");
+    rules.add(false, "amenity", "telephone");
+    rules.add(false, "amenity", "vending_machine");
+    rules.add(false, "amenity", "waste_basket");
+    rules.add(true, "amenity");
+
+    rules.add(false, "area", "no");
+    rules.add(true, "area");
+
+    rules.add(true, "area:highway");
+
+    rules.add(false, "building", "entrance");
+    rules.add(false, "building", "no");
+    rules.add(true, "building");
+
+    rules.add(true, "craft");
+
+    rules.add(false, "emergency", "fire_hydrant");
+    rules.add(false, "emergency", "phone");
+    rules.add(true, "emergency");
+
+    rules.add(false, "golf", "hole");
+    rules.add(true, "golf");
+
+    rules.add(false, "historic", "boundary_stone");
+    rules.add(true, "historic");
+
+    rules.add(false, "junction", "roundabout");
+    rules.add(true, "junction");
+
+    rules.add(true, "landuse");
+
+    rules.add(false, "leisure", "picnic_table");
+    rules.add(false, "leisure", "track");
+    rules.add(false, "leisure", "slipway");
+    rules.add(true, "leisure");
+
+    rules.add(false, "man_made", "cutline");
+    rules.add(false, "man_made", "embankment");
+    rules.add(false, "man_made", "flagpole");
+    rules.add(false, "man_made", "mast");
+    rules.add(false, "man_made", "petroleum_well");
+    rules.add(false, "man_made", "pipeline");
+    rules.add(false, "man_made", "survey_point");
+    rules.add(true, "man_made");
+
+    rules.add(true, "military");
+
+    rules.add(false, "natural", "coastline");
+    rules.add(false, "natural", "peak");
+    rules.add(false, "natural", "saddle");
+    rules.add(false, "natural", "spring");
+    rules.add(false, "natural", "tree");
+    rules.add(false, "natural", "tree_row");
+    rules.add(false, "natural", "volcano");
+    rules.add(true, "natural");
+
+    rules.add(true, "office");
+
+    rules.add(true, "piste:type");
+
+    rules.add(true, "place");
+
+    rules.add(false, "power", "line");
+    rules.add(false, "power", "minor_line");
+    rules.add(false, "power", "pole");
+    rules.add(false, "power", "tower");
+    rules.add(true, "power");
+
+    rules.add(false, "public_transport", "stop_position");
+    rules.add(true, "public_transport");
+
+    rules.add(true, "shop");
+
+    rules.add(false, "tourism", "viewpoint");
+    rules.add(true, "tourism");
+
+    rules.add(false, "waterway", "canal");
+    rules.add(false, "waterway", "ditch");
+    rules.add(false, "waterway", "drain");
+    rules.add(false, "waterway", "river");
+    rules.add(false, "waterway", "stream");
+    rules.add(false, "waterway", "weir");
+    rules.add(true, "waterway");
+
+    return rules;
+}
+
+AreaClassifier read_area_rules(const std::string& filename) {
+    std::ifstream file{filename};
+    if (!file) {
+        throw std::runtime_error{"Can not open area rules file '" + filename + "'"};
+    }
+
+    AreaClassifier rules;
+    std::string line;
+    for (int line_number = 1; std::getline(file, line); ++line_number) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        bool area = true;
+        std::size_t start = 0;
+        if (line[0] == '!') {
+            area = false;
+            start = 1;
+        }
+
+        const auto pos = line.find('=', start);
+        const std::string key = line.substr(start, pos == std::string::npos ? std::string::npos : pos - start);
+        if (key.empty()) {
+            throw std::runtime_error{"Missing key in area rules file '" + filename + "' on line " + std::to_string(line_number)};
+        }
+
+        if (pos == std::string::npos) {
+            rules.add(area, key.c_str());
+        } else {
+            rules.add(area, key.c_str(), line.c_str() + pos + 1);
+        }
+    }
+
+    if (file.bad()) {
+        throw std::runtime_error{"Error reading area rules file '" + filename + "'"};
+    }
+
+    return rules;
+}
+
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <osmium/osm/tag.hpp>
+
+#include "key_set.hpp"
+
+/**
+ * Decides from the tags of a closed way whether it is an area. The rules
+ * are "KEY" or "KEY=VALUE" with a result (area or not). As with
+ * osmium::tags::KeyValueFilter the first rule matching a tag decides for
+ * that tag, tags not matching any rule don't count. The way is an area if
+ * any of its tags is decided as area.
+ *
+ * The rules are compiled into two open addressing hash tables with linear
+ * probing, a KeySet for the keys and one for the values of each key, so
+ * every tag needs one lookup for its key and, only if there are rules for
+ * values of that key, one for its value.
+ */
+class AreaClassifier {
+
+    static constexpr std::uint32_t empty_slot = 0;
+
+    // What a rule without value says about a key.
+    enum class key_result : std::uint8_t {
+        none,
+        area,
+        no_area
+    };
+
+    // Rules for the key with the same index in m_keys.
+    struct key_rule {
+        key_result result;
+        bool has_values;
+    };
+
+    struct value_rule {
+        std::uint32_t key_index;
+        std::string value;
+        bool area;
+    };
+
+    KeySet m_keys;
+    std::vector<key_rule> m_key_rules;
+    std::vector<value_rule> m_values;
+
+    // Indexes into m_values plus 1, so 0 marks empty slots.
+    std::vector<std::uint32_t> m_value_table;
+    unsigned int m_value_table_bits;
+
+    static std::uint64_t value_hash(std::uint32_t key_index, std::uint64_t hash) noexcept {
+        return hash ^ ((key_index + 1) * 0xc2b2ae3d27d4eb4fULL);
+    }
+
+    const value_rule* find_value(std::uint32_t key_index, const char* value, std::size_t length, std::uint64_t hash) const noexcept {
+        const std::size_t mask = m_value_table.size() - 1;
+        for (std::size_t i = KeySet::slot(value_hash(key_index, hash), m_value_table_bits); m_value_table[i] != empty_slot; i = (i + 1) & mask) {
+            const value_rule& rule = m_values[m_value_table[i] - 1];
+            if (rule.key_index == key_index && KeySet::equal(rule.value, value, length)) {
+                return &rule;
+            }
+        }
+        return nullptr;
+    }
+
+    void insert_value_slot(std::uint64_t hash, std::uint32_t index) noexcept {
+        const std::size_t mask = m_value_table.size() - 1;
+        std::size_t i = KeySet::slot(hash, m_value_table_bits);
+        while (m_value_table[i] != empty_slot) {
+            i = (i + 1) & mask;
+        }
+        m_value_table[i] = index + 1;
+    }
+
+    void add_value(std::uint32_t key_index, const char* value, bool area);
+
+public:
+
+    /**
+     * Create classifier without any rules.
+     */
+    AreaClassifier() :
+        m_keys(),
+        m_key_rules(),
+        m_values(),
+        m_value_table(2),
+        m_value_table_bits(1) {
+    }
+
+    /**
+     * Add a rule. If value is nullptr, it matches all tags with the key.
+     * Rules that can never match because an earlier rule decides all the
+     * tags they would match are ignored.
+     */
+    void add(bool area, const char* key, const char* value = nullptr);
+
+    /**
+     * Is the tag decided as area?
+     */
+    bool is_area(const char* key, const char* value) const noexcept {
+        std::uint32_t index;
+        if (!m_keys.find(key, index)) {
+            return false;
+        }
+        const key_rule& rule = m_key_rules[index];
+        if (rule.has_values) {
+            std::size_t length;
+            const std::uint64_t hash = KeySet::hash(value, length);
+            const value_rule* vrule = find_value(index, value, length, hash);
+            if (vrule) {
+                return vrule->area;
+            }
+        }
+        return rule.result == key_result::area;
+    }
+
+    /**
+     * Is a closed way with these tags an area?
+     */
+    bool is_area(const osmium::TagList& tags) const noexcept {
+        for (const auto& tag : tags) {
+            if (is_area(tag.key(), tag.value())) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+}; // class AreaClassifier
+
+/**
+ * The rules used unless others are set with --area-rules.
+ */
+AreaClassifier default_area_rules();
+
+/**
+ * Read area rules from a file. Each line has one rule, "KEY" or
+ * "KEY=VALUE", meaning that tags with this key (and value) are areas, or
+ * the same with a leading "!" meaning they are not. Empty lines and lines
+ * starting with "#" are ignored.
+ *
+ * @throws std::runtime_error if the file can't be read or is invalid.
+ */
+AreaClassifier read_area_rules(const std::string& filename);
+
@@ -0,0 +1,74 @@
+#include <limits>
+#include <stdexcept>
+
+#include "external_join.hpp"
+
+// The requests are only added in the first pass, the resolved locations
+// only in the second pass while the requests are merged. So each sorter
+// gets half of the memory.
+ExternalJoin::ExternalJoin(std::size_t memory, const std::string& tmp_dir, std::size_t num_threads) :
+    m_requests(memory / 2, tmp_dir, num_threads),
+    m_locations(memory / 2, tmp_dir, num_threads),
+    m_request(),
+    m_location(),
+    m_has_request(false),
+    m_has_location(false),
+    m_joining(false),
+    m_in_ways(false),
+    m_last_node_id(std::numeric_limits<osmium::object_id_type>::min()),
+    m_way_count(0) {
+}
+
+void ExternalJoin::start_join() {
+    m_requests.sort();
+    m_has_request = m_requests.next(m_request);
+    m_joining = true;
+    m_way_count = 0;
+}
+
+void ExternalJoin::node(const osmium::Node& node) {
+    if (!m_joining) {
+        return;
+    }
+
+    if (m_in_ways) {
+        throw std::runtime_error{"The external join needs all nodes before the ways"};
+    }
+    if (node.id() < m_last_node_id) {
+        throw std::runtime_error{"The external join needs nodes sorted by ID"};
+    }
+    m_last_node_id = node.id();
+
+    while (m_has_request && m_request.ref < node.id()) {
+        m_has_request = m_requests.next(m_request);
+    }
+    while (m_has_request && m_request.ref == node.id()) {
+        m_locations.add(resolved_location{m_request.way, m_request.pos, node.location()});
+        m_has_request = m_requests.next(m_request);
+    }
+}
+
+void ExternalJoin::way(osmium::Way& way) {
+    if (!m_joining) {
+        std::uint32_t pos = 0;
+        for (const auto& node_ref : way.nodes()) {
+            m_requests.add(node_request{node_ref.ref(), m_way_count, pos++});
+        }
+        ++m_way_count;
+        return;
+    }
+
+    if (!m_in_ways) {
+        m_in_ways = true;
+        m_locations.sort();
+        m_has_location = m_locations.next(m_location);
+    }
+
+    const auto nodes = way.nodes().begin();
+    while (m_has_location && m_location.way == m_way_count) {
+        nodes[m_location.pos].set_location(m_location.location);
+        m_has_location = m_locations.next(m_location);
+    }
+    ++m_way_count;
+}
+
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <osmium/handler.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+
+#include "external_sort.hpp"
+
+/**
+ * Adds the node locations to ways without keeping an index of all node
+ * locations in memory. Use instead of osmium::handler::NodeLocationsForWays
+ * when there isn't enough memory for any location store.
+ *
+ * The input file has to be read twice, the nodes must be sorted by ID and
+ * come before the ways (as they do in sorted OSM files):
+ *
+ * 1. Apply the handler to all ways. For each node reference a request
+ *    (node ID, way number, position in the way) is added to an external
+ *    sorter sorting by node ID.
+ * 2. Call start_join().
+ * 3. Apply the handler to all objects before any other handler. The
+ *    nodes are merged with the sorted requests and for each match a
+ *    (way number, position, location) tuple is added to a second external
+ *    sorter sorting by way number and position. When the first way is
+ *    seen those tuples are read in order and the locations are set in
+ *    the ways.
+ *
+ * Memory use is bounded by the memory given to the constructor, all disk
+ * I/O is sequential. Locations of missing nodes are left undefined.
+ */
+class ExternalJoin : public osmium::handler::Handler {
+
+    struct node_request {
+        osmium::object_id_type ref;
+        std::uint64_t way;
+        std::uint32_t pos;
+    };
+
+    struct resolved_location {
+        std::uint64_t way;
+        std::uint32_t pos;
+        osmium::Location location;
+    };
+
+    struct request_compare {
+        bool operator()(const node_request& a, const node_request& b) const noexcept {
+            return a.ref < b.ref;
+        }
+    };
+
+    struct location_compare {
+        bool operator()(const resolved_location& a, const resolved_location& b) const noexcept {
+            return a.way < b.way || (a.way == b.way && a.pos < b.pos);
+        }
+    };
+
+    ExternalSorter<node_request, request_compare> m_requests;
+    ExternalSorter<resolved_location, location_compare> m_locations;
+
+    node_request m_request;
+    resolved_location m_location;
+    bool m_has_request;
+    bool m_has_location;
+
+    bool m_joining;
+    bool m_in_ways;
+    osmium::object_id_type m_last_node_id;
+    std::uint64_t m_way_count;
+
+public:
+
+    /**
+     * @param memory Maximum number of bytes for the data in memory.
+     * @param tmp_dir Directory for the temporary files.
+     * @param num_threads Number of threads used for sorting.
+     */
+    ExternalJoin(std::size_t memory, const std::string& tmp_dir, std::size_t num_threads);
+
+    /**
+     * Call after the first pass over the ways.
+     */
+    void start_join();
+
+    /**
+     * @throws std::runtime_error if the nodes are not sorted by ID or
+     *         come after the ways.
+     */
+    void node(const osmium::Node& node);
+
+    void way(osmium::Way& way);
+
+    std::size_t num_request_runs() const noexcept {
+        return m_requests.num_runs();
+    }
+
+}; // class ExternalJoin
+
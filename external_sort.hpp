@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <queue>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+/**
+ * Sort the vector using num_threads threads. The vector is split into one
+ * part per thread, the parts are sorted in parallel and then merged.
+ */
+template <typename T, typename TCompare>
+void parallel_sort(std::vector<T>& data, std::size_t num_threads, TCompare compare) {
+    if (num_threads < 2 || data.size() < num_threads * 1024) {
+        std::sort(data.begin(), data.end(), compare);
+        return;
+    }
+
+    std::vector<std::size_t> bounds;
+    for (std::size_t i = 0; i <= num_threads; ++i) {
+        bounds.push_back(data.size() * i / num_threads);
+    }
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < num_threads; ++i) {
+        threads.emplace_back([&data, &bounds, &compare, i]() {
+            std::sort(data.begin() + bounds[i], data.begin() + bounds[i + 1], compare);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (std::size_t step = 1; step < num_threads; step *= 2) {
+        for (std::size_t i = 0; i + step < num_threads; i += 2 * step) {
+            const std::size_t end = bounds[std::min(i + 2 * step, num_threads)];
+            std::inplace_merge(data.begin() + bounds[i], data.begin() + bounds[i + step], data.begin() + end, compare);
+        }
+    }
+}
+
+/**
+ * Sorts more data than fits into memory. Values are collected with add()
+ * until they use more than the given amount of memory. Then they are
+ * sorted and written as a sorted run to a temporary file. After sort()
+ * the values are returned in order by next(), merged from all the runs.
+ * All file I/O is sequential (within each run).
+ *
+ * The temporary file is created in tmp_dir and removed right away, it
+ * vanishes when the sorter is destroyed.
+ *
+ * T must be trivially copyable, it is written to disk as is.
+ */
+template <typename T, typename TCompare = std::less<T>>
+class ExternalSorter {
+
+    static_assert(std::is_trivially_copyable<T>::value, "ExternalSorter needs trivially copyable type");
+
+    // Part of a run that is being merged.
+    struct run_type {
+        off_t offset;
+        off_t end;
+        std::vector<T> buffer;
+        std::size_t pos;
+    };
+
+    struct heap_compare {
+        const TCompare* compare;
+        const std::vector<run_type>* runs;
+
+        // std::priority_queue returns the largest element, so compare the
+        // other way round.
+        bool operator()(std::size_t a, std::size_t b) const {
+            return (*compare)((*runs)[b].buffer[(*runs)[b].pos], (*runs)[a].buffer[(*runs)[a].pos]);
+        }
+    };
+
+    std::size_t m_max_values;
+    std::string m_tmp_dir;
+    std::size_t m_num_threads;
+    TCompare m_compare;
+
+    int m_fd;
+    off_t m_file_size;
+
+    std::vector<T> m_values;
+    std::size_t m_values_pos;
+
+    std::vector<run_type> m_runs;
+    std::priority_queue<std::size_t, std::vector<std::size_t>, heap_compare> m_heap;
+
+    void open_tmp_file() {
+        std::string name = m_tmp_dir + "/minjur-sort-XXXXXX";
+        m_fd = ::mkstemp(&name[0]);
+        if (m_fd < 0) {
+            throw std::system_error{errno, std::system_category(), "Can not create temporary file in '" + m_tmp_dir + "'"};
+        }
+        ::unlink(name.c_str());
+    }
+
+    void write_run() {
+        if (m_fd < 0) {
+            open_tmp_file();
+        }
+        parallel_sort(m_values, m_num_threads, m_compare);
+
+        const char* data = reinterpret_cast<const char*>(m_values.data());
+        std::size_t size = m_values.size() * sizeof(T);
+        const off_t begin = m_file_size;
+        while (size > 0) {
+            const auto written = ::pwrite(m_fd, data, size, m_file_size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error{errno, std::system_category(), "Error writing temporary file"};
+            }
+            data += written;
+            size -= static_cast<std::size_t>(written);
+            m_file_size += written;
+        }
+
+        m_runs.push_back(run_type{begin, m_file_size, std::vector<T>{}, 0});
+        m_values.clear();
+    }
+
+    // Read the next part of a run into its buffer. Returns false at the end
+    // of the run.
+    bool fill(run_type& run, std::size_t buffer_values) {
+        const auto values = std::min(buffer_values, static_cast<std::size_t>(run.end - run.offset) / sizeof(T));
+        if (values == 0) {
+            return false;
+        }
+        run.buffer.resize(values);
+        run.pos = 0;
+
+        char* data = reinterpret_cast<char*>(run.buffer.data());
+        std::size_t size = values * sizeof(T);
+        while (size > 0) {
+            const auto length = ::pread(m_fd, data, size, run.offset);
+            if (length <= 0) {
+                if (length < 0 && errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error{length < 0 ? errno : EIO, std::system_category(), "Error reading temporary file"};
+            }
+            data += length;
+            size -= static_cast<std::size_t>(length);
+            run.offset += length;
+        }
+        return true;
+    }
+
+public:
+
+    /**
+     * @param memory Maximum number of bytes used for the values in memory.
+     * @param tmp_dir Directory for the temporary file.
+     * @param num_threads Number of threads used for sorting.
+     */
+    ExternalSorter(std::size_t memory, const std::string& tmp_dir, std::size_t num_threads = 1, TCompare compare = TCompare()) :
+        m_max_values(std::max(memory / sizeof(T), std::size_t(1024))),
+        m_tmp_dir(tmp_dir),
+        m_num_threads(num_threads),
+        m_compare(compare),
+        m_fd(-1),
+        m_file_size(0),
+        m_values(),
+        m_values_pos(0),
+        m_runs(),
+        m_heap(heap_compare{&m_compare, &m_runs}) {
+    }
+
+    ExternalSorter(const ExternalSorter&) = delete;
+    ExternalSorter& operator=(const ExternalSorter&) = delete;
+
+    ~ExternalSorter() {
+        if (m_fd >= 0) {
+            ::close(m_fd);
+        }
+    }
+
+    void add(const T& value) {
+        if (m_values.empty()) {
+            m_values.reserve(m_max_values);
+        }
+        m_values.push_back(value);
+        if (m_values.size() == m_max_values) {
+            write_run();
+        }
+    }
+
+    /**
+     * Number of sorted runs written to disk so far.
+     */
+    std::size_t num_runs() const noexcept {
+        return m_runs.size();
+    }
+
+    /**
+     * Call after all values are added. If everything fitted into memory
+     * the values are sorted there, otherwise the rest is written as the
+     * last run and the merge of the runs is prepared.
+     */
+    void sort() {
+        if (m_runs.empty()) {
+            parallel_sort(m_values, m_num_threads, m_compare);
+            m_values_pos = 0;
+            return;
+        }
+
+        if (!m_values.empty()) {
+            write_run();
+        }
+        std::vector<T>{}.swap(m_values);
+
+        const std::size_t buffer_values = std::max(m_max_values / m_runs.size(), std::size_t(1024));
+        for (std::size_t i = 0; i < m_runs.size(); ++i) {
+            if (fill(m_runs[i], buffer_values)) {
+                m_heap.push(i);
+            }
+        }
+    }
+
+    /**
+     * Get the next value in sorted order. Returns false if there are no
+     * more values.
+     */
+    bool next(T& value) {
+        if (m_runs.empty()) {
+            if (m_values_pos == m_values.size()) {
+                return false;
+            }
+            value = m_values[m_values_pos++];
+            return true;
+        }
+
+        if (m_heap.empty()) {
+            return false;
+        }
+
+        const std::size_t i = m_heap.top();
+        m_heap.pop();
+        run_type& run = m_runs[i];
+        value = run.buffer[run.pos++];
+        if (run.pos < run.buffer.size() || fill(run, run.buffer.size())) {
+            m_heap.push(i);
+        }
+        return true;
+    }
+
+}; // class ExternalSorter
+
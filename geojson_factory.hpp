@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <osmium/geom/factory.hpp>
+#include <osmium/osm/location.hpp>
+
+#include "json_writer.hpp"
+
+/**
+ * "Projection" for osmium::geom::GeometryFactory that hands the locations
+ * through unchanged, so that the coordinates can be written from their
+ * fixed-point integers without converting them to double first.
+ */
+class LocationProjection {
+
+public:
+
+    /**
+     * @throws osmium::invalid_location if the location is not valid.
+     */
+    osmium::Location operator()(const osmium::Location& location) const {
+        if (!location.valid()) {
+            throw osmium::invalid_location{"invalid location"};
+        }
+        return location;
+    }
+
+    int epsg() const noexcept {
+        return 4326;
+    }
+
+    std::string proj_string() const {
+        return "+proj=longlat +datum=WGS84 +no_defs";
+    }
+
+}; // class LocationProjection
+
+/**
+ * Where a GeoJSONFactoryImpl writes to. This is owned by the user of the
+ * factory, so the factory can be kept and pointed at another buffer for
+ * every feature, and the space for the locations is reused.
+ */
+struct geojson_output {
+
+    /// The string the geometry is appended to.
+    std::string* buffer = nullptr;
+
+    /// The locations of the current linestring or ring.
+    std::vector<osmium::Location> locations;
+
+}; // struct geojson_output
+
+namespace detail {
+
+    /**
+     * Geometry implementation for osmium::geom::GeometryFactory writing
+     * the "geometry" member of a GeoJSON feature straight into a string.
+     * All the structure is written as precomputed strings. The locations
+     * of linestrings and rings are collected and written in one batch.
+     */
+    class GeoJSONFactoryImpl {
+
+        geojson_output* m_output;
+        CoordinateRounder m_rounder;
+
+        // Is the next array in the coordinates not the first in its
+        // parent array?
+        bool m_need_comma;
+
+        std::string& out() noexcept {
+            return *m_output->buffer;
+        }
+
+        void start_array() {
+            if (m_need_comma) {
+                out() += ',';
+            }
+            out() += '[';
+            m_need_comma = false;
+        }
+
+        void end_array() {
+            out() += ']';
+            m_need_comma = true;
+        }
+
+        void add_location(const osmium::Location& location) {
+            m_output->locations.push_back(location);
+        }
+
+        void write_locations() {
+            auto& locations = m_output->locations;
+            append_json_locations(out(), locations.data(), locations.size(), m_rounder);
+            locations.clear();
+        }
+
+        void start_geometry(const char* start) {
+            out().append(start);
+            m_need_comma = false;
+            m_output->locations.clear();
+        }
+
+    public:
+
+        using point_type        = void;
+        using linestring_type   = void;
+        using polygon_type      = void;
+        using multipolygon_type = void;
+        using ring_type         = void;
+
+        GeoJSONFactoryImpl(int /* srid */, geojson_output& output, unsigned int precision) :
+            m_output(&output),
+            m_rounder(precision),
+            m_need_comma(false) {
+        }
+
+        /* Point */
+
+        void make_point(const osmium::Location& location) {
+            out().append(",\"geometry\":{\"type\":\"Point\",\"coordinates\":[");
+            append_json_coordinate(out(), location.x(), m_rounder);
+            out() += ',';
+            append_json_coordinate(out(), location.y(), m_rounder);
+            out().append("]}");
+        }
+
+        /* LineString */
+
+        void linestring_start() {
+            start_geometry(",\"geometry\":{\"type\":\"LineString\",\"coordinates\":[");
+        }
+
+        void linestring_add_location(const osmium::Location& location) {
+            add_location(location);
+        }
+
+        void linestring_finish(std::size_t /* num_points */) {
+            write_locations();
+            out().append("]}");
+        }
+
+        /* Polygon */
+
+        void polygon_start() {
+            start_geometry(",\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[[");
+        }
+
+        void polygon_add_location(const osmium::Location& location) {
+            add_location(location);
+        }
+
+        void polygon_finish(std::size_t /* num_points */) {
+            write_locations();
+            out().append("]]}");
+        }
+
+        /* MultiPolygon */
+
+        void multipolygon_start() {
+            start_geometry(",\"geometry\":{\"type\":\"MultiPolygon\",\"coordinates\":[");
+        }
+
+        void multipolygon_polygon_start() {
+            start_array();
+        }
+
+        void multipolygon_polygon_finish() {
+            end_array();
+        }
+
+        void multipolygon_outer_ring_start() {
+            start_array();
+        }
+
+        void multipolygon_outer_ring_finish() {
+            write_locations();
+            end_array();
+        }
+
+        void multipolygon_inner_ring_start() {
+            start_array();
+        }
+
+        void multipolygon_inner_ring_finish() {
+            write_locations();
+            end_array();
+        }
+
+        void multipolygon_add_location(const osmium::Location& location) {
+            add_location(location);
+        }
+
+        void multipolygon_finish() {
+            out().append("]}");
+        }
+
+    }; // class GeoJSONFactoryImpl
+
+} // namespace detail
+
+using geojson_factory_type = osmium::geom::GeometryFactory<detail::GeoJSONFactoryImpl, LocationProjection>;
+
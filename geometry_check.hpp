@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <osmium/osm/area.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/way.hpp>
+
+/**
+ * Result of checking an object before creating its geometry. The checks
+ * find the problems the geometry factory would throw an exception for,
+ * so objects with missing node locations, which are common in extracts,
+ * can be skipped cheaply. The factory exceptions are still caught, but
+ * only as a last resort.
+ */
+enum class geometry_check : std::uint8_t {
+    ok,
+    invalid_location,
+    geometry_error
+};
+
+/// The name of the problem as written into the error file.
+inline const char* geometry_check_name(geometry_check check) noexcept {
+    switch (check) {
+        case geometry_check::invalid_location:
+            return "invalid_location";
+        case geometry_check::geometry_error:
+            return "geometry_error";
+        default:
+            break;
+    }
+    return "ok";
+}
+
+inline geometry_check check_point(const osmium::Node& node) noexcept {
+    return node.location().valid() ? geometry_check::ok : geometry_check::invalid_location;
+}
+
+/**
+ * Check in one pass that all locations of the way are valid and that it
+ * has at least min_points locations, not counting consecutive duplicates
+ * which the factory leaves out.
+ */
+inline geometry_check check_way(const osmium::Way& way, std::size_t min_points) noexcept {
+    std::size_t num_points = 0;
+    osmium::Location last;
+    for (const auto& node_ref : way.nodes()) {
+        const osmium::Location location = node_ref.location();
+        if (!location.valid()) {
+            return geometry_check::invalid_location;
+        }
+        if (num_points == 0 || location != last) {
+            last = location;
+            ++num_points;
+        }
+    }
+    return num_points < min_points ? geometry_check::geometry_error : geometry_check::ok;
+}
+
+inline geometry_check check_linestring(const osmium::Way& way) noexcept {
+    return check_way(way, 2);
+}
+
+inline geometry_check check_polygon(const osmium::Way& way) noexcept {
+    return check_way(way, 4);
+}
+
+/**
+ * Areas are only assembled from valid locations, but the factory can't
+ * create a multipolygon from an area without outer rings.
+ */
+inline geometry_check check_multipolygon(const osmium::Area& area) noexcept {
+    return area.num_rings().first == 0 ? geometry_check::geometry_error : geometry_check::ok;
+}
+
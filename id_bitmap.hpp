@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <osmium/osm/types.hpp>
+
+/**
+ * Set of object IDs with one bit for every possible ID up to the largest
+ * one in the set.
+ */
+class IdBitmap {
+
+    std::vector<std::uint64_t> m_bits;
+    std::size_t m_size;
+
+public:
+
+    IdBitmap() :
+        m_bits(),
+        m_size(0) {
+    }
+
+    void set(osmium::unsigned_object_id_type id) {
+        const std::size_t word = static_cast<std::size_t>(id >> 6);
+        if (word >= m_bits.size()) {
+            m_bits.resize(word + 1);
+        }
+        const std::uint64_t bit = std::uint64_t(1) << (id & 63);
+        if (!(m_bits[word] & bit)) {
+            m_bits[word] |= bit;
+            ++m_size;
+        }
+    }
+
+    bool get(osmium::unsigned_object_id_type id) const noexcept {
+        const std::size_t word = static_cast<std::size_t>(id >> 6);
+        return word < m_bits.size() && ((m_bits[word] >> (id & 63)) & 1);
+    }
+
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    std::size_t used_memory() const noexcept {
+        return m_bits.capacity() * sizeof(std::uint64_t);
+    }
+
+}; // class IdBitmap
+
@@ -1,60 +1,104 @@
 
+#include <cstddef>
 #include <string>
 
 #include <osmium/osm/tag.hpp>
 
 #include "json_feature.hpp"
 
-void JSONFeature::add_id(const std::string& prefix, osmium::object_id_type id) {
-    m_writer.Key("id");
-    m_writer.String(prefix + std::to_string(id));
+void JSONFeature::add_id(const char* prefix, osmium::object_id_type id) {
+    m_buffer.append(",\"id\":\"");
+    m_buffer.append(prefix);
+    append_json_int(m_buffer, id);
+    m_buffer += '"';
 }
 
+// Version, changeset, uid and timestamp are written as signed 32 bit
+// numbers like minjur always did. Objects read from files without
+// metadata have version 0, for them these attributes are left out.
 void JSONFeature::add_properties(const osmium::OSMObject& object) {
-    m_writer.Key("properties");
+    const attribute_names& names = m_writer.m_attr_names;
+    const property_options& options = m_writer.m_properties;
 
-    m_writer.StartObject();
+    unsigned int attributes = options.attributes;
+    if (object.version() == 0) {
+        attributes &= ~property_options::metadata_attributes;
+    }
+
+    m_buffer.append(",\"properties\":{");
+    const std::size_t start = m_buffer.size();
+    const auto add_key = [&](const std::string& key) {
+        if (m_buffer.size() != start) {
+            m_buffer += ',';
+        }
+        m_buffer.append(key);
+    };
 
-    m_writer.String(m_attr_names.id);
-    m_writer.Int64(object.type() == osmium::item_type::area ? osmium::area_id_to_object_id(object.id()) : object.id());
+    if (attributes & property_options::attribute_id) {
+        add_key(names.id_key);
+        append_json_int(m_buffer, object.type() == osmium::item_type::area ? osmium::area_id_to_object_id(object.id()) : object.id());
+    }
 
-    m_writer.String(m_attr_names.type);
-    if (object.type() == osmium::item_type::area) {
-        if (static_cast<const osmium::Area&>(object).from_way()) {
-            m_writer.String("way");
+    if (attributes & property_options::attribute_type) {
+        add_key(names.type_key);
+        if (object.type() == osmium::item_type::area) {
+            if (static_cast<const osmium::Area&>(object).from_way()) {
+                m_buffer.append("\"way\"");
+            } else {
+                m_buffer.append("\"relation\"");
+            }
         } else {
-            m_writer.String("relation");
+            append_json_string(m_buffer, osmium::item_type_to_name(object.type()));
         }
-    } else {
-        m_writer.String(osmium::item_type_to_name(object.type()));
     }
 
-    m_writer.String(m_attr_names.version);
-    m_writer.Int(object.version());
+    if (attributes & property_options::attribute_version) {
+        add_key(names.version_key);
+        append_json_int(m_buffer, static_cast<int>(object.version()));
+    }
 
-    m_writer.String(m_attr_names.changeset);
-    m_writer.Int(object.changeset());
+    if (attributes & property_options::attribute_changeset) {
+        add_key(names.changeset_key);
+        append_json_int(m_buffer, static_cast<int>(object.changeset()));
+    }
 
-    m_writer.String(m_attr_names.uid);
-    m_writer.Int(object.uid());
+    if (attributes & property_options::attribute_uid) {
+        add_key(names.uid_key);
+        append_json_int(m_buffer, static_cast<int>(object.uid()));
+    }
 
-    m_writer.String(m_attr_names.user);
-    m_writer.String(object.user());
+    if (attributes & property_options::attribute_user) {
+        add_key(names.user_key);
+        append_json_string(m_buffer, object.user());
+    }
 
-    m_writer.String(m_attr_names.timestamp);
-    m_writer.Int(object.timestamp().seconds_since_epoch());
+    if (attributes & property_options::attribute_timestamp) {
+        add_key(names.timestamp_key);
+        append_json_int(m_buffer, static_cast<int>(object.timestamp().seconds_since_epoch()));
+    }
 
     for (const auto& tag : object.tags()) {
-        m_writer.String(tag.key());
-        m_writer.String(tag.value());
+        if (!options.write_tag(tag.key())) {
+            continue;
+        }
+        if (m_buffer.size() != start) {
+            m_buffer += ',';
+        }
+        append_json_string(m_buffer, tag.key());
+        m_buffer += ':';
+        append_json_string(m_buffer, tag.value());
     }
-    m_writer.EndObject();
+    m_buffer += '}';
 }
 
-void JSONFeature::append_to(std::string& buffer) {
-    m_writer.EndObject();
+void JSONFeature::finish() {
+    m_buffer.append("}\n");
+    m_finished = true;
 
-    buffer.append(m_stream.GetString(), m_stream.GetSize());
-    buffer.append(1, '\n');
+    ++m_writer.m_feature_count;
+    if (m_buffer.capacity() != m_buffer_capacity ||
+        m_writer.m_output.locations.capacity() != m_locations_capacity) {
+        ++m_writer.m_allocation_count;
+    }
 }
 
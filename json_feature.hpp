@@ -1,17 +1,14 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wold-style-cast"
-#define RAPIDJSON_HAS_STDSTRING 1
-#include <rapidjson/writer.h>
-#include <rapidjson/stringbuffer.h>
-#pragma GCC diagnostic pop
-
-#include <osmium/geom/rapid_geojson.hpp>
 #include <osmium/osm.hpp>
 
+#include "geojson_factory.hpp"
+#include "property_options.hpp"
+
 struct attribute_names {
 
     std::string id;
@@ -22,6 +19,23 @@ struct attribute_names {
     std::string user;
     std::string timestamp;
 
+    // The names as escaped JSON strings followed by a colon, ready to be
+    // copied into the output.
+    std::string id_key;
+    std::string type_key;
+    std::string version_key;
+    std::string changeset_key;
+    std::string uid_key;
+    std::string user_key;
+    std::string timestamp_key;
+
+    static std::string make_key(const std::string& name) {
+        std::string key;
+        append_json_string(key, name);
+        key += ':';
+        return key;
+    }
+
     attribute_names(const std::string& prefix) :
         id(prefix + "id"),
         type(prefix + "type"),
@@ -29,54 +43,145 @@ struct attribute_names {
         changeset(prefix + "changeset"),
         uid(prefix + "uid"),
         user(prefix + "user"),
-        timestamp(prefix + "timestamp") {
+        timestamp(prefix + "timestamp"),
+        id_key(make_key(id)),
+        type_key(make_key(type)),
+        version_key(make_key(version)),
+        changeset_key(make_key(changeset)),
+        uid_key(make_key(uid)),
+        user_key(make_key(user)),
+        timestamp_key(make_key(timestamp)) {
     }
 
 }; // struct attribute_names
 
 
-using writer_type = rapidjson::Writer<rapidjson::StringBuffer>;
+/**
+ * Everything needed to write GeoJSON features that can be kept from one
+ * feature to the next: the geometry factory, the space for locations and
+ * the attribute names. Each handler owns one, the features are written
+ * with JSONFeature.
+ *
+ * Writing a feature doesn't allocate memory unless the output buffer or
+ * the space for locations has to grow (or a geometry error is thrown).
+ * This is counted in allocation_count().
+ */
+class JSONFeatureWriter {
+
+    geojson_output m_output;
+    geojson_factory_type m_factory;
+    attribute_names m_attr_names;
+    property_options m_properties;
+    std::uint64_t m_feature_count;
+    std::uint64_t m_allocation_count;
+
+    friend class JSONFeature;
 
+public:
+
+    /**
+     * @param precision Number of decimal places of coordinates (0 to 7).
+     * @param properties Attributes and tags to write.
+     */
+    JSONFeatureWriter(const std::string& attr_prefix, unsigned int precision = max_coordinate_precision, const property_options& properties = property_options{}) :
+        m_output(),
+        m_factory(m_output, precision),
+        m_attr_names(attr_prefix),
+        m_properties(properties),
+        m_feature_count(0),
+        m_allocation_count(0) {
+    }
+
+    // The factory refers to m_output.
+    JSONFeatureWriter(const JSONFeatureWriter&) = delete;
+    JSONFeatureWriter& operator=(const JSONFeatureWriter&) = delete;
+
+    const attribute_names& attr_names() const noexcept {
+        return m_attr_names;
+    }
+
+    /// Number of features written.
+    std::uint64_t feature_count() const noexcept {
+        return m_feature_count;
+    }
+
+    /// Number of features during which the output buffer or the space
+    /// for locations had to grow.
+    std::uint64_t allocation_count() const noexcept {
+        return m_allocation_count;
+    }
+
+    void reset_counts() noexcept {
+        m_feature_count = 0;
+        m_allocation_count = 0;
+    }
+
+}; // class JSONFeatureWriter
+
+/**
+ * Writes one GeoJSON feature directly into an output buffer using the
+ * writer. Call add_id() (optional), one of the add_* functions for the
+ * geometry and add_properties() in this order, then finish(). If the
+ * feature is destroyed without finish() being called, for instance
+ * because the geometry could not be created, everything it has written
+ * is removed from the buffer again.
+ */
 class JSONFeature {
 
-    rapidjson::StringBuffer m_stream;
-    writer_type m_writer;
-    osmium::geom::RapidGeoJSONFactory<writer_type> m_factory;
-    const attribute_names& m_attr_names;
+    JSONFeatureWriter& m_writer;
+    std::string& m_buffer;
+    std::size_t m_start;
+    std::size_t m_buffer_capacity;
+    std::size_t m_locations_capacity;
+    bool m_finished;
 
 public:
 
-    JSONFeature(const attribute_names& attr_names) :
-        m_stream(),
-        m_writer(m_stream),
-        m_factory(m_writer),
-        m_attr_names(attr_names) {
-        m_writer.StartObject();
-        m_writer.Key("type");
-        m_writer.String("Feature");
+    JSONFeature(JSONFeatureWriter& writer, std::string& buffer) :
+        m_writer(writer),
+        m_buffer(buffer),
+        m_start(buffer.size()),
+        m_buffer_capacity(buffer.capacity()),
+        m_locations_capacity(writer.m_output.locations.capacity()),
+        m_finished(false) {
+        m_writer.m_output.buffer = &buffer;
+        m_buffer.append("{\"type\":\"Feature\"");
+    }
+
+    JSONFeature(const JSONFeature&) = delete;
+    JSONFeature& operator=(const JSONFeature&) = delete;
+
+    ~JSONFeature() noexcept {
+        if (!m_finished) {
+            m_buffer.resize(m_start);
+        }
     }
 
     void add_point(const osmium::Node& node) {
-        m_factory.create_point(node);
+        m_writer.m_factory.create_point(node);
     }
 
     void add_linestring(const osmium::Way& way) {
-        m_factory.create_linestring(way);
+        m_writer.m_factory.create_linestring(way);
     }
 
     void add_polygon(const osmium::Way& way) {
-        m_factory.create_polygon(way);
+        m_writer.m_factory.create_polygon(way);
     }
 
     void add_multipolygon(const osmium::Area& area) {
-        m_factory.create_multipolygon(area);
+        m_writer.m_factory.create_multipolygon(area);
     }
 
-    void add_id(const std::string& prefix, osmium::object_id_type id);
+    /**
+     * Add the feature id made of prefix and id. The prefix is written as
+     * is, it must not contain characters that need escaping.
+     */
+    void add_id(const char* prefix, osmium::object_id_type id);
 
     void add_properties(const osmium::OSMObject& object);
 
-    void append_to(std::string& buffer);
+    void finish();
 
 }; // class JSONFeature
 
@@ -1,21 +1,168 @@
 
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <system_error>
 #include <unistd.h>
 
 #include <osmium/osm.hpp>
 
 #include "json_handler.hpp"
 
-void JSONHandler::flush_to_output() {
-    const auto written = write(1, m_buffer.data(), m_buffer.size());
-    assert(written == long(m_buffer.size()));
-    m_buffer.clear();
+namespace {
+
+    // Must match the number in output_options::num_shards().
+    const char* const type_shard_names[] = { "n", "w", "wl", "wp", "a" };
+
+} // anonymous namespace
+
+std::size_t JSONHandler::shard_index(const char* type, osmium::object_id_type id) const noexcept {
+    if (m_shards.size() == 1) {
+        return 0;
+    }
+
+    if (m_output_options.shard_by == shard_type::type) {
+        for (std::size_t i = 0; i < m_shards.size(); ++i) {
+            if (!std::strcmp(type, type_shard_names[i])) {
+                return i;
+            }
+        }
+        assert(false && "unknown feature type");
+    }
+
+    // Mix the bits so that consecutive IDs are spread evenly.
+    std::uint64_t hash = static_cast<std::uint64_t>(id) * 0x9e3779b97f4a7c15ULL;
+    hash ^= hash >> 32;
+    return static_cast<std::size_t>(hash % m_shards.size());
+}
+
+void JSONHandler::flush_to_output(shard& s) {
+    s.writer->submit(s.buffer);
+    if (s.buffer.capacity() < m_output_options.buffer_size) {
+        s.buffer.reserve(m_output_options.buffer_size + 64 * 1024);
+    }
+}
+
+void JSONHandler::open_shard(shard& s, const std::string& filename) {
+    if (!filename.empty()) {
+        s.fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (s.fd < 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can not open output file '"} + filename + "'"};
+        }
+    }
+
+    const bool compress = filename.size() > 3 && filename.compare(filename.size() - 3, 3, ".gz") == 0;
+    if (compress) {
+        // Enough slots to keep all compression threads busy.
+        const std::size_t threads = std::max<std::size_t>(m_output_options.compression_threads, 1);
+        const std::size_t queue_depth = std::max(m_output_options.queue_depth, threads * 2);
+        s.writer.reset(new OutputWriter{s.fd, queue_depth, threads});
+    } else {
+        s.writer.reset(new OutputWriter{s.fd, m_output_options.queue_depth});
+    }
+
+    s.buffer.reserve(m_output_options.buffer_size + 64 * 1024);
+}
+
+void JSONHandler::open_output() {
+    if (m_output_options.shard_prefix.empty()) {
+        open_shard(m_shards.front(), m_output_options.filename);
+    } else {
+        const std::size_t digits = std::to_string(m_shards.size() - 1).size();
+        for (std::size_t i = 0; i < m_shards.size(); ++i) {
+            std::string name;
+            if (m_output_options.shard_by == shard_type::type) {
+                name = type_shard_names[i];
+            } else {
+                name = std::to_string(i);
+                name.insert(0, digits - name.size(), '0');
+            }
+            open_shard(m_shards[i], m_output_options.shard_prefix + name + ".geojson");
+        }
+    }
+    m_output_open = true;
+}
+
+void JSONHandler::close_output() {
+    if (!m_output_open) {
+        return;
+    }
+    for (auto& s : m_shards) {
+        if (!s.buffer.empty()) {
+            flush_to_output(s);
+        }
+        s.writer->close();
+        if (s.fd != 1) {
+            const int fd = s.fd;
+            s.fd = 1;
+            if (::close(fd) != 0) {
+                throw std::system_error{errno, std::system_category(), "Error closing output file"};
+            }
+        }
+    }
+    m_output_open = false;
+}
+
+double JSONHandler::output_stall_time() const {
+    double time = 0.0;
+    for (const auto& s : m_shards) {
+        if (s.writer) {
+            time += s.writer->stall_time();
+        }
+    }
+    return time;
 }
 
 void JSONHandler::report_geometry_problem(const osmium::OSMObject& object, const char* error) {
     ++m_geometry_error_count;
-    if (m_error_stream) {
+    if (!m_output_open) {
+        m_error_buffer += osmium::item_type_to_char(object.type());
+        m_error_buffer += std::to_string(object.id());
+        m_error_buffer += ':';
+        m_error_buffer += error;
+        m_error_buffer += '\n';
+    } else if (m_error_stream) {
         *m_error_stream << osmium::item_type_to_char(object.type()) << object.id() << ":" << error << "\n";
     }
 }
 
+void JSONHandler::take_output(handler_output& output) {
+    output.features.resize(m_shards.size());
+    for (std::size_t i = 0; i < m_shards.size(); ++i) {
+        const std::size_t size = m_shards[i].buffer.size();
+        output.features[i].clear();
+        output.features[i].swap(m_shards[i].buffer);
+        // The next osmium buffer will probably need about as much, so
+        // allocate it once now instead of growing step by step.
+        m_shards[i].buffer.reserve(size);
+    }
+    output.errors.clear();
+    output.errors.swap(m_error_buffer);
+    output.geometry_error_count = m_geometry_error_count;
+    m_geometry_error_count = 0;
+    output.rejected_geometry_count = m_rejected_geometry_count;
+    m_rejected_geometry_count = 0;
+    output.feature_count = m_feature_writer.feature_count();
+    output.allocation_count = m_feature_writer.allocation_count();
+    m_feature_writer.reset_counts();
+}
+
+void JSONHandler::add_output(const handler_output& output) {
+    assert(output.features.size() == m_shards.size());
+    for (std::size_t i = 0; i < m_shards.size(); ++i) {
+        m_shards[i].buffer.append(output.features[i]);
+    }
+    if (m_error_stream) {
+        *m_error_stream << output.errors;
+    }
+    m_geometry_error_count += output.geometry_error_count;
+    m_rejected_geometry_count += output.rejected_geometry_count;
+    m_added_feature_count += output.feature_count;
+    m_added_allocation_count += output.allocation_count;
+    maybe_flush();
+}
+
@@ -1,62 +1,149 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <fstream>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <osmium/handler.hpp>
+#include <osmium/osm/types.hpp>
 
+#include "geometry_check.hpp"
 #include "json_feature.hpp"
+#include "output_writer.hpp"
 
 namespace osmium {
     class OSMObject;
 }
 
+/**
+ * Output of a handler collected in memory. Used to move the output of the
+ * handlers on the worker threads to the handler doing the actual output.
+ */
+struct handler_output {
+
+    std::vector<std::string> features;
+    std::string errors;
+    int geometry_error_count = 0;
+    int rejected_geometry_count = 0;
+    std::uint64_t feature_count = 0;
+    std::uint64_t allocation_count = 0;
+
+}; // struct handler_output
+
+/**
+ * Base class for the handlers creating GeoJSON. The output is collected
+ * in memory until open_output() is called, after that it is written to
+ * stdout or the output file(s) from a separate writer thread.
+ *
+ * If sharding is enabled in the output options, every feature goes into
+ * one of several shards, each with its own buffer, writer and file.
+ */
 class JSONHandler : public osmium::handler::Handler {
 
-    std::string m_buffer;
-    attribute_names m_attr_names;
+    struct shard {
+        std::string buffer;
+        std::unique_ptr<OutputWriter> writer;
+        int fd = 1;
+    };
+
+    std::vector<shard> m_shards;
+    std::string m_error_buffer;
+    JSONFeatureWriter m_feature_writer;
+    output_options m_output_options;
     std::unique_ptr<std::ofstream> m_error_stream;
     int m_geometry_error_count;
+
+    // Geometry errors found by the checks in geometry_check.hpp, these
+    // are also counted in m_geometry_error_count.
+    int m_rejected_geometry_count;
+
+    // Counts of features written by other handlers (see add_output()).
+    std::uint64_t m_added_feature_count;
+    std::uint64_t m_added_allocation_count;
     bool m_with_id;
+    bool m_output_open;
+
+    std::size_t shard_index(const char* type, osmium::object_id_type id) const noexcept;
+
+    void open_shard(shard& s, const std::string& filename);
 
-    void flush_to_output();
+    void flush_to_output(shard& s);
 
 protected:
 
-    std::string& buffer() noexcept {
-        return m_buffer;
+    /**
+     * The buffer a feature should be appended to. The type is the type
+     * prefix also used for the feature id ("n", "w", "wl", "wp", or "a").
+     */
+    std::string& buffer(const char* type, osmium::object_id_type id) noexcept {
+        return m_shards[shard_index(type, id)].buffer;
     }
 
-    const attribute_names& attr_names() const noexcept {
-         return m_attr_names;
+    JSONFeatureWriter& feature_writer() noexcept {
+        return m_feature_writer;
     }
 
     bool with_id() const noexcept {
         return m_with_id;
     }
 
+    /// Should an object with these tags be written (see --filter)?
+    bool selected(const osmium::TagList& tags) const noexcept {
+        return m_output_options.filter.match(tags);
+    }
+
     void maybe_flush() {
-        if (m_buffer.size() > 1024*1024) {
-            flush_to_output();
+        if (!m_output_open) {
+            return;
+        }
+        for (auto& s : m_shards) {
+            if (s.buffer.size() > m_output_options.buffer_size) {
+                flush_to_output(s);
+            }
         }
     }
 
     void report_geometry_problem(const osmium::OSMObject& object, const char* error);
 
-    JSONHandler(const std::string& error_file, const std::string& attr_prefix, bool with_id) :
-        m_buffer(),
-        m_attr_names(attr_prefix),
+    /**
+     * Report a problem found by one of the geometry checks. Returns true
+     * if there is a problem, the object should not be written then.
+     */
+    bool reject_geometry(const osmium::OSMObject& object, geometry_check check) {
+        if (check == geometry_check::ok) {
+            return false;
+        }
+        ++m_rejected_geometry_count;
+        report_geometry_problem(object, geometry_check_name(check));
+        return true;
+    }
+
+    JSONHandler(const std::string& error_file, const std::string& attr_prefix, bool with_id, const output_options& options) :
+        m_shards(options.num_shards()),
+        m_error_buffer(),
+        m_feature_writer(attr_prefix, options.coordinate_precision, options.properties),
+        m_output_options(options),
         m_error_stream(nullptr),
         m_geometry_error_count(0),
-        m_with_id(with_id) {
+        m_rejected_geometry_count(0),
+        m_added_feature_count(0),
+        m_added_allocation_count(0),
+        m_with_id(with_id),
+        m_output_open(false) {
         if (!error_file.empty()) {
             m_error_stream.reset(new std::ofstream(error_file));
         }
     }
 
     ~JSONHandler() {
-        flush_to_output();
+        try {
+            close_output();
+        } catch (...) {
+            // ignore errors here, call close_output() explicitly to see them
+        }
     }
 
 public:
@@ -65,5 +152,55 @@ public:
         return m_geometry_error_count;
     }
 
+    /// Number of geometry errors found before creating the geometry.
+    int rejected_geometry_count() const {
+        return m_rejected_geometry_count;
+    }
+
+    /// Number of features written.
+    std::uint64_t feature_count() const noexcept {
+        return m_feature_writer.feature_count() + m_added_feature_count;
+    }
+
+    /// Number of features for which memory had to be allocated, see
+    /// JSONFeatureWriter::allocation_count().
+    std::uint64_t feature_allocation_count() const noexcept {
+        return m_feature_writer.allocation_count() + m_added_allocation_count;
+    }
+
+    /**
+     * Start writing output to the file(s) set in the output options or
+     * stdout. Without this all features and error reports are kept in
+     * memory, they can be retrieved with take_output().
+     *
+     * @throws std::system_error if an output file can not be opened.
+     */
+    void open_output();
+
+    /**
+     * Write out everything still buffered and wait for the writer threads.
+     *
+     * @throws std::system_error if writing or closing an output file
+     *         fails.
+     */
+    void close_output();
+
+    /**
+     * Time in seconds the output was stalled because the writer threads
+     * couldn't keep up.
+     */
+    double output_stall_time() const;
+
+    /**
+     * Move everything collected so far into output.
+     */
+    void take_output(handler_output& output);
+
+    /**
+     * Write output collected by another handler as if it was created by
+     * this handler. The other handler must have the same output options.
+     */
+    void add_output(const handler_output& output);
+
 }; // class JSONHandler
 
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <string>
+#include <utility>
+
+#include <osmium/geom/tile.hpp>
+#include <osmium/osm.hpp>
+
+#include "area_classifier.hpp"
+#include "geometry_check.hpp"
+#include "json_feature.hpp"
+#include "json_handler.hpp"
+#include "output_writer.hpp"
+#include "tile_index.hpp"
+
+/**
+ * Creates GeoJSON for nodes and ways. Closed ways the area classifier
+ * decides are areas are written as polygons if create_polygons is set.
+ * If tiles is not nullptr only objects in those tiles are written.
+ */
+class JSONNoAreaHandler : public JSONHandler {
+
+    bool m_create_polygons;
+    const TileIndex* m_tiles;
+    unsigned int m_zoom;
+    const AreaClassifier& m_areas;
+
+    std::pair<bool, bool> linestring_and_or_polygon(const osmium::Way& way) const {
+        bool output_as_linestring = true;
+        bool output_as_polygon = false;
+
+        if (way.is_closed() && m_areas.is_area(way.tags())) {
+            output_as_linestring = false;
+            output_as_polygon = true;
+        }
+
+        return std::make_pair(output_as_linestring, output_as_polygon);
+    }
+
+public:
+
+    JSONNoAreaHandler(unsigned int zoom, const std::string& error_file, const std::string& attr_prefix, bool with_id, bool create_polygons, const AreaClassifier& areas, const TileIndex* tiles, const output_options& output) :
+        JSONHandler(error_file, attr_prefix, with_id, output),
+        m_create_polygons(create_polygons),
+        m_tiles(tiles),
+        m_zoom(zoom),
+        m_areas(areas) {
+    }
+
+    void node(const osmium::Node& node) {
+        if (node.tags().empty() || !selected(node.tags())) {
+            return;
+        }
+
+        if (reject_geometry(node, check_point(node))) {
+            return;
+        }
+
+        try {
+            osmium::geom::Tile tile{m_zoom, node.location()};
+
+            if (m_tiles && !m_tiles->contains(tile)) {
+                return;
+            }
+
+            JSONFeature feature{feature_writer(), buffer("n", node.id())};
+            if (with_id()) {
+                feature.add_id("n", node.id());
+            }
+            feature.add_point(node);
+            feature.add_properties(node);
+            feature.finish();
+        } catch (const osmium::geometry_error&) {
+            report_geometry_problem(node, "geometry_error");
+        } catch (const osmium::invalid_location&) {
+            report_geometry_problem(node, "invalid_location");
+        }
+
+        maybe_flush();
+    }
+
+    void way(const osmium::Way& way) {
+        if (way.nodes().size() <= 1 || !selected(way.tags())) {
+            return;
+        }
+
+        std::pair<bool, bool> l_p = { true, false };
+        if (m_create_polygons) {
+            l_p = linestring_and_or_polygon(way);
+        }
+
+        // Missing locations are reported before the tile check, which
+        // can't put them into any tile.
+        const geometry_check check = l_p.second ? check_polygon(way) : check_linestring(way);
+        if (check == geometry_check::invalid_location) {
+            reject_geometry(way, check);
+            return;
+        }
+
+        try {
+            if (m_tiles) {
+                bool keep = false;
+                for (auto ref : way.nodes()) {
+                    osmium::geom::Tile tile{m_zoom, ref.location()};
+                    if (m_tiles->contains(tile)) {
+                        keep = true;
+                        break;
+                    }
+                }
+
+                if (!keep) {
+                    return;
+                }
+            }
+
+            if (reject_geometry(way, check)) {
+                return;
+            }
+
+            if (l_p.first) { // output as linestring
+                JSONFeature feature{feature_writer(), buffer("wl", way.id())};
+                if (with_id()) {
+                    feature.add_id("wl", way.id());
+                }
+                feature.add_linestring(way);
+                feature.add_properties(way);
+                feature.finish();
+            }
+
+            if (l_p.second) { // output as polygon
+                JSONFeature feature{feature_writer(), buffer("wp", way.id())};
+                if (with_id()) {
+                    feature.add_id("wp", way.id());
+                }
+                feature.add_polygon(way);
+                feature.add_properties(way);
+                feature.finish();
+            }
+        } catch (const osmium::geometry_error&) {
+            report_geometry_problem(way, "geometry_error");
+        } catch (const osmium::invalid_location&) {
+            report_geometry_problem(way, "invalid_location");
+        }
+        maybe_flush();
+    }
+
+}; // class JSONNoAreaHandler
+
@@ -0,0 +1,107 @@
+
+#include <cstddef>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+# define MINJUR_ESCAPE_SIMD
+# include <immintrin.h>
+#endif
+
+#include "json_writer.hpp"
+
+namespace {
+
+    using clean_length_func = std::size_t (*)(const char*, std::size_t);
+
+    inline bool is_clean(unsigned char c) noexcept {
+        return c >= 0x20 && c != '"' && c != '\\';
+    }
+
+    std::size_t clean_length_scalar(const char* data, std::size_t size) noexcept {
+        std::size_t i = 0;
+        while (i < size && is_clean(static_cast<unsigned char>(data[i]))) {
+            ++i;
+        }
+        return i;
+    }
+
+#ifdef MINJUR_ESCAPE_SIMD
+
+    // Bit mask of the bytes in the block that have to be escaped. Bytes
+    // smaller than 0x20 are those unchanged by an unsigned min with 0x1f.
+    inline unsigned int dirty_mask_sse2(__m128i block) noexcept {
+        const __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(block, _mm_set1_epi8(0x1f)), block);
+        const __m128i quote = _mm_cmpeq_epi8(block, _mm_set1_epi8('"'));
+        const __m128i backslash = _mm_cmpeq_epi8(block, _mm_set1_epi8('\\'));
+        return static_cast<unsigned int>(_mm_movemask_epi8(_mm_or_si128(control, _mm_or_si128(quote, backslash))));
+    }
+
+    // Strings of at least 16 bytes are scanned in blocks of 16 bytes, the
+    // last block overlaps the one before so it doesn't read past the end.
+    std::size_t clean_length_sse2(const char* data, std::size_t size) noexcept {
+        if (size < 16) {
+            return clean_length_scalar(data, size);
+        }
+        std::size_t i = 0;
+        for (;; i += 16) {
+            if (i > size - 16) {
+                i = size - 16;
+            }
+            const unsigned int mask = dirty_mask_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+            if (mask) {
+                return i + static_cast<std::size_t>(__builtin_ctz(mask));
+            }
+            if (i == size - 16) {
+                return size;
+            }
+        }
+    }
+
+    __attribute__((target("avx2")))
+    std::size_t clean_length_avx2(const char* data, std::size_t size) noexcept {
+        if (size < 32) {
+            return clean_length_sse2(data, size);
+        }
+        std::size_t i = 0;
+        for (;; i += 32) {
+            if (i > size - 32) {
+                i = size - 32;
+            }
+            const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            const __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(block, _mm256_set1_epi8(0x1f)), block);
+            const __m256i quote = _mm256_cmpeq_epi8(block, _mm256_set1_epi8('"'));
+            const __m256i backslash = _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\\'));
+            const unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_or_si256(control, _mm256_or_si256(quote, backslash))));
+            if (mask) {
+                return i + static_cast<std::size_t>(__builtin_ctz(mask));
+            }
+            if (i == size - 32) {
+                return size;
+            }
+        }
+    }
+
+    clean_length_func select_clean_length() noexcept {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return clean_length_avx2;
+        }
+        return clean_length_sse2;
+    }
+
+#else
+
+    clean_length_func select_clean_length() noexcept {
+        return clean_length_scalar;
+    }
+
+#endif
+
+    // Selected once at startup, JSON is only written from main() on.
+    const clean_length_func clean_length_impl = select_clean_length();
+
+} // anonymous namespace
+
+std::size_t json_clean_length(const char* data, std::size_t size) noexcept {
+    return clean_length_impl(data, size);
+}
+
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <osmium/osm/location.hpp>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#include <rapidjson/rapidjson.h>
+#include <rapidjson/internal/dtoa.h>
+#include <rapidjson/internal/itoa.h>
+#pragma GCC diagnostic pop
+
+/*
+ * Functions appending JSON values to a string. Strings and numbers are
+ * written exactly as rapidjson::Writer with its default flags does.
+ */
+
+/**
+ * Length of the longest prefix of the data without bytes that have to be
+ * escaped in JSON strings. Scans 16 or 32 bytes at a time with SSE2 or
+ * AVX2, whichever the CPU supports (see json_writer.cpp).
+ */
+std::size_t json_clean_length(const char* data, std::size_t size) noexcept;
+
+/**
+ * Append the string in double quotes. Double quotes, backslashes and
+ * control characters are escaped, all other bytes are copied as they are.
+ */
+inline void append_json_string(std::string& out, const char* data, std::size_t size) {
+    static const char hex_digits[] = "0123456789ABCDEF";
+
+    out += '"';
+    while (true) {
+        const std::size_t clean = json_clean_length(data, size);
+        out.append(data, clean);
+        if (clean == size) {
+            break;
+        }
+        const auto c = static_cast<unsigned char>(data[clean]);
+        out += '\\';
+        switch (c) {
+            case '"':
+                out += '"';
+                break;
+            case '\\':
+                out += '\\';
+                break;
+            case '\b':
+                out += 'b';
+                break;
+            case '\f':
+                out += 'f';
+                break;
+            case '\n':
+                out += 'n';
+                break;
+            case '\r':
+                out += 'r';
+                break;
+            case '\t':
+                out += 't';
+                break;
+            default:
+                out.append("u00");
+                out += hex_digits[c >> 4];
+                out += hex_digits[c & 0xf];
+        }
+        data += clean + 1;
+        size -= clean + 1;
+    }
+    out += '"';
+}
+
+inline void append_json_string(std::string& out, const char* str) {
+    append_json_string(out, str, std::strlen(str));
+}
+
+inline void append_json_string(std::string& out, const std::string& str) {
+    append_json_string(out, str.data(), str.size());
+}
+
+inline void append_json_int(std::string& out, std::int64_t value) {
+    char buffer[20];
+    const char* end = rapidjson::internal::i64toa(value, buffer);
+    out.append(buffer, static_cast<std::size_t>(end - buffer));
+}
+
+inline void append_json_double(std::string& out, double value) {
+    char buffer[25];
+    const char* end = rapidjson::internal::dtoa(value, buffer);
+    out.append(buffer, static_cast<std::size_t>(end - buffer));
+}
+
+/// Largest number of decimal places of coordinates (the precision of
+/// osmium::Location).
+constexpr unsigned int max_coordinate_precision = 7;
+
+/// Maximum length of a coordinate written by write_coordinate().
+constexpr std::size_t max_coordinate_length = 12; // -180.0000000
+
+/**
+ * Write a coordinate given as absolute value in 1e-7 degrees and sign.
+ * The output is the shortest exact decimal of the fixed-point value. It
+ * is formatted like rapidjson::internal::dtoa() output (no trailing
+ * zeros, but at least one decimal place, exponential notation for values
+ * smaller than 1e-6) and parses to the same double, but the digits can
+ * differ: dtoa() writes 0.199975 as 0.19997500000000002.
+ *
+ * @returns Pointer to the end of the written coordinate.
+ */
+inline char* write_coordinate(char* out, std::uint32_t abs_value, bool negative) noexcept {
+    if (abs_value == 0) {
+        std::memcpy(out, "0.0", 3);
+        return out + 3;
+    }
+    if (negative) {
+        *out++ = '-';
+    }
+    if (abs_value < 10) {
+        out[0] = static_cast<char>('0' + abs_value);
+        std::memcpy(out + 1, "e-7", 3);
+        return out + 4;
+    }
+
+    std::uint32_t int_part = abs_value / 10000000;
+    std::uint32_t fraction = abs_value % 10000000;
+    if (int_part >= 100) {
+        *out++ = static_cast<char>('0' + int_part / 100);
+        int_part %= 100;
+        *out++ = static_cast<char>('0' + int_part / 10);
+    } else if (int_part >= 10) {
+        *out++ = static_cast<char>('0' + int_part / 10);
+    }
+    *out++ = static_cast<char>('0' + int_part % 10);
+    *out++ = '.';
+
+    if (fraction == 0) {
+        *out++ = '0';
+        return out;
+    }
+    int digits = static_cast<int>(max_coordinate_precision);
+    while (fraction % 10 == 0) {
+        fraction /= 10;
+        --digits;
+    }
+    char* const end = out + digits;
+    for (char* p = end; p != out; fraction /= 10) {
+        *--p = static_cast<char>('0' + fraction % 10);
+    }
+    return end;
+}
+
+/**
+ * Rounds coordinates in 1e-7 degrees to a number of decimal places using
+ * integer arithmetic only, so there are no floating point artifacts.
+ */
+class CoordinateRounder {
+
+    std::uint32_t m_unit;
+
+public:
+
+    explicit CoordinateRounder(unsigned int precision = max_coordinate_precision) noexcept :
+        m_unit(1) {
+        for (unsigned int i = precision; i < max_coordinate_precision; ++i) {
+            m_unit *= 10;
+        }
+    }
+
+    bool exact() const noexcept {
+        return m_unit == 1;
+    }
+
+    /// Round the absolute value of a coordinate, halves away from zero.
+    std::uint32_t operator()(std::uint32_t abs_value) const noexcept {
+        return (abs_value + m_unit / 2) / m_unit * m_unit;
+    }
+
+}; // class CoordinateRounder
+
+inline std::uint32_t abs_coordinate(std::int32_t value) noexcept {
+    return value < 0 ? 0 - static_cast<std::uint32_t>(value) : static_cast<std::uint32_t>(value);
+}
+
+/**
+ * Append a coordinate of a location (x or y) rounded by rounder.
+ */
+inline void append_json_coordinate(std::string& out, std::int32_t value, const CoordinateRounder& rounder) {
+    char buffer[max_coordinate_length];
+    const std::uint32_t abs_value = rounder.exact() ? abs_coordinate(value) : rounder(abs_coordinate(value));
+    const char* end = write_coordinate(buffer, abs_value, value < 0);
+    out.append(buffer, static_cast<std::size_t>(end - buffer));
+}
+
+/**
+ * Append the locations as comma separated [x,y] arrays. The locations
+ * must be valid.
+ *
+ * The locations are processed in batches: First the absolute values of
+ * all coordinates in the batch are calculated and rounded in a simple
+ * loop the compiler can vectorize, then they are written into space
+ * reserved in the output for the whole batch.
+ */
+inline void append_json_locations(std::string& out, const osmium::Location* locations, std::size_t count, const CoordinateRounder& rounder) {
+    constexpr std::size_t batch_size = 64;
+    constexpr std::size_t max_location_length = 2 * max_coordinate_length + 4; // [x,y],
+
+    std::uint32_t abs_values[2 * batch_size];
+    bool first = true;
+
+    while (count > 0) {
+        const std::size_t n = std::min(count, batch_size);
+
+        for (std::size_t i = 0; i < n; ++i) {
+            abs_values[2 * i] = abs_coordinate(locations[i].x());
+            abs_values[2 * i + 1] = abs_coordinate(locations[i].y());
+        }
+        if (!rounder.exact()) {
+            for (std::size_t i = 0; i < 2 * n; ++i) {
+                abs_values[i] = rounder(abs_values[i]);
+            }
+        }
+
+        const std::size_t old_size = out.size();
+        out.resize(old_size + n * max_location_length);
+        char* const begin = &out[old_size];
+        char* p = begin;
+        for (std::size_t i = 0; i < n; ++i) {
+            if (!first) {
+                *p++ = ',';
+            }
+            first = false;
+            *p++ = '[';
+            p = write_coordinate(p, abs_values[2 * i], locations[i].x() < 0);
+            *p++ = ',';
+            p = write_coordinate(p, abs_values[2 * i + 1], locations[i].y() < 0);
+            *p++ = ']';
+        }
+        out.resize(old_size + static_cast<std::size_t>(p - begin));
+
+        locations += n;
+        count -= n;
+    }
+}
+
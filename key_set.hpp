@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * Set of strings (usually tag keys) optimized for lookups of
+ * null-terminated strings as they come from osmium. Every string gets an
+ * index in the order it was inserted.
+ *
+ * The strings are kept in an open addressing hash table with linear
+ * probing which is kept at most half full.
+ */
+class KeySet {
+
+    static constexpr std::uint32_t empty_slot = 0;
+
+    std::vector<std::string> m_keys;
+
+    // Indexes into m_keys plus 1, so 0 marks empty slots.
+    std::vector<std::uint32_t> m_table;
+    unsigned int m_table_bits;
+
+    void insert_slot(std::uint64_t hash, std::uint32_t index) noexcept {
+        const std::size_t mask = m_table.size() - 1;
+        std::size_t i = slot(hash, m_table_bits);
+        while (m_table[i] != empty_slot) {
+            i = (i + 1) & mask;
+        }
+        m_table[i] = index + 1;
+    }
+
+public:
+
+    /// FNV-1a of the null-terminated string, also returns its length.
+    static std::uint64_t hash(const char* str, std::size_t& length) noexcept {
+        std::uint64_t hash = 0xcbf29ce484222325ULL;
+        const char* p = str;
+        for (; *p; ++p) {
+            hash = (hash ^ static_cast<unsigned char>(*p)) * 0x100000001b3ULL;
+        }
+        length = static_cast<std::size_t>(p - str);
+        return hash;
+    }
+
+    /// Slot for the hash in a table with 2^bits slots.
+    static std::size_t slot(std::uint64_t hash, unsigned int bits) noexcept {
+        return static_cast<std::size_t>((hash * 0x9e3779b97f4a7c15ULL) >> (64 - bits));
+    }
+
+    static bool equal(const std::string& str, const char* data, std::size_t length) noexcept {
+        return str.size() == length && !std::memcmp(str.data(), data, length);
+    }
+
+    KeySet() :
+        m_keys(),
+        m_table(2),
+        m_table_bits(1) {
+    }
+
+    bool empty() const noexcept {
+        return m_keys.empty();
+    }
+
+    std::size_t size() const noexcept {
+        return m_keys.size();
+    }
+
+    /**
+     * Look up a string whose length and hash were already calculated
+     * with hash(). Returns false if it is not in the set.
+     */
+    bool find(const char* key, std::size_t length, std::uint64_t hash, std::uint32_t& index) const noexcept {
+        const std::size_t mask = m_table.size() - 1;
+        for (std::size_t i = slot(hash, m_table_bits); m_table[i] != empty_slot; i = (i + 1) & mask) {
+            if (equal(m_keys[m_table[i] - 1], key, length)) {
+                index = m_table[i] - 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool find(const char* key, std::uint32_t& index) const noexcept {
+        std::size_t length;
+        const std::uint64_t h = hash(key, length);
+        return find(key, length, h, index);
+    }
+
+    bool contains(const char* key) const noexcept {
+        std::uint32_t index;
+        return find(key, index);
+    }
+
+    /**
+     * Insert a string if it is not in the set already.
+     *
+     * @returns The index of the string.
+     */
+    std::uint32_t insert(const char* key) {
+        std::size_t length;
+        const std::uint64_t h = hash(key, length);
+        std::uint32_t index;
+        if (find(key, length, h, index)) {
+            return index;
+        }
+
+        index = static_cast<std::uint32_t>(m_keys.size());
+        m_keys.emplace_back(key, length);
+
+        if (m_keys.size() * 2 > m_table.size()) {
+            std::vector<std::uint32_t> table(m_table.size() * 2);
+            m_table.swap(table);
+            ++m_table_bits;
+            for (std::uint32_t i = 0; i < m_keys.size(); ++i) {
+                insert_slot(hash(m_keys[i].c_str(), length), i);
+            }
+        } else {
+            insert_slot(h, index);
+        }
+
+        return index;
+    }
+
+}; // class KeySet
+
@@ -0,0 +1,766 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+#include <zlib.h>
+
+#include <osmium/index/index.hpp>
+#include <osmium/osm/timestamp.hpp>
+
+#include "location_dump.hpp"
+
+namespace {
+
+    const char dump_magic[] = "MJLOCDMP";
+    const std::uint32_t dump_version = 1;
+    const std::uint64_t dump_header_size = 4096;
+    const std::uint64_t dump_chunk_size = 1024 * 1024;
+
+    struct dump_header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t kind;
+        std::uint64_t payload_offset;
+        std::uint64_t payload_size;
+        std::uint64_t chunk_size;
+        std::uint64_t num_chunks;
+        std::uint64_t checksums_offset;
+        std::uint64_t min_id;
+        std::uint64_t max_id;
+        std::uint64_t count;
+        std::uint64_t replication_sequence;
+        std::uint64_t replication_timestamp;
+        std::uint32_t header_checksum;
+        std::uint32_t reserved;
+    };
+
+    static_assert(sizeof(dump_header) == 104, "unexpected size of location dump header");
+
+    using id_location_pair = std::pair<osmium::unsigned_object_id_type, osmium::Location>;
+
+    std::uint32_t checksum(const void* data, std::size_t size) noexcept {
+        return static_cast<std::uint32_t>(::crc32(0, static_cast<const Bytef*>(data), static_cast<uInt>(size)));
+    }
+
+    std::uint32_t header_checksum(dump_header header) noexcept {
+        header.header_checksum = 0;
+        return checksum(&header, sizeof(header));
+    }
+
+    void pwrite_all(int fd, const void* buffer, std::size_t size, off_t offset) {
+        const char* data = static_cast<const char*>(buffer);
+        while (size > 0) {
+            const auto written = ::pwrite(fd, data, size, offset);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error{errno, std::system_category(), "Error writing location dump"};
+            }
+            data += written;
+            size -= static_cast<std::size_t>(written);
+            offset += written;
+        }
+    }
+
+    void write_all(int fd, const void* buffer, std::size_t size) {
+        const char* data = static_cast<const char*>(buffer);
+        while (size > 0) {
+            const auto written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error{errno, std::system_category(), "Error writing location dump"};
+            }
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+    }
+
+    void pread_all(int fd, void* buffer, std::size_t size, off_t offset) {
+        char* data = static_cast<char*>(buffer);
+        while (size > 0) {
+            const auto length = ::pread(fd, data, size, offset);
+            if (length <= 0) {
+                if (length < 0 && errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error{length < 0 ? errno : EIO, std::system_category(), "Error reading location dump"};
+            }
+            data += length;
+            size -= static_cast<std::size_t>(length);
+            offset += length;
+        }
+    }
+
+    std::uint64_t num_chunks(std::uint64_t payload_size) noexcept {
+        return (payload_size + dump_chunk_size - 1) / dump_chunk_size;
+    }
+
+    // Calculate checksums for all chunks of the payload on num_threads
+    // threads. Also gets the ID range and number of nodes of dense dumps.
+    void checksum_payload(const char* payload, std::uint64_t payload_size, std::size_t num_threads,
+                          std::vector<std::uint32_t>& checksums, dump_header& header) {
+        const std::uint64_t chunks = num_chunks(payload_size);
+        checksums.resize(chunks);
+
+        struct dense_stats {
+            std::uint64_t min_id = static_cast<std::uint64_t>(-1);
+            std::uint64_t max_id = 0;
+            std::uint64_t count = 0;
+        };
+        std::vector<dense_stats> stats(num_threads);
+        const bool dense = header.kind == static_cast<std::uint32_t>(location_dump_kind::dense);
+
+        std::vector<std::thread> threads;
+        for (std::size_t t = 0; t < num_threads; ++t) {
+            threads.emplace_back([&, t]() {
+                for (std::uint64_t chunk = t; chunk < chunks; chunk += num_threads) {
+                    const std::uint64_t begin = chunk * dump_chunk_size;
+                    const std::uint64_t size = std::min(dump_chunk_size, payload_size - begin);
+                    checksums[chunk] = checksum(payload + begin, size);
+                    if (dense) {
+                        const auto* locations = reinterpret_cast<const osmium::Location*>(payload + begin);
+                        for (std::uint64_t i = 0; i < size / sizeof(osmium::Location); ++i) {
+                            if (locations[i] != osmium::Location{}) {
+                                const std::uint64_t id = begin / sizeof(osmium::Location) + i;
+                                stats[t].min_id = std::min(stats[t].min_id, id);
+                                stats[t].max_id = std::max(stats[t].max_id, id);
+                                ++stats[t].count;
+                            }
+                        }
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        if (dense) {
+            header.min_id = static_cast<std::uint64_t>(-1);
+            for (const auto& s : stats) {
+                header.min_id = std::min(header.min_id, s.min_id);
+                header.max_id = std::max(header.max_id, s.max_id);
+                header.count += s.count;
+            }
+            if (header.count == 0) {
+                header.min_id = 0;
+            }
+        }
+    }
+
+    void set_id_range(const char* payload, std::uint64_t payload_size, dump_header& header) {
+        if (header.kind == static_cast<std::uint32_t>(location_dump_kind::sparse)) {
+            const auto* pairs = reinterpret_cast<const id_location_pair*>(payload);
+            header.count = payload_size / sizeof(id_location_pair);
+            if (header.count > 0) {
+                header.min_id = pairs[0].first;
+                header.max_id = pairs[header.count - 1].first;
+            }
+        } else if (header.kind == static_cast<std::uint32_t>(location_dump_kind::succinct)) {
+            SuccinctImage image;
+            if (!image.init(payload, payload_size)) {
+                throw std::runtime_error{"Invalid succinct location store image"};
+            }
+            header.count = image.size();
+            if (header.count > 0) {
+                std::uint64_t id = 0;
+                while (!image.find(id)) {
+                    ++id;
+                }
+                header.min_id = id;
+                id = image.num_words() * 64 - 1;
+                while (!image.find(id)) {
+                    --id;
+                }
+                header.max_id = id;
+            }
+        }
+    }
+
+    // Read and check the header of the location dump in the open file.
+    dump_header read_dump_header(int fd, const std::string& filename, std::uint64_t file_size) {
+        dump_header header;
+        if (file_size < dump_header_size || ::pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+            std::memcmp(header.magic, dump_magic, sizeof(header.magic)) != 0) {
+            throw std::runtime_error{"'" + filename + "' is not a location dump. Use the sparse_file_array or dense_file_array location store for raw dumps"};
+        }
+
+        if (header.version != dump_version) {
+            throw std::runtime_error{"Location dump '" + filename + "' has unknown version " + std::to_string(header.version)};
+        }
+
+        if (header.header_checksum != header_checksum(header) ||
+            header.payload_offset != dump_header_size ||
+            header.chunk_size == 0 ||
+            header.num_chunks != (header.payload_size + header.chunk_size - 1) / header.chunk_size ||
+            header.checksums_offset < header.payload_offset + header.payload_size ||
+            header.checksums_offset + header.num_chunks * sizeof(std::uint32_t) != file_size ||
+            header.kind < static_cast<std::uint32_t>(location_dump_kind::dense) ||
+            header.kind > static_cast<std::uint32_t>(location_dump_kind::succinct)) {
+            throw std::runtime_error{"Location dump '" + filename + "' is corrupt or incomplete"};
+        }
+
+        return header;
+    }
+
+    // Write a dump to filename.tmp and rename it when it is complete. The
+    // payload is written by write_payload(fd) at the current file position.
+    template <typename TFunc>
+    void write_dump_file(const std::string& filename,
+                         location_dump_kind kind,
+                         std::uint64_t replication_sequence,
+                         std::uint64_t replication_timestamp,
+                         std::size_t num_threads,
+                         TFunc&& write_payload) {
+        const std::string tmp_filename = filename + ".tmp";
+        const int fd = ::open(tmp_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::system_error{errno, std::system_category(), "Can not open location dump '" + tmp_filename + "'"};
+        }
+
+        void* payload = MAP_FAILED;
+        std::uint64_t payload_size = 0;
+        try {
+            if (::lseek(fd, static_cast<off_t>(dump_header_size), SEEK_SET) < 0) {
+                throw std::system_error{errno, std::system_category(), "Error writing location dump"};
+            }
+            write_payload(fd);
+
+            const off_t end = ::lseek(fd, 0, SEEK_CUR);
+            if (end < 0) {
+                throw std::system_error{errno, std::system_category(), "Error writing location dump"};
+            }
+            payload_size = static_cast<std::uint64_t>(end) - dump_header_size;
+
+            dump_header header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, dump_magic, sizeof(header.magic));
+            header.version = dump_version;
+            header.kind = static_cast<std::uint32_t>(kind);
+            header.payload_offset = dump_header_size;
+            header.payload_size = payload_size;
+            header.chunk_size = dump_chunk_size;
+            header.num_chunks = num_chunks(payload_size);
+            header.checksums_offset = (dump_header_size + payload_size + 7) & ~std::uint64_t(7);
+            header.replication_sequence = replication_sequence;
+            header.replication_timestamp = replication_timestamp;
+
+            std::vector<std::uint32_t> checksums;
+            if (payload_size > 0) {
+                payload = ::mmap(nullptr, static_cast<std::size_t>(dump_header_size + payload_size), PROT_READ, MAP_SHARED, fd, 0);
+                if (payload == MAP_FAILED) {
+                    throw std::system_error{errno, std::system_category(), "Can not map location dump"};
+                }
+                const char* data = static_cast<const char*>(payload) + dump_header_size;
+                checksum_payload(data, payload_size, std::max(num_threads, std::size_t(1)), checksums, header);
+                set_id_range(data, payload_size, header);
+                ::munmap(payload, static_cast<std::size_t>(dump_header_size + payload_size));
+                payload = MAP_FAILED;
+            }
+
+            const std::uint64_t padding = 0;
+            pwrite_all(fd, &padding, header.checksums_offset - dump_header_size - payload_size, static_cast<off_t>(dump_header_size + payload_size));
+            pwrite_all(fd, checksums.data(), checksums.size() * sizeof(std::uint32_t), static_cast<off_t>(header.checksums_offset));
+
+            if (::fsync(fd) != 0) {
+                throw std::system_error{errno, std::system_category(), "Error writing location dump"};
+            }
+
+            header.header_checksum = header_checksum(header);
+            pwrite_all(fd, &header, sizeof(header), 0);
+
+            if (::fsync(fd) != 0) {
+                throw std::system_error{errno, std::system_category(), "Error writing location dump"};
+            }
+        } catch (...) {
+            if (payload != MAP_FAILED) {
+                ::munmap(payload, static_cast<std::size_t>(dump_header_size + payload_size));
+            }
+            ::close(fd);
+            ::unlink(tmp_filename.c_str());
+            throw;
+        }
+
+        if (::close(fd) != 0) {
+            throw std::system_error{errno, std::system_category(), "Error writing location dump"};
+        }
+        if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+            throw std::system_error{errno, std::system_category(), "Can not rename location dump to '" + filename + "'"};
+        }
+    }
+
+    // Update a dense dump in place: Write the changed locations at their
+    // positions and recalculate the checksums of the chunks that changed.
+    void update_dense_dump(const std::string& filename,
+                           const std::vector<location_change>& changes,
+                           std::uint64_t replication_sequence,
+                           std::uint64_t replication_timestamp,
+                           std::size_t num_threads) {
+        const int fd = ::open(filename.c_str(), O_RDWR);
+        if (fd < 0) {
+            throw std::system_error{errno, std::system_category(), "Can not open location dump '" + filename + "'"};
+        }
+
+        void* data = MAP_FAILED;
+        std::size_t data_size = 0;
+        try {
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                throw std::system_error{errno, std::system_category(), "Can not read location dump '" + filename + "'"};
+            }
+            dump_header header = read_dump_header(fd, filename, static_cast<std::uint64_t>(st.st_size));
+
+            std::vector<std::uint32_t> checksums(header.num_chunks);
+            pread_all(fd, checksums.data(), checksums.size() * sizeof(std::uint32_t), static_cast<off_t>(header.checksums_offset));
+
+            // Invalidate the dump until the update is complete.
+            dump_header invalid_header = header;
+            std::memset(invalid_header.magic, 0, sizeof(invalid_header.magic));
+            pwrite_all(fd, &invalid_header, sizeof(invalid_header), 0);
+            if (::fsync(fd) != 0) {
+                throw std::system_error{errno, std::system_category(), "Error writing location dump"};
+            }
+
+            const std::uint64_t old_size = header.payload_size / sizeof(osmium::Location);
+            std::uint64_t new_size = old_size;
+            for (const auto& change : changes) {
+                if (change.second) {
+                    new_size = std::max(new_size, change.first + 1);
+                }
+            }
+
+            const std::uint64_t chunk_size = header.chunk_size;
+            std::vector<bool> dirty((new_size * sizeof(osmium::Location) + chunk_size - 1) / chunk_size);
+
+            if (new_size > old_size) {
+                const std::vector<osmium::Location> empty(1024 * 1024);
+                for (std::uint64_t id = old_size; id < new_size; id += empty.size()) {
+                    const std::uint64_t count = std::min<std::uint64_t>(empty.size(), new_size - id);
+                    pwrite_all(fd, empty.data(), static_cast<std::size_t>(count * sizeof(osmium::Location)),
+                               static_cast<off_t>(dump_header_size + id * sizeof(osmium::Location)));
+                }
+                for (std::uint64_t chunk = old_size * sizeof(osmium::Location) / chunk_size; chunk < dirty.size(); ++chunk) {
+                    dirty[chunk] = true;
+                }
+            }
+
+            std::uint64_t min_created = static_cast<std::uint64_t>(-1);
+            std::uint64_t max_created = 0;
+            for (const auto& change : changes) {
+                if (change.first >= new_size) {
+                    continue;
+                }
+                const auto offset = static_cast<off_t>(dump_header_size + change.first * sizeof(osmium::Location));
+                osmium::Location location;
+                pread_all(fd, &location, sizeof(location), offset);
+                if (location == change.second) {
+                    continue;
+                }
+                if (!location) {
+                    ++header.count;
+                    min_created = std::min(min_created, change.first);
+                    max_created = std::max(max_created, change.first);
+                } else if (!change.second) {
+                    --header.count;
+                }
+                pwrite_all(fd, &change.second, sizeof(change.second), offset);
+                dirty[change.first * sizeof(osmium::Location) / chunk_size] = true;
+            }
+
+            header.payload_size = new_size * sizeof(osmium::Location);
+            header.num_chunks = dirty.size();
+            header.checksums_offset = dump_header_size + header.payload_size;
+            checksums.resize(dirty.size());
+
+            if (header.payload_size > 0) {
+                data_size = static_cast<std::size_t>(dump_header_size + header.payload_size);
+                data = ::mmap(nullptr, data_size, PROT_READ, MAP_SHARED, fd, 0);
+                if (data == MAP_FAILED) {
+                    throw std::system_error{errno, std::system_category(), "Can not map location dump"};
+                }
+                const char* payload = static_cast<const char*>(data) + dump_header_size;
+
+                std::vector<std::uint64_t> dirty_chunks;
+                for (std::uint64_t chunk = 0; chunk < dirty.size(); ++chunk) {
+                    if (dirty[chunk]) {
+                        dirty_chunks.push_back(chunk);
+                    }
+                }
+                std::vector<std::thread> threads;
+                for (std::size_t t = 0; t < num_threads; ++t) {
+                    threads.emplace_back([&, t]() {
+                        for (std::size_t i = t; i < dirty_chunks.size(); i += num_threads) {
+                            const std::uint64_t begin = dirty_chunks[i] * chunk_size;
+                            checksums[dirty_chunks[i]] = checksum(payload + begin, static_cast<std::size_t>(std::min(chunk_size, header.payload_size - begin)));
+                        }
+                    });
+                }
+                for (auto& thread : threads) {
+                    thread.join();
+                }
+
+                const auto* locations = reinterpret_cast<const osmium::Location*>(payload);
+                if (header.count == 0) {
+                    header.min_id = 0;
+                    header.max_id = 0;
+                } else {
+                    // Nodes before the old smallest or after the old
+                    // largest ID can only have been created by the changes.
+                    std::uint64_t id = std::min(header.min_id, min_created);
+                    while (!locations[id]) {
+                        ++id;
+                    }
+                    header.min_id = id;
+                    id = std::max(header.max_id, max_created);
+                    if (id >= new_size) {
+                        id = new_size - 1;
+                    }
+                    while (!locations[id]) {
+                        --id;
+                    }
+                    header.max_id = id;
+                }
+
+                ::munmap(data, data_size);
+                data = MAP_FAILED;
+            }
+
+            pwrite_all(fd, checksums.data(), checksums.size() * sizeof(std::uint32_t), static_cast<off_t>(header.checksums_offset));
+            if (::ftruncate(fd, static_cast<off_t>(header.checksums_offset + checksums.size() * sizeof(std::uint32_t))) != 0) {
+                throw std::system_error{errno, std::system_category(), "Error writing location dump"};
+            }
+            if (::fsync(fd) != 0) {
+                throw std::system_error{errno, std::system_category(), "Error writing location dump"};
+            }
+
+            if (replication_sequence) {
+                header.replication_sequence = replication_sequence;
+            }
+            if (replication_timestamp) {
+                header.replication_timestamp = replication_timestamp;
+            }
+            header.header_checksum = header_checksum(header);
+            pwrite_all(fd, &header, sizeof(header), 0);
+            if (::fsync(fd) != 0) {
+                throw std::system_error{errno, std::system_category(), "Error writing location dump"};
+            }
+        } catch (...) {
+            if (data != MAP_FAILED) {
+                ::munmap(data, data_size);
+            }
+            ::close(fd);
+            throw;
+        }
+
+        if (::close(fd) != 0) {
+            throw std::system_error{errno, std::system_category(), "Error writing location dump"};
+        }
+    }
+
+} // anonymous namespace
+
+void get_replication_info(const osmium::io::Header& header, std::uint64_t& sequence, std::uint64_t& timestamp) {
+    const std::string sequence_str = header.get("osmosis_replication_sequence_number");
+    sequence = std::strtoull(sequence_str.c_str(), nullptr, 10);
+
+    timestamp = 0;
+    const std::string timestamp_str = header.get("osmosis_replication_timestamp");
+    if (!timestamp_str.empty()) {
+        try {
+            timestamp = osmium::Timestamp{timestamp_str.c_str()}.seconds_since_epoch();
+        } catch (const std::invalid_argument&) {
+        }
+    }
+}
+
+location_dump_kind location_dump_kind_for_store(const std::string& location_store) {
+    if (location_store.substr(0, 5) == "dense") {
+        return location_dump_kind::dense;
+    }
+    if (location_store.substr(0, 8) == "succinct") {
+        return location_dump_kind::succinct;
+    }
+    return location_dump_kind::sparse;
+}
+
+void write_location_dump(const std::string& filename,
+                         osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>& index,
+                         location_dump_kind kind,
+                         std::uint64_t replication_sequence,
+                         std::uint64_t replication_timestamp,
+                         std::size_t num_threads) {
+    write_dump_file(filename, kind, replication_sequence, replication_timestamp, num_threads, [&](int fd) {
+        if (kind == location_dump_kind::sparse) {
+            index.sort();
+            index.dump_as_list(fd);
+        } else {
+            index.dump_as_array(fd);
+        }
+    });
+}
+
+void update_location_dump(const std::string& filename,
+                          const std::vector<location_change>& changes,
+                          std::uint64_t replication_sequence,
+                          std::uint64_t replication_timestamp,
+                          std::size_t num_threads) {
+    num_threads = std::max(num_threads, std::size_t(1));
+
+    location_dump_info info;
+    {
+        const CheckedFileArray dump{filename};
+        info = dump.info();
+    }
+
+    if (info.kind == location_dump_kind::dense) {
+        update_dense_dump(filename, changes, replication_sequence, replication_timestamp, num_threads);
+        return;
+    }
+
+    // Merge the old locations with the changes into a new dump.
+    const CheckedFileArray dump{filename};
+    write_dump_file(filename, info.kind,
+                    replication_sequence ? replication_sequence : info.replication_sequence,
+                    replication_timestamp ? replication_timestamp : info.replication_timestamp,
+                    num_threads, [&](int fd) {
+        std::vector<id_location_pair> pairs;
+        SuccinctMemArray succinct;
+
+        const auto add = [&](osmium::unsigned_object_id_type id, const osmium::Location& location) {
+            if (info.kind == location_dump_kind::succinct) {
+                succinct.set(id, location);
+                return;
+            }
+            pairs.emplace_back(id, location);
+            if (pairs.size() == 1024 * 1024) {
+                write_all(fd, pairs.data(), pairs.size() * sizeof(id_location_pair));
+                pairs.clear();
+            }
+        };
+
+        auto change = changes.begin();
+        dump.for_each([&](osmium::unsigned_object_id_type id, const osmium::Location& location) {
+            for (; change != changes.end() && change->first < id; ++change) {
+                if (change->second) {
+                    add(change->first, change->second);
+                }
+            }
+            if (change != changes.end() && change->first == id) {
+                if (change->second) {
+                    add(id, change->second);
+                }
+                ++change;
+            } else {
+                add(id, location);
+            }
+        });
+        for (; change != changes.end(); ++change) {
+            if (change->second) {
+                add(change->first, change->second);
+            }
+        }
+
+        if (info.kind == location_dump_kind::succinct) {
+            succinct.dump_as_array(fd);
+        } else {
+            write_all(fd, pairs.data(), pairs.size() * sizeof(id_location_pair));
+        }
+    });
+}
+
+CheckedFileArray::CheckedFileArray(const std::string& filename) :
+    m_filename(filename),
+    m_data(nullptr),
+    m_data_size(0),
+    m_info(),
+    m_payload(nullptr),
+    m_payload_size(0),
+    m_checksums(nullptr),
+    m_chunk_size(dump_chunk_size),
+    m_checked(),
+    m_image() {
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error{"Can not open location dump '" + filename + "': " + std::strerror(errno)};
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error{"Can not read location dump '" + filename + "': " + std::strerror(errno)};
+    }
+    const auto size = static_cast<std::uint64_t>(st.st_size);
+
+    dump_header header;
+    try {
+        header = read_dump_header(fd, filename, size);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+
+    m_data = ::mmap(nullptr, static_cast<std::size_t>(size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m_data == MAP_FAILED) {
+        m_data = nullptr;
+        throw std::runtime_error{"Can not map location dump '" + filename + "': " + std::strerror(errno)};
+    }
+    m_data_size = static_cast<std::size_t>(size);
+
+    m_info.kind = static_cast<location_dump_kind>(header.kind);
+    m_info.min_id = header.min_id;
+    m_info.max_id = header.max_id;
+    m_info.count = header.count;
+    m_info.replication_sequence = header.replication_sequence;
+    m_info.replication_timestamp = header.replication_timestamp;
+
+    m_payload = static_cast<const char*>(m_data) + header.payload_offset;
+    m_payload_size = header.payload_size;
+    m_checksums = reinterpret_cast<const std::uint32_t*>(static_cast<const char*>(m_data) + header.checksums_offset);
+    m_chunk_size = header.chunk_size;
+    m_checked.resize(header.num_chunks);
+
+    if (m_info.kind == location_dump_kind::succinct) {
+        check(m_payload, static_cast<std::size_t>(std::min<std::uint64_t>(m_payload_size, 24)));
+        if (!m_image.init(m_payload, static_cast<std::size_t>(m_payload_size))) {
+            clear();
+            throw std::runtime_error{"Location dump '" + filename + "' is corrupt"};
+        }
+    }
+}
+
+CheckedFileArray::~CheckedFileArray() noexcept {
+    clear();
+}
+
+void CheckedFileArray::check(const void* data, std::size_t size) const {
+    if (size == 0) {
+        return;
+    }
+    const auto offset = static_cast<std::uint64_t>(static_cast<const char*>(data) - m_payload);
+    const std::uint64_t last = (offset + size - 1) / m_chunk_size;
+    for (std::uint64_t chunk = offset / m_chunk_size; chunk <= last; ++chunk) {
+        if (m_checked[chunk]) {
+            continue;
+        }
+        const std::uint64_t begin = chunk * m_chunk_size;
+        const std::uint64_t length = std::min(m_chunk_size, m_payload_size - begin);
+        if (checksum(m_payload + begin, static_cast<std::size_t>(length)) != m_checksums[chunk]) {
+            throw std::runtime_error{"Location dump '" + m_filename + "' is corrupt (checksum error in chunk " + std::to_string(chunk) + ")"};
+        }
+        m_checked[chunk] = true;
+    }
+}
+
+// Find the ID in the sparse dump starting at position first, which is
+// set to the position of the first pair with an ID not smaller than id.
+// The range is found by doubling the step, so looking up sorted IDs
+// touches the dump in order.
+const osmium::Location* CheckedFileArray::find_sparse(id_type id, std::uint64_t& first) const {
+    const auto* pairs = reinterpret_cast<const id_location_pair*>(m_payload);
+    const std::uint64_t size = m_payload_size / sizeof(id_location_pair);
+
+    std::uint64_t count = 1;
+    while (first + count <= size) {
+        check(pairs + first + count - 1, sizeof(id_location_pair));
+        if (pairs[first + count - 1].first >= id) {
+            break;
+        }
+        first += count;
+        count *= 2;
+    }
+    count = std::min(count, size - first);
+
+    while (count > 0) {
+        const std::uint64_t step = count / 2;
+        check(pairs + first + step, sizeof(id_location_pair));
+        if (pairs[first + step].first < id) {
+            first += step + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+    if (first < size) {
+        check(pairs + first, sizeof(id_location_pair));
+        if (pairs[first].first == id) {
+            return &pairs[first].second;
+        }
+    }
+    return nullptr;
+}
+
+const osmium::Location* CheckedFileArray::find(const id_type id) const {
+    switch (m_info.kind) {
+        case location_dump_kind::dense:
+            if (id < m_payload_size / sizeof(osmium::Location)) {
+                const auto* location = reinterpret_cast<const osmium::Location*>(m_payload) + id;
+                check(location, sizeof(osmium::Location));
+                if (*location != osmium::Location{}) {
+                    return location;
+                }
+            }
+            break;
+        case location_dump_kind::sparse: {
+                std::uint64_t first = 0;
+                return find_sparse(id, first);
+            }
+        case location_dump_kind::succinct:
+            return m_image.find(id, [this](const void* data, std::size_t size) {
+                check(data, size);
+            });
+    }
+    return nullptr;
+}
+
+std::vector<osmium::Location> CheckedFileArray::get_sorted(const std::vector<id_type>& ids) const {
+    std::vector<osmium::Location> locations;
+    locations.reserve(ids.size());
+
+    std::uint64_t first = 0;
+    for (const auto id : ids) {
+        const osmium::Location* location = m_info.kind == location_dump_kind::sparse ? find_sparse(id, first) : find(id);
+        locations.push_back(location ? *location : osmium::Location{});
+    }
+
+    return locations;
+}
+
+void CheckedFileArray::set(const id_type /*id*/, const osmium::Location /*value*/) {
+    throw std::runtime_error{"The checked_file_array location store is read-only"};
+}
+
+const osmium::Location CheckedFileArray::get(const id_type id) const {
+    const osmium::Location* location = find(id);
+    if (!location) {
+        throw osmium::not_found{"id " + std::to_string(id) + " not found"};
+    }
+    return *location;
+}
+
+void CheckedFileArray::clear() {
+    if (m_data) {
+        ::munmap(m_data, m_data_size);
+    }
+    m_data = nullptr;
+    m_data_size = 0;
+    m_payload = nullptr;
+    m_payload_size = 0;
+    m_checked.clear();
+    m_image = SuccinctImage{};
+    m_info = location_dump_info{};
+}
+
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <osmium/index/map.hpp>
+#include <osmium/io/header.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/types.hpp>
+
+#include "location_stores.hpp"
+
+/**
+ * Location dumps are written by minjur -d and read by
+ * minjur-generate-tilelist with the "checked_file_array,FILE" location
+ * store.
+ *
+ * The file starts with a 4096 byte header (only the first 104 bytes are
+ * used, the rest is zero). All numbers are in native byte order:
+ *
+ *     magic "MJLOCDMP"          8 bytes
+ *     format version (1)        32 bit
+ *     kind                      32 bit, see location_dump_kind
+ *     payload offset (4096)     64 bit
+ *     payload size              64 bit
+ *     chunk size                64 bit
+ *     number of chunks          64 bit
+ *     checksums offset          64 bit
+ *     smallest node ID          64 bit
+ *     largest node ID           64 bit
+ *     number of nodes           64 bit
+ *     replication sequence      64 bit, 0 if unknown
+ *     replication timestamp     64 bit, seconds since epoch, 0 if unknown
+ *     header checksum           32 bit, CRC32 of the header with this
+ *                               field set to zero
+ *     reserved                  32 bit
+ *
+ * The payload is the dump of the location store: an array with a location
+ * for every ID for dense stores, (ID, location) pairs ordered by ID for
+ * sparse stores, or the image of a succinct store. It is followed by the
+ * CRC32 checksums of each chunk of the payload (32 bit each).
+ *
+ * The header is written last, so a dump that wasn't written completely
+ * is never accepted.
+ */
+enum class location_dump_kind : std::uint32_t {
+    dense    = 1,
+    sparse   = 2,
+    succinct = 3
+};
+
+struct location_dump_info {
+    location_dump_kind kind = location_dump_kind::sparse;
+    std::uint64_t min_id = 0;
+    std::uint64_t max_id = 0;
+    std::uint64_t count = 0;
+    std::uint64_t replication_sequence = 0;
+    std::uint64_t replication_timestamp = 0;
+};
+
+/**
+ * The dump kind for a location store with the given name.
+ */
+location_dump_kind location_dump_kind_for_store(const std::string& location_store);
+
+/**
+ * Get the replication sequence number and timestamp (in seconds since the
+ * epoch) from the header of an OSM file. They are set to 0 if they are
+ * not in the header.
+ */
+void get_replication_info(const osmium::io::Header& header, std::uint64_t& sequence, std::uint64_t& timestamp);
+
+/**
+ * Write the locations in the store to a dump file. The data is written to
+ * a temporary file first which is renamed when it is complete. The
+ * checksums are calculated on num_threads threads.
+ *
+ * @throws std::system_error if writing fails.
+ */
+void write_location_dump(const std::string& filename,
+                         osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>& index,
+                         location_dump_kind kind,
+                         std::uint64_t replication_sequence,
+                         std::uint64_t replication_timestamp,
+                         std::size_t num_threads);
+
+/**
+ * Change of a node location in a location dump. An undefined location
+ * removes the node.
+ */
+using location_change = std::pair<osmium::unsigned_object_id_type, osmium::Location>;
+
+/**
+ * Apply the changes, which must be ordered by ID with only one change for
+ * each ID, to an existing location dump. Dense dumps are updated in
+ * place, the header is invalidated while this happens. Other dumps are
+ * rewritten to a temporary file which replaces the dump when complete.
+ * The replication sequence and timestamp are only updated if they are
+ * not 0.
+ *
+ * @throws std::runtime_error if the dump is invalid or can't be written.
+ */
+void update_location_dump(const std::string& filename,
+                          const std::vector<location_change>& changes,
+                          std::uint64_t replication_sequence,
+                          std::uint64_t replication_timestamp,
+                          std::size_t num_threads);
+
+/**
+ * Read-only location store using a location dump. The file is mapped into
+ * memory and used as is. Each chunk is checked against its checksum when
+ * it is used for the first time. Because of this get() must not be
+ * called from several threads at the same time. Use it with
+ * "checked_file_array,FILE".
+ */
+class CheckedFileArray : public osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location> {
+
+public:
+
+    using id_type = osmium::unsigned_object_id_type;
+
+private:
+
+    std::string m_filename;
+    void* m_data;
+    std::size_t m_data_size;
+    location_dump_info m_info;
+
+    const char* m_payload;
+    std::uint64_t m_payload_size;
+    const std::uint32_t* m_checksums;
+    std::uint64_t m_chunk_size;
+    mutable std::vector<bool> m_checked;
+
+    SuccinctImage m_image;
+
+    void check(const void* data, std::size_t size) const;
+
+    const osmium::Location* find_sparse(id_type id, std::uint64_t& first) const;
+
+    const osmium::Location* find(id_type id) const;
+
+public:
+
+    /**
+     * @throws std::runtime_error if the file can't be read or is invalid.
+     */
+    explicit CheckedFileArray(const std::string& filename);
+
+    CheckedFileArray(const CheckedFileArray&) = delete;
+    CheckedFileArray& operator=(const CheckedFileArray&) = delete;
+
+    ~CheckedFileArray() noexcept override;
+
+    const location_dump_info& info() const noexcept {
+        return m_info;
+    }
+
+    /**
+     * Check all chunks now. Afterwards get() can be called from several
+     * threads at the same time.
+     *
+     * @throws std::runtime_error if the data is corrupted.
+     */
+    void check_all() const {
+        check(m_payload, static_cast<std::size_t>(m_payload_size));
+    }
+
+    /**
+     * Call func(id, location) for all locations in the dump in order of
+     * their IDs. All chunks are checked first.
+     *
+     * @throws std::runtime_error if the data is corrupted.
+     */
+    template <typename TFunc>
+    void for_each(TFunc&& func) const {
+        check(m_payload, static_cast<std::size_t>(m_payload_size));
+
+        switch (m_info.kind) {
+            case location_dump_kind::dense: {
+                    const auto* locations = reinterpret_cast<const osmium::Location*>(m_payload);
+                    for (std::uint64_t id = 0; id < m_payload_size / sizeof(osmium::Location); ++id) {
+                        if (locations[id] != osmium::Location{}) {
+                            func(id, locations[id]);
+                        }
+                    }
+                }
+                break;
+            case location_dump_kind::sparse: {
+                    const auto* pairs = reinterpret_cast<const std::pair<id_type, osmium::Location>*>(m_payload);
+                    for (std::uint64_t i = 0; i < m_payload_size / sizeof(pairs[0]); ++i) {
+                        func(pairs[i].first, pairs[i].second);
+                    }
+                }
+                break;
+            case location_dump_kind::succinct:
+                m_image.for_each(func);
+                break;
+        }
+    }
+
+    /**
+     * Look up the location of the ID without throwing if it is not in the
+     * dump. The location is undefined then.
+     *
+     * @throws std::runtime_error if the data is corrupted.
+     */
+    osmium::Location lookup(const id_type id) const {
+        const osmium::Location* location = find(id);
+        return location ? *location : osmium::Location{};
+    }
+
+    /**
+     * Look up the locations of all IDs, which must be sorted, in a single
+     * sweep over the dump. The location for IDs not in the dump is
+     * undefined.
+     *
+     * @throws std::runtime_error if the data is corrupted.
+     */
+    std::vector<osmium::Location> get_sorted(const std::vector<id_type>& ids) const;
+
+    void set(const id_type id, const osmium::Location value) override;
+
+    /**
+     * @throws osmium::not_found if the ID is not in the dump.
+     * @throws std::runtime_error if the data is corrupted.
+     */
+    const osmium::Location get(const id_type id) const override;
+
+    std::size_t size() const override {
+        return static_cast<std::size_t>(m_info.count);
+    }
+
+    std::size_t used_memory() const override {
+        return m_data_size;
+    }
+
+    void clear() override;
+
+}; // class CheckedFileArray
+
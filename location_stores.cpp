@@ -0,0 +1,555 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+#include <osmium/index/index.hpp>
+
+#include "location_dump.hpp"
+#include "location_stores.hpp"
+
+namespace {
+
+    const std::uint64_t no_block = static_cast<std::uint64_t>(-1);
+
+    std::uint64_t zigzag_encode(std::int64_t value) noexcept {
+        return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+    }
+
+    std::int64_t zigzag_decode(std::uint64_t value) noexcept {
+        return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+    }
+
+    unsigned char* append_varint(unsigned char* out, std::uint64_t value) noexcept {
+        while (value >= 0x80) {
+            *out++ = static_cast<unsigned char>((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        *out++ = static_cast<unsigned char>(value);
+        return out;
+    }
+
+    const unsigned char* read_varint(const unsigned char* data, std::uint64_t& value) noexcept {
+        value = 0;
+        for (unsigned int shift = 0; ; shift += 7) {
+            const unsigned char byte = *data++;
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return data;
+            }
+        }
+    }
+
+    void write_all(int fd, const void* buffer, std::size_t size) {
+        const char* data = static_cast<const char*>(buffer);
+        while (size > 0) {
+            const auto written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error{errno, std::system_category(), "Error writing location store"};
+            }
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+    }
+
+} // anonymous namespace
+
+constexpr std::size_t CompressedMemArray::block_size;
+constexpr std::uint16_t CompressedMemArray::empty_block;
+
+CompressedMemArray::CompressedMemArray() :
+    m_chunks(),
+    m_chunk_used(0),
+    m_group_offsets(),
+    m_block_offsets(),
+    m_open_bits(0),
+    m_open_block(),
+    m_size(0),
+    m_cached_block(no_block),
+    m_cached_bits(0),
+    m_cached_locations() {
+}
+
+void CompressedMemArray::close_block() {
+    const std::uint64_t block = num_blocks();
+
+    if ((block & ((1 << group_bits) - 1)) == 0) {
+        if (m_chunks.empty() || chunk_size - m_chunk_used < max_group_bytes) {
+            m_chunks.emplace_back(new unsigned char[chunk_size]);
+            m_chunk_used = 0;
+        }
+        m_group_offsets.push_back(data_size());
+    }
+    if (!m_open_bits) {
+        m_block_offsets.push_back(empty_block);
+        return;
+    }
+    m_block_offsets.push_back(static_cast<std::uint16_t>(data_size() - m_group_offsets.back()));
+
+    unsigned char* const begin = m_chunks.back().get() + m_chunk_used;
+    unsigned char* out = begin;
+    for (int i = 0; i < 8; ++i) {
+        *out++ = static_cast<unsigned char>((m_open_bits >> (8 * i)) & 0xff);
+    }
+
+    std::int64_t x = 0;
+    std::int64_t y = 0;
+    for (std::uint64_t bits = m_open_bits; bits; bits &= bits - 1) {
+        const auto& location = m_open_block[static_cast<std::size_t>(__builtin_ctzll(bits))];
+        out = append_varint(out, zigzag_encode(location.x() - x));
+        out = append_varint(out, zigzag_encode(location.y() - y));
+        x = location.x();
+        y = location.y();
+    }
+    m_chunk_used += static_cast<std::size_t>(out - begin);
+
+    m_open_bits = 0;
+}
+
+void CompressedMemArray::decode_block(std::uint64_t block, std::uint64_t& bits, block_type& locations) const {
+    if (block == num_blocks()) {
+        bits = m_open_bits;
+        locations = m_open_block;
+        return;
+    }
+
+    if (m_block_offsets[block] == empty_block) {
+        bits = 0;
+        return;
+    }
+
+    const std::uint64_t begin = block_offset(block);
+
+    const unsigned char* data = m_chunks[begin / chunk_size].get() + begin % chunk_size;
+    bits = 0;
+    for (int i = 0; i < 8; ++i) {
+        bits |= static_cast<std::uint64_t>(*data++) << (8 * i);
+    }
+
+    std::int64_t x = 0;
+    std::int64_t y = 0;
+    for (std::uint64_t b = bits; b; b &= b - 1) {
+        std::uint64_t value;
+        data = read_varint(data, value);
+        x += zigzag_decode(value);
+        data = read_varint(data, value);
+        y += zigzag_decode(value);
+        locations[static_cast<std::size_t>(__builtin_ctzll(b))] = osmium::Location{static_cast<std::int32_t>(x), static_cast<std::int32_t>(y)};
+    }
+}
+
+template <typename TFunc>
+void CompressedMemArray::for_each_block(TFunc&& func) const {
+    std::uint64_t bits;
+    block_type locations;
+    for (std::uint64_t block = 0; block <= num_blocks(); ++block) {
+        decode_block(block, bits, locations);
+        func(block, bits, locations);
+    }
+}
+
+void CompressedMemArray::set(const id_type id, const osmium::Location value) {
+    const std::uint64_t block = id >> block_bits;
+    if (block < num_blocks()) {
+        throw std::runtime_error{"The compressed_mem_array location store needs node IDs in ascending order"};
+    }
+
+    while (block > num_blocks()) {
+        close_block();
+    }
+
+    const std::uint64_t bit = std::uint64_t(1) << (id & (block_size - 1));
+    if (!(m_open_bits & bit)) {
+        m_open_bits |= bit;
+        ++m_size;
+    }
+    m_open_block[id & (block_size - 1)] = value;
+}
+
+const osmium::Location CompressedMemArray::get(const id_type id) const {
+    const std::uint64_t block = id >> block_bits;
+    const std::size_t n = id & (block_size - 1);
+
+    if (block == num_blocks()) {
+        if ((m_open_bits >> n) & 1) {
+            return m_open_block[n];
+        }
+    } else if (block < num_blocks()) {
+        if (block != m_cached_block) {
+            decode_block(block, m_cached_bits, m_cached_locations);
+            m_cached_block = block;
+        }
+        if ((m_cached_bits >> n) & 1) {
+            return m_cached_locations[n];
+        }
+    }
+
+    throw osmium::not_found{"id " + std::to_string(id) + " not found"};
+}
+
+std::size_t CompressedMemArray::used_memory() const {
+    return sizeof(CompressedMemArray) +
+           m_chunks.size() * (chunk_size + sizeof(std::unique_ptr<unsigned char[]>)) +
+           m_group_offsets.capacity() * sizeof(std::uint64_t) +
+           m_block_offsets.capacity() * sizeof(std::uint16_t);
+}
+
+void CompressedMemArray::clear() {
+    m_chunks.clear();
+    m_chunks.shrink_to_fit();
+    m_chunk_used = 0;
+    m_group_offsets.clear();
+    m_group_offsets.shrink_to_fit();
+    m_block_offsets.clear();
+    m_block_offsets.shrink_to_fit();
+    m_open_bits = 0;
+    m_size = 0;
+    m_cached_block = no_block;
+}
+
+// Same format as the sparse location stores: pairs of ID and location.
+void CompressedMemArray::dump_as_list(const int fd) {
+    std::vector<std::pair<id_type, osmium::Location>> out;
+    out.reserve(1024 * 1024);
+
+    for_each_block([&](std::uint64_t block, std::uint64_t bits, const block_type& locations) {
+        for (; bits; bits &= bits - 1) {
+            const auto n = static_cast<std::size_t>(__builtin_ctzll(bits));
+            out.emplace_back((block << block_bits) + n, locations[n]);
+        }
+        if (out.size() + block_size > out.capacity()) {
+            write_all(fd, out.data(), out.size() * sizeof(out[0]));
+            out.clear();
+        }
+    });
+
+    write_all(fd, out.data(), out.size() * sizeof(out[0]));
+}
+
+// Same format as the dense location stores: a location for every ID.
+void CompressedMemArray::dump_as_array(const int fd) {
+    std::vector<osmium::Location> out;
+    out.reserve(1024 * 1024);
+
+    for_each_block([&](std::uint64_t /*block*/, std::uint64_t bits, const block_type& locations) {
+        for (std::size_t n = 0; n < block_size; ++n) {
+            out.push_back((bits >> n) & 1 ? locations[n] : osmium::Location{});
+        }
+        if (out.size() + block_size > out.capacity()) {
+            write_all(fd, out.data(), out.size() * sizeof(out[0]));
+            out.clear();
+        }
+    });
+
+    write_all(fd, out.data(), out.size() * sizeof(out[0]));
+}
+
+constexpr std::size_t SuccinctMemArray::chunk_size;
+
+namespace {
+
+    // Image of a succinct store written by dump_as_array(), all values in
+    // native byte order:
+    //   header: magic (8 bytes), number of bitmap words, number of locations
+    //   bitmap words (64 bit each)
+    //   rank every 2^16 words (64 bit each)
+    //   rank before each word relative to the last 64 bit rank (32 bit
+    //   each, padded to a multiple of 8 bytes)
+    //   locations
+    const char succinct_magic[] = "MJSUCC01";
+    const std::size_t succinct_magic_size = 8;
+    const std::size_t succinct_header_size = 24;
+    const unsigned int super_rank_bits = 16;
+
+    std::uint64_t num_super_ranks(std::uint64_t num_words) noexcept {
+        return (num_words + (1 << super_rank_bits) - 1) >> super_rank_bits;
+    }
+
+    std::uint64_t padded_ranks_size(std::uint64_t num_words) noexcept {
+        return (num_words * sizeof(std::uint32_t) + 7) & ~std::uint64_t(7);
+    }
+
+    // Call func(id, rank) for every ID in the bitmap.
+    template <typename TFunc>
+    void for_each_id(const std::uint64_t* bits, std::uint64_t num_words, TFunc&& func) {
+        std::uint64_t rank = 0;
+        for (std::uint64_t word = 0; word < num_words; ++word) {
+            for (std::uint64_t b = bits[word]; b; b &= b - 1) {
+                func((word << 6) + static_cast<std::uint64_t>(__builtin_ctzll(b)), rank++);
+            }
+        }
+    }
+
+    // Rank of the ID or -1 if it is not in the bitmap.
+    std::uint64_t succinct_rank(const std::uint64_t* bits, const std::uint64_t* super_ranks, const std::uint32_t* ranks,
+                                std::uint64_t num_words, std::uint64_t id) noexcept {
+        const std::uint64_t word = id >> 6;
+        if (word >= num_words) {
+            return static_cast<std::uint64_t>(-1);
+        }
+        const std::uint64_t bit = std::uint64_t(1) << (id & 63);
+        if (!(bits[word] & bit)) {
+            return static_cast<std::uint64_t>(-1);
+        }
+        return super_ranks[word >> super_rank_bits] + ranks[word] +
+               static_cast<std::uint64_t>(__builtin_popcountll(bits[word] & (bit - 1)));
+    }
+
+    template <typename TFunc>
+    void dump_succinct_as_list(int fd, const std::uint64_t* bits, std::uint64_t num_words, TFunc&& location) {
+        std::vector<std::pair<osmium::unsigned_object_id_type, osmium::Location>> out;
+        out.reserve(1024 * 1024);
+
+        for_each_id(bits, num_words, [&](std::uint64_t id, std::uint64_t rank) {
+            out.emplace_back(id, location(rank));
+            if (out.size() == out.capacity()) {
+                write_all(fd, out.data(), out.size() * sizeof(out[0]));
+                out.clear();
+            }
+        });
+
+        write_all(fd, out.data(), out.size() * sizeof(out[0]));
+    }
+
+} // anonymous namespace
+
+SuccinctMemArray::SuccinctMemArray() :
+    m_bits(),
+    m_super_ranks(),
+    m_ranks(),
+    m_locations(),
+    m_size(0) {
+}
+
+void SuccinctMemArray::set(const id_type id, const osmium::Location value) {
+    const std::uint64_t word = id >> 6;
+    const std::uint64_t bit = std::uint64_t(1) << (id & 63);
+
+    if (word + 1 < m_bits.size() || (word + 1 == m_bits.size() && (m_bits.back() & ~(bit - 1)))) {
+        if (m_bits[word] & bit) {
+            // Setting an ID again is fine.
+            location(succinct_rank(m_bits.data(), m_super_ranks.data(), m_ranks.data(), m_bits.size(), id)) = value;
+            return;
+        }
+        throw std::runtime_error{"The succinct_mem_array location store needs node IDs in ascending order"};
+    }
+
+    while (m_bits.size() <= word) {
+        if ((m_bits.size() & ((1 << super_rank_bits) - 1)) == 0) {
+            m_super_ranks.push_back(m_size);
+        }
+        m_ranks.push_back(static_cast<std::uint32_t>(m_size - m_super_ranks.back()));
+        m_bits.push_back(0);
+    }
+
+    if ((m_size & (chunk_size - 1)) == 0) {
+        m_locations.emplace_back(new osmium::Location[chunk_size]);
+    }
+    m_bits.back() |= bit;
+    location(m_size) = value;
+    ++m_size;
+}
+
+const osmium::Location SuccinctMemArray::get(const id_type id) const {
+    const std::uint64_t rank = succinct_rank(m_bits.data(), m_super_ranks.data(), m_ranks.data(), m_bits.size(), id);
+    if (rank == static_cast<std::uint64_t>(-1)) {
+        throw osmium::not_found{"id " + std::to_string(id) + " not found"};
+    }
+    return location(rank);
+}
+
+std::size_t SuccinctMemArray::used_memory() const {
+    return sizeof(SuccinctMemArray) +
+           m_bits.capacity() * sizeof(std::uint64_t) +
+           m_super_ranks.capacity() * sizeof(std::uint64_t) +
+           m_ranks.capacity() * sizeof(std::uint32_t) +
+           m_locations.size() * (chunk_size * sizeof(osmium::Location) + sizeof(std::unique_ptr<osmium::Location[]>));
+}
+
+void SuccinctMemArray::clear() {
+    m_bits.clear();
+    m_bits.shrink_to_fit();
+    m_super_ranks.clear();
+    m_super_ranks.shrink_to_fit();
+    m_ranks.clear();
+    m_ranks.shrink_to_fit();
+    m_locations.clear();
+    m_locations.shrink_to_fit();
+    m_size = 0;
+}
+
+void SuccinctMemArray::dump_as_list(const int fd) {
+    dump_succinct_as_list(fd, m_bits.data(), m_bits.size(), [this](std::uint64_t rank) {
+        return location(rank);
+    });
+}
+
+void SuccinctMemArray::dump_as_array(const int fd) {
+    std::string header{succinct_magic, succinct_magic_size};
+    const std::uint64_t sizes[2] = { m_bits.size(), m_size };
+    header.append(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+    write_all(fd, header.data(), header.size());
+
+    write_all(fd, m_bits.data(), m_bits.size() * sizeof(std::uint64_t));
+    write_all(fd, m_super_ranks.data(), m_super_ranks.size() * sizeof(std::uint64_t));
+    write_all(fd, m_ranks.data(), m_ranks.size() * sizeof(std::uint32_t));
+    const std::uint64_t padding = 0;
+    write_all(fd, &padding, padded_ranks_size(m_bits.size()) - m_ranks.size() * sizeof(std::uint32_t));
+
+    for (std::size_t chunk = 0; chunk < m_locations.size(); ++chunk) {
+        const std::size_t count = chunk + 1 < m_locations.size() ? chunk_size : m_size - chunk * chunk_size;
+        write_all(fd, m_locations[chunk].get(), count * sizeof(osmium::Location));
+    }
+}
+
+bool SuccinctImage::init(const char* data, std::size_t size) noexcept {
+    if (size < succinct_header_size || std::memcmp(data, succinct_magic, succinct_magic_size) != 0) {
+        return false;
+    }
+
+    std::uint64_t sizes[2];
+    std::memcpy(sizes, data + succinct_magic_size, sizeof(sizes));
+    const std::uint64_t num_words = sizes[0];
+    const std::uint64_t count = sizes[1];
+
+    const std::uint64_t expected_size = succinct_header_size +
+                                        num_words * sizeof(std::uint64_t) +
+                                        num_super_ranks(num_words) * sizeof(std::uint64_t) +
+                                        padded_ranks_size(num_words) +
+                                        count * sizeof(osmium::Location);
+    if (expected_size != size) {
+        return false;
+    }
+
+    m_num_words = num_words;
+    m_size = static_cast<std::size_t>(count);
+
+    data += succinct_header_size;
+    m_bits = reinterpret_cast<const std::uint64_t*>(data);
+    data += num_words * sizeof(std::uint64_t);
+    m_super_ranks = reinterpret_cast<const std::uint64_t*>(data);
+    data += num_super_ranks(num_words) * sizeof(std::uint64_t);
+    m_ranks = reinterpret_cast<const std::uint32_t*>(data);
+    data += padded_ranks_size(num_words);
+    m_locations = reinterpret_cast<const osmium::Location*>(data);
+
+    return true;
+}
+
+void SuccinctImage::dump_as_list(int fd) const {
+    dump_succinct_as_list(fd, m_bits, m_num_words, [this](std::uint64_t rank) {
+        return m_locations[rank];
+    });
+}
+
+SuccinctFileArray::SuccinctFileArray(const std::string& filename) :
+    m_data(nullptr),
+    m_data_size(0),
+    m_image() {
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error{"Can not open location store '" + filename + "': " + std::strerror(errno)};
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error{"Can not read location store '" + filename + "': " + std::strerror(errno)};
+    }
+    const auto size = static_cast<std::size_t>(st.st_size);
+    if (size == 0) {
+        ::close(fd);
+        throw std::runtime_error{"Invalid succinct location store '" + filename + "'"};
+    }
+
+    m_data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m_data == MAP_FAILED) {
+        m_data = nullptr;
+        throw std::runtime_error{"Can not map location store '" + filename + "': " + std::strerror(errno)};
+    }
+    m_data_size = size;
+
+    if (!m_image.init(static_cast<const char*>(m_data), m_data_size)) {
+        clear();
+        throw std::runtime_error{"Invalid succinct location store '" + filename + "'"};
+    }
+}
+
+SuccinctFileArray::~SuccinctFileArray() noexcept {
+    clear();
+}
+
+void SuccinctFileArray::set(const id_type /*id*/, const osmium::Location /*value*/) {
+    throw std::runtime_error{"The succinct_file_array location store is read-only"};
+}
+
+const osmium::Location SuccinctFileArray::get(const id_type id) const {
+    const osmium::Location* location = m_image.find(id);
+    if (!location) {
+        throw osmium::not_found{"id " + std::to_string(id) + " not found"};
+    }
+    return *location;
+}
+
+void SuccinctFileArray::clear() {
+    if (m_data) {
+        ::munmap(m_data, m_data_size);
+    }
+    m_data = nullptr;
+    m_data_size = 0;
+    m_image = SuccinctImage{};
+}
+
+void SuccinctFileArray::dump_as_list(const int fd) {
+    m_image.dump_as_list(fd);
+}
+
+void SuccinctFileArray::dump_as_array(const int fd) {
+    write_all(fd, m_data, m_data_size);
+}
+
+bool register_location_stores() {
+    using map_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
+    auto& factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+
+    factory.register_map("compressed_mem_array", [](const std::vector<std::string>& /*config*/) -> map_type* {
+        return new CompressedMemArray{};
+    });
+
+    factory.register_map("succinct_mem_array", [](const std::vector<std::string>& /*config*/) -> map_type* {
+        return new SuccinctMemArray{};
+    });
+
+    factory.register_map("succinct_file_array", [](const std::vector<std::string>& config) -> map_type* {
+        if (config.size() < 2) {
+            throw std::runtime_error{"Use succinct_file_array,FILE as location store"};
+        }
+        return new SuccinctFileArray{config[1]};
+    });
+
+    factory.register_map("checked_file_array", [](const std::vector<std::string>& config) -> map_type* {
+        if (config.size() < 2) {
+            throw std::runtime_error{"Use checked_file_array,FILE as location store"};
+        }
+        return new CheckedFileArray{config[1]};
+    });
+
+    return true;
+}
+
+namespace {
+
+    const bool registered_location_stores = register_location_stores();
+
+} // anonymous namespace
+
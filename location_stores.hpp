@@ -0,0 +1,402 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <osmium/index/map.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/types.hpp>
+
+#include "id_bitmap.hpp"
+
+/**
+ * Location stores in addition to the ones from libosmium. They are
+ * registered with the osmium::index::MapFactory by register_location_stores()
+ * so they can be used with the -l, --location-store option.
+ */
+
+/**
+ * Location store keeping the locations compressed in memory. Use it with
+ * "compressed_mem_array".
+ *
+ * Node IDs are grouped into blocks of 64. For each block a bitmap of the
+ * IDs that have a location is stored followed by the locations of those
+ * IDs: the coordinates are stored as differences to the previous location
+ * in the block, zigzag and varint encoded. Consecutive node IDs are
+ * usually close to each other, so most locations need 3 to 5 bytes instead
+ * of the 8 bytes for every possible ID a dense array needs. A directory with
+ * a 64 bit offset for each group of 64 blocks and a 16 bit offset into the
+ * group for each block gives O(1) access to any block.
+ *
+ * The IDs must be set in ascending order, which they are when reading from
+ * a sorted OSM file. Blocks are only written once all their IDs are set.
+ *
+ * The last block decoded in get() is cached, because the nodes of a way
+ * are often in the same block. Because of this cache get() must not be
+ * called from several threads at the same time.
+ */
+class CompressedMemArray : public osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location> {
+
+public:
+
+    using id_type = osmium::unsigned_object_id_type;
+
+    static constexpr std::size_t block_bits = 6;
+    static constexpr std::size_t block_size = 1 << block_bits;
+
+private:
+
+    static constexpr std::size_t group_bits = 6;
+    static constexpr std::size_t chunk_size = 16 * 1024 * 1024;
+
+    // Bitmap plus two varints with up to 5 bytes for each location.
+    static constexpr std::size_t max_block_bytes = 8 + block_size * 2 * 5;
+    static constexpr std::size_t max_group_bytes = max_block_bytes << group_bits;
+
+    // Offset marking blocks without any locations, no real offset in a
+    // group can be this large.
+    static constexpr std::uint16_t empty_block = 0xffff;
+    static_assert(max_group_bytes < empty_block, "block offsets must fit into 16 bits");
+
+    using block_type = std::array<osmium::Location, block_size>;
+
+    // Encoded data. Kept in fixed size chunks so that growing doesn't need
+    // twice the memory while copying, groups never cross chunk boundaries.
+    std::vector<std::unique_ptr<unsigned char[]>> m_chunks;
+    std::size_t m_chunk_used;
+
+    std::vector<std::uint64_t> m_group_offsets;
+
+    // Offsets of the blocks relative to their group or empty_block.
+    std::vector<std::uint16_t> m_block_offsets;
+
+    // The block currently being filled by set(), its number is always
+    // m_block_offsets.size().
+    std::uint64_t m_open_bits;
+    block_type m_open_block;
+
+    std::size_t m_size;
+
+    mutable std::uint64_t m_cached_block;
+    mutable std::uint64_t m_cached_bits;
+    mutable block_type m_cached_locations;
+
+    std::uint64_t num_blocks() const noexcept {
+        return m_block_offsets.size();
+    }
+
+    std::uint64_t data_size() const noexcept {
+        return m_chunks.empty() ? 0 : (m_chunks.size() - 1) * chunk_size + m_chunk_used;
+    }
+
+    std::uint64_t block_offset(std::uint64_t block) const noexcept {
+        return m_group_offsets[block >> group_bits] + m_block_offsets[block];
+    }
+
+    void close_block();
+
+    void decode_block(std::uint64_t block, std::uint64_t& bits, block_type& locations) const;
+
+    // Call func(block, bits, locations) for all blocks in order.
+    template <typename TFunc>
+    void for_each_block(TFunc&& func) const;
+
+public:
+
+    CompressedMemArray();
+
+    ~CompressedMemArray() noexcept override = default;
+
+    void set(const id_type id, const osmium::Location value) override;
+
+    const osmium::Location get(const id_type id) const override;
+
+    std::size_t size() const override {
+        return m_size;
+    }
+
+    std::size_t used_memory() const override;
+
+    void clear() override;
+
+    void dump_as_list(const int fd) override;
+
+    void dump_as_array(const int fd) override;
+
+}; // class CompressedMemArray
+
+/**
+ * Location store for node IDs spread over a large range with many gaps.
+ * Use it with "succinct_mem_array".
+ *
+ * A bitmap with one bit for every possible ID marks the IDs that have a
+ * location, the locations themselves are kept in an array ordered by ID.
+ * The index into that array is the rank of the ID in the bitmap (the
+ * number of set bits before it), it is found with one popcount using the
+ * number of set bits before each 64 bit word of the bitmap (32 bit counts
+ * relative to the count stored every 2^16 words). This needs about
+ * 1.5 bits per possible ID plus 8 bytes per node instead of the 8 bytes per
+ * possible ID of the dense stores.
+ *
+ * The IDs must be set in ascending order.
+ *
+ * dump_as_array() writes an image of the store that can be used with the
+ * "succinct_file_array,FILE" store.
+ */
+class SuccinctMemArray : public osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location> {
+
+public:
+
+    using id_type = osmium::unsigned_object_id_type;
+
+private:
+
+    static constexpr std::size_t chunk_bits = 20;
+    static constexpr std::size_t chunk_size = 1 << chunk_bits;
+
+    std::vector<std::uint64_t> m_bits;
+    std::vector<std::uint64_t> m_super_ranks;
+    std::vector<std::uint32_t> m_ranks;
+
+    // Locations ordered by ID in fixed size chunks.
+    std::vector<std::unique_ptr<osmium::Location[]>> m_locations;
+
+    std::size_t m_size;
+
+    osmium::Location& location(std::size_t rank) const noexcept {
+        return m_locations[rank >> chunk_bits][rank & (chunk_size - 1)];
+    }
+
+public:
+
+    SuccinctMemArray();
+
+    ~SuccinctMemArray() noexcept override = default;
+
+    void set(const id_type id, const osmium::Location value) override;
+
+    const osmium::Location get(const id_type id) const override;
+
+    std::size_t size() const override {
+        return m_size;
+    }
+
+    std::size_t used_memory() const override;
+
+    void clear() override;
+
+    void dump_as_list(const int fd) override;
+
+    void dump_as_array(const int fd) override;
+
+}; // class SuccinctMemArray
+
+/**
+ * Read-only access to an image of a SuccinctMemArray written by its
+ * dump_as_array() somewhere in memory.
+ */
+class SuccinctImage {
+
+    const std::uint64_t* m_bits;
+    const std::uint64_t* m_super_ranks;
+    const std::uint32_t* m_ranks;
+    const osmium::Location* m_locations;
+    std::uint64_t m_num_words;
+    std::size_t m_size;
+
+public:
+
+    SuccinctImage() noexcept :
+        m_bits(nullptr),
+        m_super_ranks(nullptr),
+        m_ranks(nullptr),
+        m_locations(nullptr),
+        m_num_words(0),
+        m_size(0) {
+    }
+
+    /**
+     * Use the image of the given size at data.
+     *
+     * @returns false if it is not a valid image.
+     */
+    bool init(const char* data, std::size_t size) noexcept;
+
+    /**
+     * Find the location of the ID. Before any part of the image is read
+     * check(pointer, length) is called for it.
+     *
+     * @returns pointer to the location or nullptr if the ID is not there.
+     */
+    template <typename TCheck>
+    const osmium::Location* find(osmium::unsigned_object_id_type id, TCheck&& check) const {
+        const std::uint64_t word = id >> 6;
+        if (word >= m_num_words) {
+            return nullptr;
+        }
+        check(m_bits + word, sizeof(std::uint64_t));
+        const std::uint64_t bit = std::uint64_t(1) << (id & 63);
+        if (!(m_bits[word] & bit)) {
+            return nullptr;
+        }
+        check(m_super_ranks + (word >> 16), sizeof(std::uint64_t));
+        check(m_ranks + word, sizeof(std::uint32_t));
+        const std::uint64_t rank = m_super_ranks[word >> 16] + m_ranks[word] +
+                                   static_cast<std::uint64_t>(__builtin_popcountll(m_bits[word] & (bit - 1)));
+        check(m_locations + rank, sizeof(osmium::Location));
+        return m_locations + rank;
+    }
+
+    const osmium::Location* find(osmium::unsigned_object_id_type id) const noexcept {
+        return find(id, [](const void*, std::size_t) {});
+    }
+
+    std::uint64_t num_words() const noexcept {
+        return m_num_words;
+    }
+
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    /**
+     * Call func(id, location) for all locations in order of their IDs.
+     */
+    template <typename TFunc>
+    void for_each(TFunc&& func) const {
+        std::uint64_t rank = 0;
+        for (std::uint64_t word = 0; word < m_num_words; ++word) {
+            for (std::uint64_t bits = m_bits[word]; bits; bits &= bits - 1) {
+                func((word << 6) + static_cast<std::uint64_t>(__builtin_ctzll(bits)), m_locations[rank++]);
+            }
+        }
+    }
+
+    /**
+     * Write all IDs and locations in the format of the sparse stores.
+     */
+    void dump_as_list(int fd) const;
+
+}; // class SuccinctImage
+
+/**
+ * Read-only location store using an image of a SuccinctMemArray written
+ * by its dump_as_array(). The file is mapped into memory. Use it with
+ * "succinct_file_array,FILE".
+ */
+class SuccinctFileArray : public osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location> {
+
+public:
+
+    using id_type = osmium::unsigned_object_id_type;
+
+private:
+
+    void* m_data;
+    std::size_t m_data_size;
+    SuccinctImage m_image;
+
+public:
+
+    /**
+     * @throws std::runtime_error if the file can't be read or is invalid.
+     */
+    explicit SuccinctFileArray(const std::string& filename);
+
+    SuccinctFileArray(const SuccinctFileArray&) = delete;
+    SuccinctFileArray& operator=(const SuccinctFileArray&) = delete;
+
+    ~SuccinctFileArray() noexcept override;
+
+    void set(const id_type id, const osmium::Location value) override;
+
+    const osmium::Location get(const id_type id) const override;
+
+    std::size_t size() const override {
+        return m_image.size();
+    }
+
+    std::size_t used_memory() const override {
+        return m_data_size;
+    }
+
+    void clear() override;
+
+    void dump_as_list(const int fd) override;
+
+    void dump_as_array(const int fd) override;
+
+}; // class SuccinctFileArray
+
+/**
+ * Location store wrapping another one that only stores the locations of
+ * the IDs in a bitmap, all other locations are ignored. Used by
+ * minjur --two-pass to keep only the locations of nodes referenced by ways.
+ */
+class FilteredLocationStore : public osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location> {
+
+public:
+
+    using id_type = osmium::unsigned_object_id_type;
+    using map_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
+
+private:
+
+    map_type& m_store;
+    const IdBitmap& m_ids;
+
+public:
+
+    FilteredLocationStore(map_type& store, const IdBitmap& ids) :
+        m_store(store),
+        m_ids(ids) {
+    }
+
+    ~FilteredLocationStore() noexcept override = default;
+
+    void set(const id_type id, const osmium::Location value) override {
+        if (m_ids.get(id)) {
+            m_store.set(id, value);
+        }
+    }
+
+    const osmium::Location get(const id_type id) const override {
+        return m_store.get(id);
+    }
+
+    std::size_t size() const override {
+        return m_store.size();
+    }
+
+    std::size_t used_memory() const override {
+        return m_store.used_memory() + m_ids.used_memory();
+    }
+
+    void clear() override {
+        m_store.clear();
+    }
+
+    void sort() override {
+        m_store.sort();
+    }
+
+    void dump_as_list(const int fd) override {
+        m_store.dump_as_list(fd);
+    }
+
+    void dump_as_array(const int fd) override {
+        m_store.dump_as_array(fd);
+    }
+
+}; // class FilteredLocationStore
+
+/**
+ * Register the location stores from this file and the CheckedFileArray
+ * with the osmium::index::MapFactory. Called automatically on startup.
+ */
+bool register_location_stores();
+
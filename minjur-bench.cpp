@@ -0,0 +1,371 @@
+
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#define RAPIDJSON_HAS_STDSTRING 1
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+#pragma GCC diagnostic pop
+
+#include <osmium/builder/attr.hpp>
+#include <osmium/geom/rapid_geojson.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm.hpp>
+
+#include "json_feature.hpp"
+#include "minjur_version.hpp"
+
+void print_help() {
+    std::cout << "minjur-bench [OPTIONS]\n\n"
+              << "Time writing GeoJSON features for synthetic nodes and ways with the\n"
+              << "feature writer used by minjur and with rapidjson::Writer.\n"
+              << "\nOptions:\n"
+              << "  -c, --count=N              Number of nodes and of ways (default: 100000)\n"
+              << "  -h, --help                 This help message\n"
+              << "  -n, --way-nodes=N          Number of nodes in each way (default: 10)\n"
+              << "  -r, --rounds=N             Number of rounds, the fastest counts (default: 5)\n"
+              << "  -v, --version              Display version\n";
+}
+
+void print_version() {
+    std::cout << MINJUR_VERSION_STRING << "\n";
+}
+
+using writer_type = rapidjson::Writer<rapidjson::StringBuffer>;
+
+/**
+ * Writes features the way minjur did before JSONFeature wrote directly
+ * into the output buffers.
+ */
+class RapidJSONFeature {
+
+    rapidjson::StringBuffer m_stream;
+    writer_type m_writer;
+    osmium::geom::RapidGeoJSONFactory<writer_type> m_factory;
+    const attribute_names& m_attr_names;
+
+public:
+
+    explicit RapidJSONFeature(const attribute_names& attr_names) :
+        m_stream(),
+        m_writer(m_stream),
+        m_factory(m_writer),
+        m_attr_names(attr_names) {
+        m_writer.StartObject();
+        m_writer.Key("type");
+        m_writer.String("Feature");
+    }
+
+    void add_point(const osmium::Node& node) {
+        m_factory.create_point(node);
+    }
+
+    void add_linestring(const osmium::Way& way) {
+        m_factory.create_linestring(way);
+    }
+
+    void add_id(const std::string& prefix, osmium::object_id_type id) {
+        m_writer.Key("id");
+        m_writer.String(prefix + std::to_string(id));
+    }
+
+    void add_properties(const osmium::OSMObject& object) {
+        m_writer.Key("properties");
+        m_writer.StartObject();
+
+        m_writer.String(m_attr_names.id);
+        m_writer.Int64(object.id());
+
+        m_writer.String(m_attr_names.type);
+        m_writer.String(osmium::item_type_to_name(object.type()));
+
+        m_writer.String(m_attr_names.version);
+        m_writer.Int(object.version());
+
+        m_writer.String(m_attr_names.changeset);
+        m_writer.Int(object.changeset());
+
+        m_writer.String(m_attr_names.uid);
+        m_writer.Int(object.uid());
+
+        m_writer.String(m_attr_names.user);
+        m_writer.String(object.user());
+
+        m_writer.String(m_attr_names.timestamp);
+        m_writer.Int(object.timestamp().seconds_since_epoch());
+
+        for (const auto& tag : object.tags()) {
+            m_writer.String(tag.key());
+            m_writer.String(tag.value());
+        }
+        m_writer.EndObject();
+    }
+
+    void append_to(std::string& buffer) {
+        m_writer.EndObject();
+
+        buffer.append(m_stream.GetString(), m_stream.GetSize());
+        buffer.append(1, '\n');
+    }
+
+}; // class RapidJSONFeature
+
+struct synthetic_data {
+    osmium::memory::Buffer buffer{1024 * 1024, osmium::memory::Buffer::auto_grow::yes};
+    std::vector<std::size_t> nodes;
+    std::vector<std::size_t> ways;
+};
+
+/**
+ * Create count nodes with a few tags near Berlin and count ways with
+ * way_nodes of those nodes each. All objects have metadata, so the
+ * properties are the same with both writers.
+ */
+void create_data(synthetic_data& data, std::size_t count, std::size_t way_nodes) {
+    using namespace osmium::builder::attr;
+
+    std::mt19937 random{42};
+    std::uniform_int_distribution<std::int32_t> x_dist{130000000, 140000000};
+    std::uniform_int_distribution<std::int32_t> y_dist{520000000, 530000000};
+    std::uniform_int_distribution<std::int32_t> step_dist{-5000, 5000};
+
+    std::vector<osmium::Location> locations;
+    locations.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        const osmium::Location location{x_dist(random), y_dist(random)};
+        locations.push_back(location);
+        const auto id = static_cast<osmium::object_id_type>(i + 1);
+        data.nodes.push_back(osmium::builder::add_node(data.buffer,
+            _id(id), _version(3), _changeset(4711), _uid(123), _user("mapper"),
+            _timestamp(osmium::Timestamp{"2016-01-01T00:00:00Z"}),
+            _location(location),
+            _tag("amenity", "restaurant"),
+            _tag("name", "Zum \"Anker\""),
+            _tag("opening_hours", "Mo-Fr 11:00-23:00"),
+            _tag("addr:street", "Stra\xc3\x9f" "e des 17. Juni")));
+    }
+
+    std::vector<osmium::NodeRef> refs;
+    for (std::size_t i = 0; i < count; ++i) {
+        refs.clear();
+        osmium::Location location = locations[i];
+        for (std::size_t n = 0; n < way_nodes; ++n) {
+            const auto ref = static_cast<osmium::object_id_type>((i + n) % count + 1);
+            refs.emplace_back(ref, location);
+            location.set_x(location.x() + step_dist(random));
+            location.set_y(location.y() + step_dist(random));
+        }
+        const auto id = static_cast<osmium::object_id_type>(i + 1);
+        data.ways.push_back(osmium::builder::add_way(data.buffer,
+            _id(id), _version(7), _changeset(4712), _uid(456), _user("other mapper"),
+            _timestamp(osmium::Timestamp{"2016-02-01T12:00:00Z"}),
+            _nodes(refs),
+            _tag("highway", "residential"),
+            _tag("name", "Unter den Linden"),
+            _tag("maxspeed", "30")));
+    }
+}
+
+void write_new(JSONFeatureWriter& writer, const synthetic_data& data, std::string& out) {
+    for (const auto offset : data.nodes) {
+        const auto& node = data.buffer.get<osmium::Node>(offset);
+        JSONFeature feature{writer, out};
+        feature.add_id("n", node.id());
+        feature.add_point(node);
+        feature.add_properties(node);
+        feature.finish();
+    }
+    for (const auto offset : data.ways) {
+        const auto& way = data.buffer.get<osmium::Way>(offset);
+        JSONFeature feature{writer, out};
+        feature.add_id("w", way.id());
+        feature.add_linestring(way);
+        feature.add_properties(way);
+        feature.finish();
+    }
+}
+
+void write_rapidjson(const attribute_names& attr_names, const synthetic_data& data, std::string& out) {
+    for (const auto offset : data.nodes) {
+        const auto& node = data.buffer.get<osmium::Node>(offset);
+        RapidJSONFeature feature{attr_names};
+        feature.add_id("n", node.id());
+        feature.add_point(node);
+        feature.add_properties(node);
+        feature.append_to(out);
+    }
+    for (const auto offset : data.ways) {
+        const auto& way = data.buffer.get<osmium::Way>(offset);
+        RapidJSONFeature feature{attr_names};
+        feature.add_id("w", way.id());
+        feature.add_linestring(way);
+        feature.add_properties(way);
+        feature.append_to(out);
+    }
+}
+
+/**
+ * Compare the output of the two writers. Numbers outside of strings are
+ * equal if they parse to the same double: JSONFeature writes the shortest
+ * exact decimal of the fixed-point coordinates, rapidjson the shortest
+ * decimal of the double, like 0.199975 and 0.19997500000000002. The
+ * number of numbers written differently is returned in different_numbers.
+ */
+bool same_output(const std::string& a, const std::string& b, std::size_t& different_numbers) {
+    const char* pa = a.c_str();
+    const char* pb = b.c_str();
+    const char* const end_a = pa + a.size();
+    const char* const end_b = pb + b.size();
+    bool in_string = false;
+    different_numbers = 0;
+
+    while (pa != end_a && pb != end_b) {
+        if (!in_string && (*pa == '-' || std::isdigit(static_cast<unsigned char>(*pa)))) {
+            char* next_a;
+            char* next_b;
+            const double value_a = std::strtod(pa, &next_a);
+            const double value_b = std::strtod(pb, &next_b);
+            if (next_b == pb || value_a != value_b) {
+                return false;
+            }
+            if (next_a - pa != next_b - pb || std::strncmp(pa, pb, static_cast<std::size_t>(next_a - pa)) != 0) {
+                ++different_numbers;
+            }
+            pa = next_a;
+            pb = next_b;
+            continue;
+        }
+        if (*pa != *pb) {
+            return false;
+        }
+        if (*pa == '"') {
+            in_string = !in_string;
+        } else if (*pa == '\\' && in_string) {
+            ++pa;
+            ++pb;
+            if (pa == end_a || pb == end_b || *pa != *pb) {
+                return false;
+            }
+        }
+        ++pa;
+        ++pb;
+    }
+
+    return pa == end_a && pb == end_b;
+}
+
+/**
+ * Call func(out) rounds times with an emptied output string and return
+ * the fastest time in nanoseconds.
+ */
+template <typename TFunc>
+double time_rounds(std::size_t rounds, std::string& out, TFunc&& func) {
+    double best = 0;
+    for (std::size_t round = 0; round < rounds; ++round) {
+        out.clear();
+        const auto start = std::chrono::steady_clock::now();
+        func(out);
+        const std::chrono::duration<double, std::nano> duration = std::chrono::steady_clock::now() - start;
+        if (round == 0 || duration.count() < best) {
+            best = duration.count();
+        }
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"count",                required_argument, 0, 'c'},
+        {"help",                       no_argument, 0, 'h'},
+        {"way-nodes",            required_argument, 0, 'n'},
+        {"rounds",               required_argument, 0, 'r'},
+        {"version",                    no_argument, 0, 'v'},
+        {0, 0, 0, 0}
+    };
+
+    std::size_t count = 100000;
+    std::size_t way_nodes = 10;
+    std::size_t rounds = 5;
+
+    while (true) {
+        int c = getopt_long(argc, argv, "c:hn:r:v", long_options, 0);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'c':
+                count = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'h':
+                print_help();
+                std::exit(0);
+            case 'n':
+                way_nodes = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'r':
+                rounds = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'v':
+                print_version();
+                std::exit(0);
+            default:
+                std::exit(1);
+        }
+    }
+
+    if (optind != argc) {
+        std::cerr << "Usage: " << argv[0] << " [OPTIONS]\n";
+        std::exit(1);
+    }
+
+    if (count == 0 || rounds == 0 || way_nodes < 2) {
+        std::cerr << "Count and rounds must be at least 1, way nodes at least 2.\n";
+        std::exit(1);
+    }
+
+    synthetic_data data;
+    create_data(data, count, way_nodes);
+
+    const double num_features = static_cast<double>(2 * count);
+
+    JSONFeatureWriter writer{""};
+    std::string new_out;
+    const double new_time = time_rounds(rounds, new_out, [&](std::string& out) {
+        write_new(writer, data, out);
+    });
+
+    const attribute_names attr_names{""};
+    std::string rapidjson_out;
+    const double rapidjson_time = time_rounds(rounds, rapidjson_out, [&](std::string& out) {
+        write_rapidjson(attr_names, data, out);
+    });
+
+    std::cout << std::fixed << std::setprecision(1)
+              << count << " nodes, " << count << " ways with " << way_nodes << " nodes, fastest of " << rounds << " rounds\n"
+              << "JSONFeature:      " << std::setw(8) << new_time / num_features << " ns/feature, " << new_out.size() << " bytes\n"
+              << "rapidjson::Writer:" << std::setw(8) << rapidjson_time / num_features << " ns/feature, " << rapidjson_out.size() << " bytes\n"
+              << "Speedup:          " << std::setw(8) << std::setprecision(2) << rapidjson_time / new_time << "\n";
+
+    std::size_t different_numbers = 0;
+    if (!same_output(new_out, rapidjson_out, different_numbers)) {
+        std::cerr << "The output of the two writers differs.\n";
+        std::exit(1);
+    }
+    if (different_numbers) {
+        std::cout << different_numbers << " numbers written differently with the same value\n";
+    }
+}
+
@@ -0,0 +1,717 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <unistd.h>
+#include <vector>
+
+#include <osmium/handler.hpp>
+#include <osmium/io/any_input.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/visitor.hpp>
+
+// these must be include in this order
+#include <osmium/index/map/all.hpp>
+#include <osmium/handler/node_locations_for_ways.hpp>
+#include <osmium/osm.hpp>
+
+#include "minjur_version.hpp"
+#include "json_no_area_handler.hpp"
+#include "location_dump.hpp"
+#include "pbf_index.hpp"
+#include "tile_diff_handler.hpp"
+#include "tile_index.hpp"
+#include "tile_list.hpp"
+#include "way_index.hpp"
+
+using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
+using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
+
+namespace {
+
+    volatile std::sig_atomic_t stop_requested = 0;
+
+    void request_stop(int /*signal*/) {
+        stop_requested = 1;
+    }
+
+    const char* const change_file_suffixes[] = {".osc", ".osc.gz", ".osc.bz2"};
+
+    bool has_suffix(const std::string& name, const std::string& suffix) {
+        return name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+} // anonymous namespace
+
+struct daemon_options {
+    std::string watch_dir;
+    std::string output_dir;
+    std::string dump_file;
+    std::string way_index_file;
+    std::string osm_file;
+    std::string area_rules_file;
+    std::string attr_prefix = "@";
+    unsigned int zoom = 15;
+    unsigned int coordinate_precision = max_coordinate_precision;
+    property_options properties;
+    ObjectFilter filter;
+    bool with_id = false;
+    bool create_polygons = false;
+    tile_list_format format = tile_list_format::text;
+};
+
+/**
+ * The change file name without the suffix.
+ */
+std::string change_file_stem(const std::string& name) {
+    for (const auto* suffix : change_file_suffixes) {
+        if (has_suffix(name, suffix)) {
+            return name.substr(0, name.size() - std::strlen(suffix));
+        }
+    }
+    return name;
+}
+
+/**
+ * The number in the name of a change file like "4711.osc.gz", which is
+ * its replication sequence number for replication diffs, or 0 if the name
+ * is not a number.
+ */
+std::uint64_t change_file_number(const std::string& name) {
+    const std::string stem = change_file_stem(name);
+    if (stem.empty() || stem.size() > 18 || stem.find_first_not_of("0123456789") != std::string::npos) {
+        return 0;
+    }
+    return std::stoull(stem);
+}
+
+/**
+ * Names of all change files in the directory in the order they have to be
+ * applied in: Numbered files (like replication diffs) ordered by their
+ * numbers, then all other files ordered by name.
+ *
+ * @throws std::system_error if the directory can't be read.
+ */
+std::vector<std::string> find_change_files(const std::string& dir) {
+    DIR* d = ::opendir(dir.c_str());
+    if (!d) {
+        throw std::system_error{errno, std::system_category(), "Can not read directory '" + dir + "'"};
+    }
+
+    std::vector<std::string> names;
+    while (const struct dirent* entry = ::readdir(d)) {
+        const std::string name{entry->d_name};
+        for (const auto* suffix : change_file_suffixes) {
+            if (has_suffix(name, suffix)) {
+                names.push_back(name);
+                break;
+            }
+        }
+    }
+    ::closedir(d);
+
+    // Sorting the names would put 1000.osc.gz before 999.osc.gz.
+    std::sort(names.begin(), names.end(), [](const std::string& a, const std::string& b) {
+        const std::uint64_t na = change_file_number(a);
+        const std::uint64_t nb = change_file_number(b);
+        if (na != nb) {
+            return nb == 0 || (na != 0 && na < nb);
+        }
+        return a < b;
+    });
+    return names;
+}
+
+/**
+ * Move a completely written file into place.
+ *
+ * @throws std::system_error if the file can't be renamed.
+ */
+void rename_file(const std::string& from, const std::string& to) {
+    if (std::rename(from.c_str(), to.c_str()) != 0) {
+        throw std::system_error{errno, std::system_category(), "Can not rename '" + from + "' to '" + to + "'"};
+    }
+}
+
+/**
+ * @throws std::system_error if the file can't be written.
+ */
+void write_tile_file(const std::string& filename, const TileIndex& tiles, tile_list_format format) {
+    const std::string tmp_filename = filename + ".tmp";
+    const int fd = ::open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::system_error{errno, std::system_category(), "Can not open tile list '" + tmp_filename + "'"};
+    }
+    try {
+        write_tile_list(fd, tiles, format);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    if (::close(fd) != 0) {
+        throw std::system_error{errno, std::system_category(), "Error writing tile list '" + tmp_filename + "'"};
+    }
+    rename_file(tmp_filename, filename);
+}
+
+/**
+ * The newest versions of the ways in the change files processed so far.
+ * They replace the ways in the OSM file, which is from before the first
+ * change file.
+ */
+class ChangedWays : public osmium::handler::Handler {
+
+    osmium::memory::Buffer m_buffer;
+    std::unordered_map<osmium::unsigned_object_id_type, std::size_t> m_offsets;
+
+    // Replaced versions stay in the buffer until it is compacted.
+    std::size_t m_compacted_size;
+
+    void compact() {
+        osmium::memory::Buffer buffer{1024 * 1024};
+        for (auto& id_offset : m_offsets) {
+            const std::size_t offset = buffer.committed();
+            buffer.add_item(m_buffer.get<osmium::Way>(id_offset.second));
+            buffer.commit();
+            id_offset.second = offset;
+        }
+        m_buffer = std::move(buffer);
+        m_compacted_size = m_buffer.committed();
+    }
+
+public:
+
+    ChangedWays() :
+        m_buffer(1024 * 1024),
+        m_offsets(),
+        m_compacted_size(0) {
+    }
+
+    void way(const osmium::Way& way) {
+        const auto it = m_offsets.find(way.positive_id());
+        if (it != m_offsets.end() && m_buffer.get<osmium::Way>(it->second).version() > way.version()) {
+            return;
+        }
+
+        const std::size_t offset = m_buffer.committed();
+        m_buffer.add_item(way);
+        m_buffer.commit();
+        m_offsets[way.positive_id()] = offset;
+
+        if (m_buffer.committed() > 2 * m_compacted_size + 64 * 1024 * 1024) {
+            compact();
+        }
+    }
+
+    /**
+     * The newest version of the way or nullptr if it wasn't changed. The
+     * way is not visible if it was deleted.
+     */
+    osmium::Way* get(osmium::unsigned_object_id_type id) const {
+        const auto it = m_offsets.find(id);
+        return it == m_offsets.end() ? nullptr : &m_buffer.get<osmium::Way>(it->second);
+    }
+
+}; // class ChangedWays
+
+/**
+ * Writes the ways with the given IDs (sorted) from an OSM file.
+ */
+class AffectedWaysHandler : public osmium::handler::Handler {
+
+    const std::vector<osmium::unsigned_object_id_type>& m_ids;
+    location_handler_type& m_location_handler;
+    JSONNoAreaHandler& m_json_handler;
+
+public:
+
+    AffectedWaysHandler(const std::vector<osmium::unsigned_object_id_type>& ids, location_handler_type& location_handler, JSONNoAreaHandler& json_handler) :
+        m_ids(ids),
+        m_location_handler(location_handler),
+        m_json_handler(json_handler) {
+    }
+
+    void way(osmium::Way& way) {
+        if (std::binary_search(m_ids.begin(), m_ids.end(), way.positive_id())) {
+            m_location_handler.way(way);
+            m_json_handler.way(way);
+        }
+    }
+
+}; // class AffectedWaysHandler
+
+/**
+ * What the daemon keeps in memory between change files.
+ */
+struct daemon_state {
+    std::unique_ptr<index_type> index;
+    std::unique_ptr<WayIndex> way_index;
+
+    /// Replication sequence number of the location dump, 0 if unknown.
+    std::uint64_t dump_sequence = 0;
+
+    /// Block index of the OSM file, used with the way index.
+    PBFBlockIndex block_index;
+    ChangedWays changed_ways;
+};
+
+/**
+ * Write the ways with the given IDs (sorted), which are not in the change
+ * file but use nodes in it: Ways changed by earlier change files from
+ * memory, all others from the blocks of the OSM file with their IDs.
+ *
+ * @throws std::runtime_error if the OSM file can't be read.
+ */
+void write_affected_ways(const std::vector<osmium::unsigned_object_id_type>& ids, const daemon_state& state, const daemon_options& options,
+                         location_handler_type& location_handler, JSONNoAreaHandler& json_handler) {
+    std::vector<osmium::unsigned_object_id_type> file_ids;
+    for (const auto id : ids) {
+        osmium::Way* way = state.changed_ways.get(id);
+        if (!way) {
+            file_ids.push_back(id);
+        } else if (way->visible()) {
+            location_handler.way(*way);
+            json_handler.way(*way);
+        }
+    }
+
+    std::vector<pbf_block> blocks;
+    for (const auto& block : state.block_index.blocks()) {
+        if (!(block.types & osmium::osm_entity_bits::way) || block.max_id < 0) {
+            continue;
+        }
+        const auto min_id = static_cast<osmium::unsigned_object_id_type>(std::max(block.min_id, osmium::object_id_type(0)));
+        const auto it = std::lower_bound(file_ids.begin(), file_ids.end(), min_id);
+        if (it != file_ids.end() && *it <= static_cast<osmium::unsigned_object_id_type>(block.max_id)) {
+            blocks.push_back(block);
+        }
+    }
+    if (blocks.empty()) {
+        return;
+    }
+
+    AffectedWaysHandler handler{file_ids, location_handler, json_handler};
+    state.block_index.read_blocks(options.osm_file, blocks, osmium::osm_entity_bits::way, [&](osmium::io::Reader& reader) {
+        osmium::apply(reader, handler);
+    });
+}
+
+/**
+ * Apply one change file: Find the changed tiles with the old locations in
+ * the index, then update the index and write the GeoJSON features of all
+ * objects in the change file and, with a way index, of all ways using
+ * nodes in the change file. Then update the location dump and the way
+ * index (which is reopened). The change file must have the replication
+ * sequence number after the one of the location dump.
+ *
+ * @throws std::runtime_error if anything goes wrong. The index might be
+ *         partially updated then.
+ */
+void process_change_file(const std::string& name, daemon_state& state, const AreaClassifier& areas, const daemon_options& options) {
+    const std::string filename = options.watch_dir + "/" + name;
+    const std::string prefix = options.output_dir + "/" + change_file_stem(name);
+
+    TileDiffHandler tile_diff_handler{static_cast<int>(options.zoom), state.way_index.get()};
+    NodeChangeHandler node_change_handler;
+    WayChangeHandler way_change_handler;
+    std::uint64_t replication_sequence = 0;
+    std::uint64_t replication_timestamp = 0;
+    {
+        osmium::io::Reader reader{filename};
+        get_replication_info(reader.header(), replication_sequence, replication_timestamp);
+        if (!replication_sequence) {
+            replication_sequence = change_file_number(name);
+        }
+        if (state.dump_sequence && replication_sequence && replication_sequence != state.dump_sequence + 1) {
+            throw std::runtime_error{"Change file '" + name + "' has replication sequence " + std::to_string(replication_sequence) +
+                                     ", but the location dump is at " + std::to_string(state.dump_sequence) +
+                                     ". Refusing to skip or repeat changes"};
+        }
+        osmium::apply(reader, tile_diff_handler, node_change_handler, way_change_handler, state.changed_ways);
+        reader.close();
+    }
+    tile_diff_handler.add_old_locations(*state.index);
+    const auto changes = node_change_handler.changes();
+
+    // Ways using nodes in the change file change, too, even if they are
+    // not in it.
+    std::vector<way_change> way_changes;
+    std::vector<osmium::unsigned_object_id_type> affected_ways;
+    if (state.way_index) {
+        way_changes = way_change_handler.changes(changes, *state.index);
+        for (const auto& change : changes) {
+            state.way_index->for_each_piece(change.first, [&](std::uint64_t piece) {
+                affected_ways.push_back(state.way_index->pieces()[piece].way_id);
+            });
+        }
+        std::sort(affected_ways.begin(), affected_ways.end());
+        affected_ways.erase(std::unique(affected_ways.begin(), affected_ways.end()), affected_ways.end());
+        affected_ways.erase(std::remove_if(affected_ways.begin(), affected_ways.end(), [&](osmium::unsigned_object_id_type id) {
+            return std::binary_search(way_changes.begin(), way_changes.end(), way_change{id, false, {}}, [](const way_change& a, const way_change& b) {
+                return a.id < b.id;
+            });
+        }), affected_ways.end());
+    }
+
+    output_options output;
+    output.filename = prefix + ".geojson.tmp";
+    output.coordinate_precision = options.coordinate_precision;
+    output.properties = options.properties;
+    output.filter = options.filter;
+    {
+        JSONNoAreaHandler json_handler{options.zoom, "", options.attr_prefix, options.with_id, options.create_polygons, areas, nullptr, output};
+        json_handler.open_output();
+
+        location_handler_type location_handler{*state.index};
+        location_handler.ignore_errors();
+
+        osmium::io::Reader reader{filename};
+        osmium::apply(reader, location_handler, json_handler);
+        reader.close();
+        write_affected_ways(affected_ways, state, options, location_handler, json_handler);
+        json_handler.close_output();
+
+        if (json_handler.geometry_error_count()) {
+            std::cerr << "Number of geometry errors (not written to output): " << json_handler.geometry_error_count()
+                      << " (" << json_handler.rejected_geometry_count() << " found before creating the geometry)\n";
+        }
+    }
+    rename_file(output.filename, prefix + ".geojson");
+
+    write_tile_file(prefix + ".tiles", tile_diff_handler.dirty_tiles(), options.format);
+
+    // Processed change files are renamed, so after a restart the daemon
+    // only sees later changes. The dump and the way index on disk must
+    // always have all changes applied.
+    if (state.way_index) {
+        state.way_index.reset();
+        update_way_index(options.way_index_file, way_changes, changes, replication_sequence, replication_timestamp);
+        state.way_index.reset(new WayIndex{options.way_index_file});
+    }
+    update_location_dump(options.dump_file, changes, replication_sequence, replication_timestamp,
+                         std::max(std::thread::hardware_concurrency(), 1u));
+    if (replication_sequence) {
+        state.dump_sequence = replication_sequence;
+    }
+
+    std::cerr << "Processed '" << name << "': " << tile_diff_handler.dirty_tiles().size() << " dirty tiles, "
+              << affected_ways.size() << " ways using changed nodes.\n";
+}
+
+void print_help() {
+    std::cout << "minjur-daemon [OPTIONS] DIRECTORY\n\n"
+              << "Watches DIRECTORY for change files (*.osc, *.osc.gz, *.osc.bz2).\n"
+              << "\nOptions:\n"
+              << "  -d, --dump=FILE            Location dump to load (default: locations.dump)\n"
+              << "  -f, --format=text|binary   Format of tile lists (default: text)\n"
+              << "  -c, --precision=N          Number of decimal places of coordinates (default: 7)\n"
+              << "  -h, --help                 This help message\n"
+              << "  -v, --version              Display version\n"
+              << "  -i, --with-id              Add unique id to each feature\n"
+              << "  -I, --interval=SECONDS     Time between looking for new change files (default: 10)\n"
+              << "  -l, --location-store=TYPE  Set location store\n"
+              << "  -L, --list-location-stores Show available location stores\n"
+              << "  -n, --nodes=sparse|dense   Are node IDs sparse or dense?\n"
+              << "  -o, --output-dir=DIR       Directory for GeoJSON and tile lists (default: DIRECTORY)\n"
+              << "  -p, --polygons             Create polygons from closed ways\n"
+              << "  -P, --osm-file=FILE        OSM file (PBF) the location dump was created from,\n"
+              << "                             needed with --way-index\n"
+              << "  -A, --area-rules=FILE      Read rules deciding which closed ways are polygons from FILE\n"
+              << "  -W, --way-index=FILE       Add ways using changed nodes from way index\n"
+              << "  -z, --zoom=ZOOM            Zoom level for tiles (default: 15)\n"
+              << "  -a, --attr-prefix=PREFIX   Optional prefix for attributes, defaults to '@'\n"
+              << "  -k, --keep-tags=FILE       Only write tags with the keys listed in FILE\n"
+              << "  -K, --drop-tags=FILE       Don't write tags with the keys listed in FILE\n"
+              << "  -m, --attributes=LIST      Attributes to write (default: id,type,version,changeset,uid,user,timestamp)\n"
+              << "  -F, --filter=EXPR          Only write objects with tags matching EXPR, e.g. 'highway=* and not area=yes'\n";
+}
+
+void print_version() {
+    std::cout << MINJUR_VERSION_STRING << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+
+    static struct option long_options[] = {
+        {"dump",                 required_argument, 0, 'd'},
+        {"format",               required_argument, 0, 'f'},
+        {"precision",            required_argument, 0, 'c'},
+        {"help",                       no_argument, 0, 'h'},
+        {"version",                    no_argument, 0, 'v'},
+        {"with-id",                    no_argument, 0, 'i'},
+        {"interval",             required_argument, 0, 'I'},
+        {"location-store",       required_argument, 0, 'l'},
+        {"list-location-stores",       no_argument, 0, 'L'},
+        {"nodes",                required_argument, 0, 'n'},
+        {"output-dir",           required_argument, 0, 'o'},
+        {"polygons",                   no_argument, 0, 'p'},
+        {"osm-file",             required_argument, 0, 'P'},
+        {"area-rules",           required_argument, 0, 'A'},
+        {"way-index",            required_argument, 0, 'W'},
+        {"zoom",                 required_argument, 0, 'z'},
+        {"attr-prefix",          required_argument, 0, 'a'},
+        {"keep-tags",            required_argument, 0, 'k'},
+        {"drop-tags",            required_argument, 0, 'K'},
+        {"attributes",           required_argument, 0, 'm'},
+        {"filter",               required_argument, 0, 'F'},
+        {0, 0, 0, 0}
+    };
+
+    daemon_options options;
+    options.dump_file = "locations.dump";
+    std::string location_store;
+    std::string keep_tags_file;
+    std::string drop_tags_file;
+    bool nodes_dense = false;
+    int interval = 10;
+
+    while (true) {
+        int c = getopt_long(argc, argv, "d:f:c:hviI:l:Ln:o:pP:A:W:z:a:k:K:m:F:", long_options, 0);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'd':
+                options.dump_file = optarg;
+                break;
+            case 'f':
+                if (!std::strcmp(optarg, "text")) {
+                    options.format = tile_list_format::text;
+                } else if (!std::strcmp(optarg, "binary")) {
+                    options.format = tile_list_format::binary;
+                } else {
+                    std::cerr << "Set --format, -f to 'text' or 'binary'\n";
+                    std::exit(1);
+                }
+                break;
+            case 'c': {
+                    const int precision = std::atoi(optarg);
+                    if (precision < 0 || precision > static_cast<int>(max_coordinate_precision)) {
+                        std::cerr << "Set --precision, -c to a number between 0 and " << max_coordinate_precision << "\n";
+                        std::exit(1);
+                    }
+                    options.coordinate_precision = static_cast<unsigned int>(precision);
+                }
+                break;
+            case 'h':
+                print_help();
+                std::exit(0);
+            case 'v':
+                print_version();
+                std::exit(0);
+            case 'i':
+                options.with_id = true;
+                break;
+            case 'I':
+                interval = std::atoi(optarg);
+                if (interval < 1) {
+                    std::cerr << "Set --interval, -I to a number larger than 0\n";
+                    std::exit(1);
+                }
+                break;
+            case 'l':
+                location_store = optarg;
+                break;
+            case 'L':
+                std::cout << "Available map types:\n";
+                for (const auto& map_type : map_factory.map_types()) {
+                    std::cout << "  " << map_type << "\n";
+                }
+                std::exit(0);
+            case 'n':
+                if (!std::strcmp(optarg, "sparse")) {
+                    nodes_dense = false;
+                } else if (!std::strcmp(optarg, "dense")) {
+                    nodes_dense = true;
+                } else {
+                    std::cerr << "Set --nodes, -n to 'sparse' or 'dense'\n";
+                    std::exit(1);
+                }
+                break;
+            case 'o':
+                options.output_dir = optarg;
+                break;
+            case 'p':
+                options.create_polygons = true;
+                break;
+            case 'P':
+                options.osm_file = optarg;
+                break;
+            case 'A':
+                options.area_rules_file = optarg;
+                break;
+            case 'W':
+                options.way_index_file = optarg;
+                break;
+            case 'z': {
+                    const int z = std::atoi(optarg);
+                    if (z < 0 || z > static_cast<int>(max_tile_zoom)) {
+                        std::cerr << "Set --zoom, -z to a number between 0 and " << max_tile_zoom << "\n";
+                        std::exit(1);
+                    }
+                    options.zoom = static_cast<unsigned int>(z);
+                }
+                break;
+            case 'a':
+                options.attr_prefix = optarg;
+                break;
+            case 'k':
+                keep_tags_file = optarg;
+                break;
+            case 'K':
+                drop_tags_file = optarg;
+                break;
+            case 'm':
+                try {
+                    options.properties.attributes = parse_attribute_list(optarg);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << e.what() << " in --attributes, -m\n";
+                    std::exit(1);
+                }
+                break;
+            case 'F':
+                try {
+                    options.filter = ObjectFilter{optarg};
+                } catch (const std::runtime_error& e) {
+                    std::cerr << e.what() << "\n";
+                    std::exit(1);
+                }
+                break;
+            default:
+                std::exit(1);
+        }
+    }
+
+    try {
+        read_tag_keys(options.properties, keep_tags_file, drop_tags_file);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << "\n";
+        std::exit(1);
+    }
+
+    // The locations are updated in place, so only location stores that
+    // allow setting IDs in any order and more than once can be used.
+    if (location_store.empty()) {
+        if (nodes_dense) {
+            location_store = map_factory.has_map_type("dense_mmap_array") ? "dense_mmap_array" : "dense_mem_array";
+        } else {
+            location_store = "sparse_mem_map";
+        }
+    } else if (location_store.compare(0, 6, "dense_") != 0 && location_store != "sparse_mem_map") {
+        std::cerr << "The location store must be one of the dense stores or sparse_mem_map\n";
+        std::exit(1);
+    }
+
+    // The way index only has the IDs of the ways, their tags are in the
+    // OSM file.
+    if (options.way_index_file.empty() != options.osm_file.empty()) {
+        std::cerr << "--way-index, -W and --osm-file, -P must be used together\n";
+        std::exit(1);
+    }
+
+    const int remaining_args = argc - optind;
+    if (remaining_args != 1) {
+        std::cerr << "Usage: " << argv[0] << " [OPTIONS] DIRECTORY\n";
+        std::exit(1);
+    }
+    options.watch_dir = argv[optind];
+    if (options.output_dir.empty()) {
+        options.output_dir = options.watch_dir;
+    }
+
+    std::cerr << "Using the '" << location_store << "' location store. Use -l or -n to change this.\n";
+
+    daemon_state state;
+    AreaClassifier areas = default_area_rules();
+    try {
+        if (!options.area_rules_file.empty()) {
+            areas = read_area_rules(options.area_rules_file);
+        }
+
+        state.index = map_factory.create_map(location_store);
+
+        std::cerr << "Loading locations from '" << options.dump_file << "'...\n";
+        const CheckedFileArray dump{options.dump_file};
+        dump.for_each([&state](osmium::unsigned_object_id_type id, const osmium::Location& location) {
+            state.index->set(id, location);
+        });
+        state.dump_sequence = dump.info().replication_sequence;
+        if (state.dump_sequence) {
+            std::cerr << "Location dump is from replication sequence " << state.dump_sequence << ".\n";
+        }
+
+        if (!options.way_index_file.empty()) {
+            state.way_index.reset(new WayIndex{options.way_index_file});
+            check_way_index(*state.way_index, dump.info());
+
+            // Ways not in the change files are read from the OSM file, so
+            // it must have the ways the location dump has the nodes of.
+            std::uint64_t osm_sequence = 0;
+            std::uint64_t osm_timestamp = 0;
+            {
+                osmium::io::Reader reader{options.osm_file, osmium::osm_entity_bits::nothing};
+                get_replication_info(reader.header(), osm_sequence, osm_timestamp);
+                reader.close();
+            }
+            if (osm_sequence != state.dump_sequence) {
+                throw std::runtime_error{"OSM file '" + options.osm_file + "' is from replication sequence " + std::to_string(osm_sequence) +
+                                         ", but the location dump from " + std::to_string(state.dump_sequence)};
+            }
+
+            const std::string block_index_file = pbf_index_filename(options.osm_file);
+            try {
+                state.block_index = PBFBlockIndex::read(block_index_file, options.osm_file);
+            } catch (const std::runtime_error&) {
+                std::cerr << "Building block index '" << block_index_file << "'...\n";
+                state.block_index = PBFBlockIndex::build(options.osm_file, nullptr, std::max(std::thread::hardware_concurrency(), 1u));
+                state.block_index.write(block_index_file);
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << "\n";
+        std::exit(1);
+    }
+
+    std::signal(SIGINT, request_stop);
+    std::signal(SIGTERM, request_stop);
+
+    std::cerr << "Watching '" << options.watch_dir << "' for change files...\n";
+    while (!stop_requested) {
+        try {
+            for (const auto& name : find_change_files(options.watch_dir)) {
+                if (stop_requested) {
+                    break;
+                }
+                process_change_file(name, state, areas, options);
+                const std::string filename = options.watch_dir + "/" + name;
+                rename_file(filename, filename + ".done");
+            }
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << "\n";
+            std::exit(1);
+        }
+
+        for (int i = 0; i < interval && !stop_requested; ++i) {
+            ::sleep(1);
+        }
+    }
+
+    std::cerr << "Done.\n";
+}
+
@@ -1,14 +1,17 @@
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <getopt.h>
 #include <iostream>
 #include <memory>
-#include <set>
+#include <stdexcept>
 #include <string>
+#include <system_error>
+#include <thread>
 
 #include <osmium/index/map/all.hpp>
-#include <osmium/handler/node_locations_for_ways.hpp>
 #include <osmium/visitor.hpp>
 
 #include <osmium/geom/tile.hpp>
@@ -16,71 +19,26 @@
 #include <osmium/handler.hpp>
 #include <osmium/osm.hpp>
 
-using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
-using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
-
-class TileDiffHandler : public osmium::handler::Handler {
-
-    int m_zoom;
-    index_type& m_old_index;
-    index_type& m_tmp_index;
-
-    std::set<osmium::geom::Tile> m_dirty_tiles;
-
-    void add_location(const osmium::Location& location) {
-        if (location.valid()) {
-            m_dirty_tiles.emplace(m_zoom, location);
-        }
-    }
-
-public:
-
-    TileDiffHandler(int zoom, index_type& old_index, index_type& tmp_index) :
-        m_zoom(zoom),
-        m_old_index(old_index),
-        m_tmp_index(tmp_index) {
-    }
-
-    void node(const osmium::Node& node) {
-        try {
-            add_location(m_old_index.get(node.id()));
-        } catch (...) {
-        }
-        try {
-            add_location(node.location());
-        } catch (...) {
-        }
-    }
-
-    void way(const osmium::Way& way) {
-        for (const auto& node_ref : way.nodes()) {
-            try {
-                add_location(m_old_index.get(node_ref.ref()));
-            } catch (...) {
-            }
-            try {
-                add_location(m_tmp_index.get(node_ref.ref()));
-            } catch (...) {
-            }
-        }
-    }
+#include "location_dump.hpp"
+#include "tile_index.hpp"
+#include "tile_diff_handler.hpp"
+#include "tile_list.hpp"
+#include "way_index.hpp"
 
-    void dump_tiles() const {
-        for (const auto& tile : m_dirty_tiles) {
-            std::cout << tile.z << " " << tile.x << " " << tile.y << "\n";
-        }
-    }
-
-}; // class TileDiffHandler
+using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
 
 void print_help() {
     std::cout << "minjur-generate-tilelist [OPTIONS] OSM-CHANGE-FILE\n\n" \
               << "Output is always to stdout.\n" \
               << "\nOptions:\n" \
+              << "  -f, --format=text|binary   Format of tile list (default: text)\n" \
               << "  -h, --help                 This help message\n" \
               << "  -l, --location_store=TYPE  Set location store\n" \
               << "  -L, --list-location-stores Show available location stores\n" \
               << "  -n, --nodes=sparse|dense   Are node IDs sparse or dense?\n" \
+              << "  -u, --update-dump          Apply the change file to the location dump\n" \
+              << "                             and the way index\n" \
+              << "  -W, --way-index=FILE       Add tiles of ways using changed nodes from way index\n" \
               << "  -z, --zoom=ZOOM            Zoom level for tiles (default: 15)\n";
 }
 
@@ -88,27 +46,43 @@ int main(int argc, char* argv[]) {
     const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
 
     static struct option long_options[] = {
+        {"format",               required_argument, 0, 'f'},
         {"help",                       no_argument, 0, 'h'},
         {"location_store",       required_argument, 0, 'l'},
         {"list_location_stores",       no_argument, 0, 'L'},
         {"nodes",                required_argument, 0, 'n'},
+        {"update-dump",                no_argument, 0, 'u'},
+        {"way-index",            required_argument, 0, 'W'},
         {"zoom",                 required_argument, 0, 'z'},
         {0, 0, 0, 0}
     };
 
     std::string input_filename = "-";
-    std::string location_store = "sparse_file_array,locations.dump";
-    std::string locations_dump_file;
+    std::string location_store;
+    bool nodes_set = false;
     bool nodes_dense = false;
+    bool update_dump = false;
+    std::string way_index_file;
     int zoom = 15;
+    tile_list_format format = tile_list_format::text;
 
     while (true) {
-        int c = getopt_long(argc, argv, "hl:Ln:z", long_options, 0);
+        int c = getopt_long(argc, argv, "f:hl:Ln:uW:z:", long_options, 0);
         if (c == -1) {
             break;
         }
 
         switch (c) {
+            case 'f':
+                if (!std::strcmp(optarg, "text")) {
+                    format = tile_list_format::text;
+                } else if (!std::strcmp(optarg, "binary")) {
+                    format = tile_list_format::binary;
+                } else {
+                    std::cerr << "Set --format, -f to 'text' or 'binary'\n";
+                    std::exit(1);
+                }
+                break;
             case 'h':
                 print_help();
                 std::exit(0);
@@ -122,6 +96,7 @@ int main(int argc, char* argv[]) {
                 }
                 std::exit(0);
             case 'n':
+                nodes_set = true;
                 if (!std::strcmp(optarg, "sparse")) {
                     nodes_dense = false;
                 } else if (!std::strcmp(optarg, "dense")) {
@@ -131,8 +106,20 @@ int main(int argc, char* argv[]) {
                     std::exit(1);
                 }
                 break;
-            case 'z':
-                zoom = std::atoi(optarg);
+            case 'u':
+                update_dump = true;
+                break;
+            case 'W':
+                way_index_file = optarg;
+                break;
+            case 'z': {
+                    const int z = std::atoi(optarg);
+                    if (z < 0 || z > static_cast<int>(max_tile_zoom)) {
+                        std::cerr << "Set --zoom, -z to a number between 0 and " << max_tile_zoom << "\n";
+                        std::exit(1);
+                    }
+                    zoom = z;
+                }
                 break;
             default:
                 std::exit(1);
@@ -140,8 +127,18 @@ int main(int argc, char* argv[]) {
     }
 
     if (location_store.empty()) {
-        location_store = nodes_dense ? "dense" : "sparse";
-        location_store.append("_file_array,locations.dump");
+        if (nodes_set) {
+            location_store = nodes_dense ? "dense" : "sparse";
+            location_store.append("_file_array,locations.dump");
+        } else {
+            location_store = "checked_file_array,locations.dump";
+        }
+    }
+
+    const std::string checked_prefix = "checked_file_array,";
+    if (update_dump && location_store.compare(0, checked_prefix.size(), checked_prefix) != 0) {
+        std::cerr << "--update-dump, -u only works with the checked_file_array location store\n";
+        std::exit(1);
     }
 
     std::cerr << "Using the '" << location_store << "' location store. Use -l or -n to change this.\n";
@@ -160,16 +157,73 @@ int main(int argc, char* argv[]) {
 
     osmium::io::Reader reader{input_filename};
 
-    std::unique_ptr<index_type> old_index = map_factory.create_map(location_store);
-    std::unique_ptr<index_type> tmp_index = map_factory.create_map("sparse_mem_array");
-    location_handler_type location_handler{*tmp_index};
-    location_handler.ignore_errors();
+    std::unique_ptr<index_type> old_index;
+    try {
+        old_index = map_factory.create_map(location_store);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << "\n";
+        std::exit(1);
+    }
 
-    TileDiffHandler tile_diff_handler{zoom, *old_index, *tmp_index};
+    const auto* checked_index = dynamic_cast<const CheckedFileArray*>(old_index.get());
+    if (checked_index && checked_index->info().replication_sequence) {
+        std::cerr << "Location dump is from replication sequence " << checked_index->info().replication_sequence << ".\n";
+    }
 
-    osmium::apply(reader, location_handler, tile_diff_handler);
+    std::unique_ptr<WayIndex> way_index;
+    if (!way_index_file.empty()) {
+        try {
+            way_index.reset(new WayIndex{way_index_file});
+            if (checked_index) {
+                check_way_index(*way_index, checked_index->info());
+            }
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << "\n";
+            std::exit(1);
+        }
+    }
+
+    TileDiffHandler tile_diff_handler{zoom, way_index.get()};
+    NodeChangeHandler node_change_handler;
+    WayChangeHandler way_change_handler;
+
+    try {
+        osmium::apply(reader, tile_diff_handler, node_change_handler, way_change_handler);
+        tile_diff_handler.add_old_locations(*old_index);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << "\n";
+        std::exit(1);
+    }
+    std::uint64_t replication_sequence = 0;
+    std::uint64_t replication_timestamp = 0;
+    get_replication_info(reader.header(), replication_sequence, replication_timestamp);
     reader.close();
 
-    tile_diff_handler.dump_tiles();
-}
+    try {
+        write_tile_list(1, tile_diff_handler.dirty_tiles(), format);
+    } catch (const std::system_error& e) {
+        std::cerr << e.what() << "\n";
+        std::exit(1);
+    }
 
+    if (update_dump) {
+        const std::string dump_filename = location_store.substr(checked_prefix.size());
+        const auto changes = node_change_handler.changes();
+        try {
+            // The new node locations of the changed ways are in the change
+            // file or in the old dump, so get them before updating it.
+            if (way_index) {
+                const auto way_changes = way_change_handler.changes(changes, *old_index);
+                way_index.reset();
+                std::cerr << "Applying " << way_changes.size() << " way changes to '" << way_index_file << "'...\n";
+                update_way_index(way_index_file, way_changes, changes, replication_sequence, replication_timestamp);
+            }
+            old_index.reset();
+            std::cerr << "Applying " << changes.size() << " node changes to '" << dump_filename << "'...\n";
+            update_location_dump(dump_filename, changes, replication_sequence, replication_timestamp, std::max(std::thread::hardware_concurrency(), 1u));
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << "\n";
+            std::exit(1);
+        }
+    }
+}
@@ -0,0 +1,113 @@
+#include <cstddef>
+#include <cstdlib>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <osmium/osm/entity_bits.hpp>
+
+#include "minjur_version.hpp"
+#include "location_dump.hpp"
+#include "pbf_index.hpp"
+
+void print_help() {
+    std::cout << "minjur-index [OPTIONS] OSMFILE\n\n"
+              << "Write block index of PBF file OSMFILE.\n"
+              << "\nOptions:\n"
+              << "  -d, --dump=FILE            Location dump of OSMFILE for bounding boxes of ways\n"
+              << "  -h, --help                 This help message\n"
+              << "  -v, --version              Display version\n"
+              << "  -o, --output=FILE          Write index to FILE (default: OSMFILE.idx)\n"
+              << "  -T, --threads=N            Number of threads reading blocks (default: 1)\n";
+}
+
+void print_version() {
+    std::cout << MINJUR_VERSION_STRING << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"dump",                 required_argument, 0, 'd'},
+        {"help",                       no_argument, 0, 'h'},
+        {"version",                    no_argument, 0, 'v'},
+        {"output",               required_argument, 0, 'o'},
+        {"threads",              required_argument, 0, 'T'},
+        {0, 0, 0, 0}
+    };
+
+    std::string dump_file;
+    std::string index_file;
+    int num_threads = 1;
+
+    while (true) {
+        int c = getopt_long(argc, argv, "d:hvo:T:", long_options, 0);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'd':
+                dump_file = optarg;
+                break;
+            case 'h':
+                print_help();
+                std::exit(0);
+            case 'v':
+                print_version();
+                std::exit(0);
+            case 'o':
+                index_file = optarg;
+                break;
+            case 'T':
+                num_threads = std::atoi(optarg);
+                if (num_threads < 1) {
+                    std::cerr << "Set --threads, -T to a number larger than 0\n";
+                    std::exit(1);
+                }
+                break;
+            default:
+                std::exit(1);
+        }
+    }
+
+    if (argc - optind != 1) {
+        std::cerr << "Usage: " << argv[0] << " [OPTIONS] OSMFILE\n";
+        std::exit(1);
+    }
+    const std::string input_filename = argv[optind];
+    if (index_file.empty()) {
+        index_file = pbf_index_filename(input_filename);
+    }
+
+    try {
+        std::unique_ptr<CheckedFileArray> locations;
+        if (!dump_file.empty()) {
+            std::cerr << "Checking location dump '" << dump_file << "'...\n";
+            locations.reset(new CheckedFileArray{dump_file});
+            locations->check_all();
+        }
+
+        std::cerr << "Reading blocks of '" << input_filename << "'...\n";
+        const auto index = PBFBlockIndex::build(input_filename, locations.get(), static_cast<std::size_t>(num_threads));
+
+        std::size_t counts[3] = {0, 0, 0};
+        for (const auto& block : index.blocks()) {
+            counts[0] += (block.types & osmium::osm_entity_bits::node) ? 1 : 0;
+            counts[1] += (block.types & osmium::osm_entity_bits::way) ? 1 : 0;
+            counts[2] += (block.types & osmium::osm_entity_bits::relation) ? 1 : 0;
+        }
+        std::cerr << "Found " << index.blocks().size() << " blocks (" << counts[0] << " with nodes, "
+                  << counts[1] << " with ways, " << counts[2] << " with relations).\n";
+
+        std::cerr << "Writing block index to '" << index_file << "'...\n";
+        index.write(index_file);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << "\n";
+        std::exit(1);
+    }
+
+    std::cerr << "Done.\n";
+}
+
@@ -1,10 +1,17 @@
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdlib>
 #include <cstring>
 #include <getopt.h>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <stdexcept>
 #include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
 
 #include <osmium/area/assembler.hpp>
 #include <osmium/area/multipolygon_collector.hpp>
@@ -22,6 +29,8 @@
 #include "minjur_version.hpp"
 #include "json_feature.hpp"
 #include "json_handler.hpp"
+#include "parallel_serializer.hpp"
+#include "pbf_index.hpp"
 
 using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
 using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
@@ -31,23 +40,27 @@ class JSONAreaHandler : public JSONHandler {
 
 public:
 
-    JSONAreaHandler(const std::string& error_file, const std::string& attr_prefix, bool with_id) :
-        JSONHandler(error_file, attr_prefix, with_id) {
+    JSONAreaHandler(const std::string& error_file, const std::string& attr_prefix, bool with_id, const output_options& output) :
+        JSONHandler(error_file, attr_prefix, with_id, output) {
     }
 
     void node(const osmium::Node& node) {
-        if (node.tags().empty()) {
+        if (node.tags().empty() || !selected(node.tags())) {
+            return;
+        }
+
+        if (reject_geometry(node, check_point(node))) {
             return;
         }
 
         try {
-            JSONFeature feature{attr_names()};
+            JSONFeature feature{feature_writer(), buffer("n", node.id())};
             if (with_id()) {
                 feature.add_id("n", node.id());
             }
             feature.add_point(node);
             feature.add_properties(node);
-            feature.append_to(buffer());
+            feature.finish();
         } catch (const osmium::geometry_error&) {
             report_geometry_problem(node, "geometry_error");
         } catch (const osmium::invalid_location&) {
@@ -58,17 +71,22 @@ public:
     }
 
     void way(const osmium::Way& way) {
-        if (way.nodes().size() <= 1) {
+        if (way.nodes().size() <= 1 || !selected(way.tags())) {
+            return;
+        }
+
+        if (reject_geometry(way, check_linestring(way))) {
             return;
         }
+
         try {
-            JSONFeature feature{attr_names()};
+            JSONFeature feature{feature_writer(), buffer("w", way.id())};
             if (with_id()) {
                 feature.add_id("w", way.id());
             }
             feature.add_linestring(way);
             feature.add_properties(way);
-            feature.append_to(buffer());
+            feature.finish();
         } catch (const osmium::geometry_error&) {
             report_geometry_problem(way, "geometry_error");
         } catch (const osmium::invalid_location&) {
@@ -79,14 +97,22 @@ public:
     }
 
     void area(const osmium::Area& area) {
+        if (!selected(area.tags())) {
+            return;
+        }
+
+        if (reject_geometry(area, check_multipolygon(area))) {
+            return;
+        }
+
         try {
-            JSONFeature feature{attr_names()};
+            JSONFeature feature{feature_writer(), buffer("a", area.id())};
             if (with_id()) {
                 feature.add_id("a", area.id());
             }
             feature.add_multipolygon(area);
             feature.add_properties(area);
-            feature.append_to(buffer());
+            feature.finish();
         } catch (const osmium::geometry_error&) {
             report_geometry_problem(area, "geometry_error");
         } catch (const osmium::invalid_location&) {
@@ -102,16 +128,29 @@ public:
 
 void print_help() {
     std::cout << "minjur-mp [OPTIONS] INFILE\n\n"
-              << "Output is always to stdout.\n"
+              << "Output is to stdout unless --output is set.\n"
               << "\nOptions:\n"
               << "  -e, --error-file=FILE      Write errors to file\n"
+              << "  -B, --buffer-size=MB       Size of output buffers in MBytes (default: 1)\n"
+              << "  -c, --precision=N          Number of decimal places of coordinates (default: 7)\n"
               << "  -h, --help                 This help message\n"
               << "  -v, --version              Display version\n"
               << "  -i, --with-id              Add unique id to each feature\n"
+              << "  -I, --index=FILE           Read only relation blocks in pass 1 using block index\n"
               << "  -l, --location-store=TYPE  Set location store\n"
               << "  -L, --list-location-stores Show available location stores\n"
               << "  -n, --nodes=sparse|dense   Are node IDs sparse or dense?\n"
-              << "  -a, --attr-prefix=PREFIX   Optional prefix for attributes, defaults to '@'\n";
+              << "  -o, --output=FILE          Write output to FILE, compressed if it ends in .gz\n"
+              << "  -P, --output-prefix=PATH   Write output to shard files starting with PATH\n"
+              << "  -Q, --queue-depth=N        Number of output buffers queued for writing (default: 2)\n"
+              << "  -s, --shards=N             Number of shard files when sharding by id\n"
+              << "  -S, --shard-by=id|type     Put features in shards by id or by type (default: id)\n"
+              << "  -T, --threads=N            Number of threads creating GeoJSON (default: 1)\n"
+              << "  -a, --attr-prefix=PREFIX   Optional prefix for attributes, defaults to '@'\n"
+              << "  -k, --keep-tags=FILE       Only write tags with the keys listed in FILE\n"
+              << "  -K, --drop-tags=FILE       Don't write tags with the keys listed in FILE\n"
+              << "  -m, --attributes=LIST      Attributes to write (default: id,type,version,changeset,uid,user,timestamp)\n"
+              << "  -F, --filter=EXPR          Only write objects with tags matching EXPR, e.g. 'highway=* and not area=yes'\n";
 }
 
 void print_version() {
@@ -123,24 +162,42 @@ int main(int argc, char* argv[]) {
 
     static struct option long_options[] = {
         {"error-file",           required_argument, 0, 'e'},
+        {"buffer-size",          required_argument, 0, 'B'},
+        {"precision",            required_argument, 0, 'c'},
         {"help",                       no_argument, 0, 'h'},
         {"version",                    no_argument, 0, 'v'},
         {"with-id",                    no_argument, 0, 'i'},
+        {"index",                required_argument, 0, 'I'},
         {"location-store",       required_argument, 0, 'l'},
         {"list-location-stores",       no_argument, 0, 'L'},
         {"nodes",                required_argument, 0, 'n'},
+        {"output",               required_argument, 0, 'o'},
+        {"output-prefix",        required_argument, 0, 'P'},
+        {"queue-depth",          required_argument, 0, 'Q'},
+        {"shards",               required_argument, 0, 's'},
+        {"shard-by",             required_argument, 0, 'S'},
+        {"threads",              required_argument, 0, 'T'},
         {"attr-prefix",          required_argument, 0, 'a'},
+        {"keep-tags",            required_argument, 0, 'k'},
+        {"drop-tags",            required_argument, 0, 'K'},
+        {"attributes",           required_argument, 0, 'm'},
+        {"filter",               required_argument, 0, 'F'},
         {0, 0, 0, 0}
     };
 
     std::string location_store;
     std::string error_file;
+    std::string index_file;
+    std::string keep_tags_file;
+    std::string drop_tags_file;
     std::string attr_prefix = "@";
     bool nodes_dense = false;
     bool with_id = false;
+    int num_threads = 1;
+    output_options output;
 
     while (true) {
-        int c = getopt_long(argc, argv, "e:hivl:Ln:a:", long_options, 0);
+        int c = getopt_long(argc, argv, "e:B:c:hiI:vl:Ln:o:P:Q:s:S:T:a:k:K:m:F:", long_options, 0);
         if (c == -1) {
             break;
         }
@@ -149,6 +206,24 @@ int main(int argc, char* argv[]) {
             case 'e':
                 error_file = optarg;
                 break;
+            case 'B': {
+                    const int size = std::atoi(optarg);
+                    if (size < 1) {
+                        std::cerr << "Set --buffer-size, -B to a number larger than 0\n";
+                        std::exit(1);
+                    }
+                    output.buffer_size = static_cast<std::size_t>(size) * 1024 * 1024;
+                }
+                break;
+            case 'c': {
+                    const int precision = std::atoi(optarg);
+                    if (precision < 0 || precision > static_cast<int>(max_coordinate_precision)) {
+                        std::cerr << "Set --precision, -c to a number between 0 and " << max_coordinate_precision << "\n";
+                        std::exit(1);
+                    }
+                    output.coordinate_precision = static_cast<unsigned int>(precision);
+                }
+                break;
             case 'h':
                 print_help();
                 std::exit(0);
@@ -158,6 +233,9 @@ int main(int argc, char* argv[]) {
             case 'i':
                 with_id = true;
                 break;
+            case 'I':
+                index_file = optarg;
+                break;
             case 'l':
                 location_store = optarg;
                 break;
@@ -177,14 +255,84 @@ int main(int argc, char* argv[]) {
                     std::exit(1);
                 }
                 break;
+            case 'o':
+                output.filename = optarg;
+                break;
+            case 'P':
+                output.shard_prefix = optarg;
+                break;
+            case 'Q': {
+                    const int depth = std::atoi(optarg);
+                    if (depth < 1) {
+                        std::cerr << "Set --queue-depth, -Q to a number larger than 0\n";
+                        std::exit(1);
+                    }
+                    output.queue_depth = static_cast<std::size_t>(depth);
+                }
+                break;
+            case 's': {
+                    const int shards = std::atoi(optarg);
+                    if (shards < 1) {
+                        std::cerr << "Set --shards, -s to a number larger than 0\n";
+                        std::exit(1);
+                    }
+                    output.shards = static_cast<std::size_t>(shards);
+                }
+                break;
+            case 'S':
+                if (!std::strcmp(optarg, "id")) {
+                    output.shard_by = shard_type::id;
+                } else if (!std::strcmp(optarg, "type")) {
+                    output.shard_by = shard_type::type;
+                } else {
+                    std::cerr << "Set --shard-by, -S to 'id' or 'type'\n";
+                    std::exit(1);
+                }
+                break;
+            case 'T':
+                num_threads = std::atoi(optarg);
+                if (num_threads < 1) {
+                    std::cerr << "Set --threads, -T to a number larger than 0\n";
+                    std::exit(1);
+                }
+                break;
             case 'a':
                 attr_prefix = optarg;
                 break;
+            case 'k':
+                keep_tags_file = optarg;
+                break;
+            case 'K':
+                drop_tags_file = optarg;
+                break;
+            case 'm':
+                try {
+                    output.properties.attributes = parse_attribute_list(optarg);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << e.what() << " in --attributes, -m\n";
+                    std::exit(1);
+                }
+                break;
+            case 'F':
+                try {
+                    output.filter = ObjectFilter{optarg};
+                } catch (const std::runtime_error& e) {
+                    std::cerr << e.what() << "\n";
+                    std::exit(1);
+                }
+                break;
             default:
                 std::exit(1);
         }
     }
 
+    try {
+        read_tag_keys(output.properties, keep_tags_file, drop_tags_file);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << "\n";
+        std::exit(1);
+    }
+
     if (location_store.empty()) {
         location_store = nodes_dense ? "dense" : "sparse";
 
@@ -194,6 +342,22 @@ int main(int argc, char* argv[]) {
             location_store.append("_mem_array");
         }
     }
+    output.compression_threads = static_cast<std::size_t>(num_threads);
+
+    if (!output.shard_prefix.empty()) {
+        if (!output.filename.empty()) {
+            std::cerr << "Use either --output, -o or --output-prefix, -P\n";
+            std::exit(1);
+        }
+        if (output.shard_by == shard_type::id && output.shards == 0) {
+            std::cerr << "Set --shards, -s when sharding by id\n";
+            std::exit(1);
+        }
+    } else if (output.shards > 0 || output.shard_by == shard_type::type) {
+        std::cerr << "Set --output-prefix, -P for sharded output\n";
+        std::exit(1);
+    }
+
     std::cerr << "Using the '" << location_store << "' location store. Use -l or -n to change this.\n";
 
     std::string input_filename;
@@ -210,9 +374,26 @@ int main(int argc, char* argv[]) {
     osmium::area::MultipolygonCollector<osmium::area::Assembler> collector{assembler_config};
 
     std::cerr << "Pass 1...\n";
-    osmium::io::Reader reader1{input_filename, osmium::osm_entity_bits::relation};
-    collector.read_relations(reader1);
-    reader1.close();
+    if (index_file.empty()) {
+        osmium::io::Reader reader1{input_filename, osmium::osm_entity_bits::relation};
+        collector.read_relations(reader1);
+        reader1.close();
+    } else {
+        try {
+            const auto pbf_index = PBFBlockIndex::read(index_file, input_filename);
+            std::vector<pbf_block> blocks;
+            std::copy_if(pbf_index.blocks().begin(), pbf_index.blocks().end(), std::back_inserter(blocks), [](const pbf_block& block) {
+                return (block.types & osmium::osm_entity_bits::relation) != 0;
+            });
+            std::cerr << "Reading " << blocks.size() << " of " << pbf_index.blocks().size() << " blocks.\n";
+            pbf_index.read_blocks(input_filename, blocks, osmium::osm_entity_bits::relation, [&collector](osmium::io::Reader& reader) {
+                collector.read_relations(reader);
+            });
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << "\n";
+            std::exit(1);
+        }
+    }
     std::cerr << "Pass 1 done\n";
 
 
@@ -220,20 +401,59 @@ int main(int argc, char* argv[]) {
     location_handler_type location_handler{*index};
     location_handler.ignore_errors();
 
-    JSONAreaHandler json_handler{error_file, attr_prefix, with_id};
+    JSONAreaHandler json_handler{error_file, attr_prefix, with_id, output};
+    try {
+        json_handler.open_output();
+    } catch (const std::system_error& e) {
+        std::cerr << e.what() << "\n";
+        std::exit(1);
+    }
     osmium::handler::CheckOrder check_order_handler;
 
     std::cerr << "Pass 2...\n";
     osmium::io::Reader reader2{input_filename};
-    osmium::apply(reader2, check_order_handler, location_handler, json_handler, collector.handler([&json_handler](osmium::memory::Buffer&& buffer) {
-        osmium::apply(buffer, json_handler);
-    }));
+    if (num_threads > 1) {
+        ParallelSerializer<JSONAreaHandler> serializer{json_handler, static_cast<std::size_t>(num_threads), [&]() {
+            return std::unique_ptr<JSONAreaHandler>{new JSONAreaHandler{"", attr_prefix, with_id, output}};
+        }};
+        std::vector<osmium::memory::Buffer> area_buffers;
+        auto&& area_handler = collector.handler([&area_buffers](osmium::memory::Buffer&& buffer) {
+            area_buffers.push_back(std::move(buffer));
+        });
+        while (osmium::memory::Buffer buffer = reader2.read()) {
+            osmium::apply(buffer, check_order_handler, location_handler, area_handler);
+            serializer.submit(std::move(buffer));
+
+            // The collector is flushed after every buffer, the areas
+            // assembled from it come after its objects.
+            for (auto& area_buffer : area_buffers) {
+                serializer.submit(std::move(area_buffer));
+            }
+            area_buffers.clear();
+        }
+        serializer.finish();
+    } else {
+        osmium::apply(reader2, check_order_handler, location_handler, json_handler, collector.handler([&json_handler](osmium::memory::Buffer&& buffer) {
+            osmium::apply(buffer, json_handler);
+        }));
+    }
     reader2.close();
+    try {
+        json_handler.close_output();
+    } catch (const std::system_error& e) {
+        std::cerr << e.what() << "\n";
+        std::exit(1);
+    }
     std::cerr << "Pass 2 done\n";
 
+    std::cerr << "Wrote " << json_handler.feature_count() << " features, "
+              << json_handler.feature_allocation_count() << " of them needed memory allocations.\n";
+    std::cerr << "Output stalled waiting for the consumer for " << json_handler.output_stall_time() << " seconds.\n";
+
 
     if (json_handler.geometry_error_count()) {
-        std::cerr << "Number of geometry errors (not written to output): " << json_handler.geometry_error_count() << "\n";
+        std::cerr << "Number of geometry errors (not written to output): " << json_handler.geometry_error_count()
+                  << " (" << json_handler.rejected_geometry_count() << " found before creating the geometry)\n";
     }
 
     std::cerr << "Done.\n";
@@ -0,0 +1,387 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <osmium/handler.hpp>
+#include <osmium/io/any_input.hpp>
+#include <osmium/osm.hpp>
+#include <osmium/visitor.hpp>
+
+#include "minjur_version.hpp"
+#include "json_no_area_handler.hpp"
+#include "location_dump.hpp"
+#include "pbf_index.hpp"
+#include "tile_diff_handler.hpp"
+#include "tile_index.hpp"
+#include "way_index.hpp"
+
+/**
+ * The node locations after the change file: the changes on top of the old
+ * location dump. Deleted nodes have an undefined location. The changes
+ * must be ordered by ID.
+ */
+class UpdatedLocations : public osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location> {
+
+    const CheckedFileArray& m_old_locations;
+    const std::vector<location_change>& m_changes;
+
+public:
+
+    UpdatedLocations(const CheckedFileArray& old_locations, const std::vector<location_change>& changes) :
+        m_old_locations(old_locations),
+        m_changes(changes) {
+    }
+
+    /**
+     * Look up the location of the ID without throwing if it is unknown.
+     * The location is undefined then.
+     */
+    osmium::Location lookup(const osmium::unsigned_object_id_type id) const {
+        const auto it = std::lower_bound(m_changes.begin(), m_changes.end(), location_change{id, osmium::Location{}},
+                                         [](const location_change& a, const location_change& b) {
+            return a.first < b.first;
+        });
+        if (it != m_changes.end() && it->first == id) {
+            return it->second;
+        }
+        return m_old_locations.lookup(id);
+    }
+
+    void set(const osmium::unsigned_object_id_type /*id*/, const osmium::Location /*value*/) override {
+        throw std::runtime_error{"The updated locations are read-only"};
+    }
+
+    /**
+     * @throws osmium::not_found if the node is unknown or deleted.
+     */
+    const osmium::Location get(const osmium::unsigned_object_id_type id) const override {
+        const osmium::Location location = lookup(id);
+        if (!location.valid()) {
+            throw osmium::not_found{"id " + std::to_string(id) + " not found"};
+        }
+        return location;
+    }
+
+    std::size_t size() const override {
+        return m_old_locations.size();
+    }
+
+    std::size_t used_memory() const override {
+        return m_changes.capacity() * sizeof(location_change);
+    }
+
+    void clear() override {
+        throw std::runtime_error{"The updated locations are read-only"};
+    }
+
+}; // class UpdatedLocations
+
+/**
+ * Sets the node locations in ways from the old location dump and the
+ * changes. Nodes in the new file have those locations, so the nodes
+ * themselves don't have to be read.
+ */
+class UpdatedLocationsHandler : public osmium::handler::Handler {
+
+    const UpdatedLocations& m_locations;
+
+public:
+
+    explicit UpdatedLocationsHandler(const UpdatedLocations& locations) :
+        m_locations(locations) {
+    }
+
+    void way(osmium::Way& way) {
+        for (auto& node_ref : way.nodes()) {
+            node_ref.set_location(m_locations.lookup(node_ref.positive_ref()));
+        }
+    }
+
+}; // class UpdatedLocationsHandler
+
+/**
+ * The blocks that can contain nodes or ways in the tiles. Relations are
+ * not needed, blocks with unknown bounding box are always used.
+ */
+std::vector<pbf_block> select_blocks(const PBFBlockIndex& index, const TileIndex& tiles) {
+    std::vector<pbf_block> blocks;
+    for (const auto& block : index.blocks()) {
+        if (!(block.types & (osmium::osm_entity_bits::node | osmium::osm_entity_bits::way))) {
+            continue;
+        }
+        if (block.box.valid() && !tiles.intersects(block.box)) {
+            continue;
+        }
+        blocks.push_back(block);
+    }
+
+    return blocks;
+}
+
+void print_help() {
+    std::cout << "minjur-update [OPTIONS] OLD-DUMP OSM-CHANGE-FILE NEW-OSMFILE\n\n"
+              << "Output is to stdout unless --output is set.\n"
+              << "\nOptions:\n"
+              << "  -e, --error-file=FILE      Write errors to file\n"
+              << "  -c, --precision=N          Number of decimal places of coordinates (default: 7)\n"
+              << "  -h, --help                 This help message\n"
+              << "  -v, --version              Display version\n"
+              << "  -i, --with-id              Add unique id to each feature\n"
+              << "  -I, --index=FILE           Block index of NEW-OSMFILE (default: NEW-OSMFILE.idx)\n"
+              << "  -o, --output=FILE          Write output to FILE, compressed if it ends in .gz\n"
+              << "  -p, --polygons             Create polygons from closed ways\n"
+              << "  -A, --area-rules=FILE      Read rules deciding which closed ways are polygons from FILE\n"
+              << "  -T, --threads=N            Number of threads for building the block index (default: 1)\n"
+              << "  -u, --update-dump          Apply the change file to OLD-DUMP and the way\n"
+              << "                             index\n"
+              << "  -W, --way-index=FILE       Add tiles of ways using changed nodes from way index\n"
+              << "  -z, --zoom=ZOOM            Zoom level for tiles (default: 15)\n"
+              << "  -a, --attr-prefix=PREFIX   Optional prefix for attributes, defaults to '@'\n"
+              << "  -k, --keep-tags=FILE       Only write tags with the keys listed in FILE\n"
+              << "  -K, --drop-tags=FILE       Don't write tags with the keys listed in FILE\n"
+              << "  -m, --attributes=LIST      Attributes to write (default: id,type,version,changeset,uid,user,timestamp)\n"
+              << "  -F, --filter=EXPR          Only write objects with tags matching EXPR, e.g. 'highway=* and not area=yes'\n";
+}
+
+void print_version() {
+    std::cout << MINJUR_VERSION_STRING << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"error-file",           required_argument, 0, 'e'},
+        {"precision",            required_argument, 0, 'c'},
+        {"help",                       no_argument, 0, 'h'},
+        {"version",                    no_argument, 0, 'v'},
+        {"with-id",                    no_argument, 0, 'i'},
+        {"index",                required_argument, 0, 'I'},
+        {"output",               required_argument, 0, 'o'},
+        {"polygons",                   no_argument, 0, 'p'},
+        {"area-rules",           required_argument, 0, 'A'},
+        {"threads",              required_argument, 0, 'T'},
+        {"update-dump",                no_argument, 0, 'u'},
+        {"way-index",            required_argument, 0, 'W'},
+        {"zoom",                 required_argument, 0, 'z'},
+        {"attr-prefix",          required_argument, 0, 'a'},
+        {"keep-tags",            required_argument, 0, 'k'},
+        {"drop-tags",            required_argument, 0, 'K'},
+        {"attributes",           required_argument, 0, 'm'},
+        {"filter",               required_argument, 0, 'F'},
+        {0, 0, 0, 0}
+    };
+
+    std::string error_file;
+    std::string index_file;
+    std::string way_index_file;
+    std::string area_rules_file;
+    std::string keep_tags_file;
+    std::string drop_tags_file;
+    std::string attr_prefix = "@";
+    bool with_id = false;
+    bool create_polygons = false;
+    bool update_dump = false;
+    unsigned int zoom = 15;
+    int num_threads = 1;
+    output_options output;
+
+    while (true) {
+        int c = getopt_long(argc, argv, "e:c:hviI:o:pA:T:uW:z:a:k:K:m:F:", long_options, 0);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'e':
+                error_file = optarg;
+                break;
+            case 'c': {
+                    const int precision = std::atoi(optarg);
+                    if (precision < 0 || precision > static_cast<int>(max_coordinate_precision)) {
+                        std::cerr << "Set --precision, -c to a number between 0 and " << max_coordinate_precision << "\n";
+                        std::exit(1);
+                    }
+                    output.coordinate_precision = static_cast<unsigned int>(precision);
+                }
+                break;
+            case 'h':
+                print_help();
+                std::exit(0);
+            case 'v':
+                print_version();
+                std::exit(0);
+            case 'i':
+                with_id = true;
+                break;
+            case 'I':
+                index_file = optarg;
+                break;
+            case 'o':
+                output.filename = optarg;
+                break;
+            case 'p':
+                create_polygons = true;
+                break;
+            case 'A':
+                area_rules_file = optarg;
+                break;
+            case 'T':
+                num_threads = std::atoi(optarg);
+                if (num_threads < 1) {
+                    std::cerr << "Set --threads, -T to a number larger than 0\n";
+                    std::exit(1);
+                }
+                break;
+            case 'u':
+                update_dump = true;
+                break;
+            case 'W':
+                way_index_file = optarg;
+                break;
+            case 'z': {
+                    const int z = std::atoi(optarg);
+                    if (z < 0 || z > static_cast<int>(max_tile_zoom)) {
+                        std::cerr << "Set --zoom, -z to a number between 0 and " << max_tile_zoom << "\n";
+                        std::exit(1);
+                    }
+                    zoom = static_cast<unsigned int>(z);
+                }
+                break;
+            case 'a':
+                attr_prefix = optarg;
+                break;
+            case 'k':
+                keep_tags_file = optarg;
+                break;
+            case 'K':
+                drop_tags_file = optarg;
+                break;
+            case 'm':
+                try {
+                    output.properties.attributes = parse_attribute_list(optarg);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << e.what() << " in --attributes, -m\n";
+                    std::exit(1);
+                }
+                break;
+            case 'F':
+                try {
+                    output.filter = ObjectFilter{optarg};
+                } catch (const std::runtime_error& e) {
+                    std::cerr << e.what() << "\n";
+                    std::exit(1);
+                }
+                break;
+            default:
+                std::exit(1);
+        }
+    }
+
+    try {
+        read_tag_keys(output.properties, keep_tags_file, drop_tags_file);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << "\n";
+        std::exit(1);
+    }
+
+    if (argc - optind != 3) {
+        std::cerr << "Usage: " << argv[0] << " [OPTIONS] OLD-DUMP OSM-CHANGE-FILE NEW-OSMFILE\n";
+        std::exit(1);
+    }
+    const std::string dump_file = argv[optind];
+    const std::string change_file = argv[optind + 1];
+    const std::string input_filename = argv[optind + 2];
+    if (index_file.empty()) {
+        index_file = pbf_index_filename(input_filename);
+    }
+
+    try {
+        const AreaClassifier areas = area_rules_file.empty() ? default_area_rules() : read_area_rules(area_rules_file);
+        std::unique_ptr<CheckedFileArray> old_locations{new CheckedFileArray{dump_file}};
+
+        std::unique_ptr<WayIndex> way_index;
+        if (!way_index_file.empty()) {
+            way_index.reset(new WayIndex{way_index_file});
+            check_way_index(*way_index, old_locations->info());
+        }
+
+        std::cerr << "Reading changes from '" << change_file << "'...\n";
+        TileDiffHandler tile_diff_handler{static_cast<int>(zoom), way_index.get()};
+        NodeChangeHandler node_change_handler;
+        WayChangeHandler way_change_handler;
+        std::uint64_t replication_sequence = 0;
+        std::uint64_t replication_timestamp = 0;
+        {
+            osmium::io::Reader reader{change_file};
+            get_replication_info(reader.header(), replication_sequence, replication_timestamp);
+            osmium::apply(reader, tile_diff_handler, node_change_handler, way_change_handler);
+            reader.close();
+        }
+        tile_diff_handler.add_old_locations(*old_locations);
+        const TileIndex& tiles = tile_diff_handler.dirty_tiles();
+        const auto changes = node_change_handler.changes();
+        std::cerr << "Found " << tiles.size() << " dirty tiles.\n";
+
+        PBFBlockIndex index;
+        bool have_index = false;
+        try {
+            index = PBFBlockIndex::read(index_file);
+            have_index = index.matches(input_filename);
+        } catch (const std::runtime_error&) {
+        }
+        const UpdatedLocations updated_locations{*old_locations, changes};
+        if (!have_index) {
+            // With the locations the blocks with ways get bounding boxes,
+            // so only blocks near the dirty tiles are read. The boxes need
+            // the locations after the change, ways can use created nodes
+            // that are not in the old dump.
+            std::cerr << "Building block index '" << index_file << "'...\n";
+            old_locations->check_all();
+            index = PBFBlockIndex::build(input_filename, &updated_locations, static_cast<std::size_t>(num_threads));
+            index.write(index_file);
+        }
+
+        const auto blocks = tiles.empty() ? std::vector<pbf_block>{} : select_blocks(index, tiles);
+        std::cerr << "Reading " << blocks.size() << " of " << index.blocks().size() << " blocks from '" << input_filename << "'...\n";
+
+        JSONNoAreaHandler json_handler{zoom, error_file, attr_prefix, with_id, create_polygons, areas, &tiles, output};
+        json_handler.open_output();
+
+        UpdatedLocationsHandler location_handler{updated_locations};
+        index.read_blocks(input_filename, blocks, osmium::osm_entity_bits::node | osmium::osm_entity_bits::way, [&](osmium::io::Reader& reader) {
+            osmium::apply(reader, location_handler, json_handler);
+        });
+        json_handler.close_output();
+
+        if (json_handler.geometry_error_count()) {
+            std::cerr << "Number of geometry errors (not written to output): " << json_handler.geometry_error_count()
+                      << " (" << json_handler.rejected_geometry_count() << " found before creating the geometry)\n";
+        }
+
+        if (update_dump) {
+            if (way_index) {
+                const auto way_changes = way_change_handler.changes(changes, *old_locations);
+                way_index.reset();
+                std::cerr << "Applying " << way_changes.size() << " way changes to '" << way_index_file << "'...\n";
+                update_way_index(way_index_file, way_changes, changes, replication_sequence, replication_timestamp);
+            }
+            old_locations.reset();
+            std::cerr << "Applying " << changes.size() << " node changes to '" << dump_file << "'...\n";
+            update_location_dump(dump_file, changes, replication_sequence, replication_timestamp, std::max(std::thread::hardware_concurrency(), 1u));
+        }
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << "\n";
+        std::exit(1);
+    }
+
+    std::cerr << "Done.\n";
+}
+
@@ -1,23 +1,22 @@
 
-#include <cerrno>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
-#include <fcntl.h>
-#include <unistd.h>
 #include <cstring>
-#include <fstream>
 #include <getopt.h>
 #include <iostream>
 #include <memory>
-#include <set>
+#include <stdexcept>
 #include <string>
+#include <system_error>
 #include <utility>
+#include <vector>
 
 #include <osmium/geom/tile.hpp>
+#include <osmium/handler.hpp>
 #include <osmium/io/any_input.hpp>
+#include <osmium/memory/buffer.hpp>
 #include <osmium/visitor.hpp>
-#include <osmium/tags/filter.hpp>
-#include <osmium/tags/taglist.hpp>
 
 // these must be include in this order
 #include <osmium/index/map/all.hpp>
@@ -26,261 +25,176 @@
 
 #include "minjur_version.hpp"
 #include "json_feature.hpp"
+#include "external_join.hpp"
 #include "json_handler.hpp"
+#include "json_no_area_handler.hpp"
+#include "location_dump.hpp"
+#include "location_stores.hpp"
+#include "object_filter.hpp"
+#include "parallel_serializer.hpp"
+#include "pbf_index.hpp"
+#include "tile_index.hpp"
+#include "tile_list.hpp"
+#include "way_index.hpp"
 
 using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
 using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
 
-using tileset_type = std::set<osmium::geom::Tile>;
+using tileset_type = TileIndex;
 
+/**
+ * Marks all nodes referenced by ways in the bitmap.
+ */
+class ReferencedNodesHandler : public osmium::handler::Handler {
 
-class JSONNoAreaHandler : public JSONHandler {
+    IdBitmap& m_ids;
 
-    bool m_create_polygons;
-    tileset_type m_tiles;
-    unsigned int m_zoom;
-    osmium::tags::KeyValueFilter m_filter;
+public:
 
-    std::pair<bool, bool> linestring_and_or_polygon(const osmium::Way& way) const {
-        bool output_as_linestring = true;
-        bool output_as_polygon = false;
+    explicit ReferencedNodesHandler(IdBitmap& ids) :
+        m_ids(ids) {
+    }
 
-        if (way.is_closed() && osmium::tags::match_any_of(way.tags(), m_filter)) {
-            output_as_linestring = false;
-            output_as_polygon = true;
+    void way(const osmium::Way& way) {
+        for (const auto& node_ref : way.nodes()) {
+            m_ids.set(node_ref.positive_ref());
         }
-
-        return std::make_pair(output_as_linestring, output_as_polygon);
     }
 
-public:
+}; // class ReferencedNodesHandler
 
-    JSONNoAreaHandler(unsigned int zoom, const std::string& error_file, const std::string& attr_prefix, bool with_id, bool create_polygons, const tileset_type& tiles) :
-        JSONHandler(error_file, attr_prefix, with_id),
-        m_create_polygons(create_polygons),
-        m_tiles(tiles),
-        m_zoom(zoom),
-        m_filter(false) {
-
-        m_filter.add(false, "aeroway", "gate");
-        m_filter.add(false, "aeroway", "taxiway");
-        m_filter.add(true, "aeroway");
-
-        m_filter.add(false, "amenity", "atm");
-        m_filter.add(false, "amenity", "bbq");
-        m_filter.add(false, "amenity", "bench");
-        m_filter.add(false, "amenity", "bureau_de_change");
-        m_filter.add(false, "amenity", "clock");
-        m_filter.add(false, "amenity", "drinking_water");
-        m_filter.add(false, "amenity", "grit_bin");
-        m_filter.add(false, "amenity", "parking_entrance");
-        m_filter.add(false, "amenity", "post_box");
-        m_filter.add(false, "amenity", "telephone");
-        m_filter.add(false, "amenity", "vending_machine");
-        m_filter.add(false, "amenity", "waste_basket");
-        m_filter.add(true, "amenity");
-
-        m_filter.add(false, "area", "no");
-        m_filter.add(true, "area");
-
-        m_filter.add(true, "area:highway");
-
-        m_filter.add(false, "building", "entrance");
-        m_filter.add(false, "building", "no");
-        m_filter.add(true, "building");
-
-        m_filter.add(true, "craft");
-
-        m_filter.add(false, "emergency", "fire_hydrant");
-        m_filter.add(false, "emergency", "phone");
-        m_filter.add(true, "emergency");
-
-        m_filter.add(false, "golf", "hole");
-        m_filter.add(true, "golf");
-
-        m_filter.add(false, "historic", "boundary_stone");
-        m_filter.add(true, "historic");
-
-        m_filter.add(false, "junction", "roundabout");
-        m_filter.add(true, "junction");
-
-        m_filter.add(true, "landuse");
-
-        m_filter.add(false, "leisure", "picnic_table");
-        m_filter.add(false, "leisure", "track");
-        m_filter.add(false, "leisure", "slipway");
-        m_filter.add(true, "leisure");
-
-        m_filter.add(false, "man_made", "cutline");
-        m_filter.add(false, "man_made", "embankment");
-        m_filter.add(false, "man_made", "flagpole");
-        m_filter.add(false, "man_made", "mast");
-        m_filter.add(false, "man_made", "petroleum_well");
-        m_filter.add(false, "man_made", "pipeline");
-        m_filter.add(false, "man_made", "survey_point");
-        m_filter.add(true, "man_made");
-
-        m_filter.add(true, "military");
-
-        m_filter.add(false, "natural", "coastline");
-        m_filter.add(false, "natural", "peak");
-        m_filter.add(false, "natural", "saddle");
-        m_filter.add(false, "natural", "spring");
-        m_filter.add(false, "natural", "tree");
-        m_filter.add(false, "natural", "tree_row");
-        m_filter.add(false, "natural", "volcano");
-        m_filter.add(true, "natural");
-
-        m_filter.add(true, "office");
-
-        m_filter.add(true, "piste:type");
-
-        m_filter.add(true, "place");
-
-        m_filter.add(false, "power", "line");
-        m_filter.add(false, "power", "minor_line");
-        m_filter.add(false, "power", "pole");
-        m_filter.add(false, "power", "tower");
-        m_filter.add(true, "power");
-
-        m_filter.add(false, "public_transport", "stop_position");
-        m_filter.add(true, "public_transport");
-
-        m_filter.add(true, "shop");
-
-        m_filter.add(false, "tourism", "viewpoint");
-        m_filter.add(true, "tourism");
-
-        m_filter.add(false, "waterway", "canal");
-        m_filter.add(false, "waterway", "ditch");
-        m_filter.add(false, "waterway", "drain");
-        m_filter.add(false, "waterway", "river");
-        m_filter.add(false, "waterway", "stream");
-        m_filter.add(false, "waterway", "weir");
-        m_filter.add(true, "waterway");
-    }
-
-    void node(const osmium::Node& node) {
-        if (node.tags().empty()) {
-            return;
-        }
+/**
+ * The input file. If blocks are selected from a block index, only those
+ * blocks are read.
+ */
+class InputFile {
 
-        try {
-            osmium::geom::Tile tile{m_zoom, node.location()};
+    std::string m_filename;
+    PBFBlockIndex m_index;
+    std::vector<pbf_block> m_blocks;
+    bool m_use_blocks;
 
-            if (!m_tiles.empty() && !m_tiles.count(tile)) {
-                return;
-            }
+public:
 
-            JSONFeature feature{attr_names()};
-            if (with_id()) {
-                feature.add_id("n", node.id());
-            }
-            feature.add_point(node);
-            feature.add_properties(node);
-            feature.append_to(buffer());
-        } catch (const osmium::geometry_error&) {
-            report_geometry_problem(node, "geometry_error");
-        } catch (const osmium::invalid_location&) {
-            report_geometry_problem(node, "invalid_location");
-        }
+    explicit InputFile(const std::string& filename) :
+        m_filename(filename),
+        m_index(),
+        m_blocks(),
+        m_use_blocks(false) {
+    }
 
-        maybe_flush();
+    void use_blocks(PBFBlockIndex&& index, std::vector<pbf_block>&& blocks) {
+        m_index = std::move(index);
+        m_blocks = std::move(blocks);
+        m_use_blocks = true;
     }
 
-    void way(const osmium::Way& way) {
-        if (way.nodes().size() <= 1) {
+    /**
+     * Call func with a reader for the objects of the given types. It is
+     * called several times if only some blocks are read.
+     */
+    template <typename TFunc>
+    void read(osmium::osm_entity_bits::type read_types, TFunc&& func) const {
+        if (m_use_blocks) {
+            m_index.read_blocks(m_filename, m_blocks, read_types, std::forward<TFunc>(func));
             return;
         }
-        try {
-            if (!m_tiles.empty()) {
-                bool keep = false;
-                for (auto ref : way.nodes()) {
-                    osmium::geom::Tile tile{m_zoom, ref.location()};
-                    if (m_tiles.count(tile)) {
-                        keep = true;
-                        break;
-                    }
-                }
+        osmium::io::Reader reader{m_filename, read_types};
+        func(reader);
+        reader.close();
+    }
 
-                if (!keep) {
-                    return;
+}; // class InputFile
+
+/**
+ * Add the node locations to the ways with the location handler, add the
+ * ways to the way index if way_index_builder is not nullptr, and create
+ * the GeoJSON, on num_threads threads if it is larger than 1. The header
+ * of the input file is stored in header.
+ */
+template <typename TLocationHandler, typename TFunc>
+void process(const InputFile& input, osmium::io::Header& header, TLocationHandler& location_handler, WayIndexBuilder* way_index_builder, JSONNoAreaHandler& json_handler, std::size_t num_threads, TFunc&& create_handler) {
+    if (num_threads > 1) {
+        ParallelSerializer<JSONNoAreaHandler> serializer{json_handler, num_threads, std::forward<TFunc>(create_handler)};
+        input.read(osmium::osm_entity_bits::all, [&](osmium::io::Reader& reader) {
+            header = reader.header();
+            while (osmium::memory::Buffer buffer = reader.read()) {
+                osmium::apply(buffer, location_handler);
+                if (way_index_builder) {
+                    osmium::apply(buffer, *way_index_builder);
                 }
+                serializer.submit(std::move(buffer));
             }
-
-            std::pair<bool, bool> l_p = { true, false };
-            if (m_create_polygons) {
-                l_p =linestring_and_or_polygon(way);
-            }
-
-            if (l_p.first) { // output as linestring
-                JSONFeature feature{attr_names()};
-                if (with_id()) {
-                    feature.add_id("wl", way.id());
-                }
-                feature.add_linestring(way);
-                feature.add_properties(way);
-                feature.append_to(buffer());
+        });
+        serializer.finish();
+    } else {
+        input.read(osmium::osm_entity_bits::all, [&](osmium::io::Reader& reader) {
+            header = reader.header();
+            if (way_index_builder) {
+                osmium::apply(reader, location_handler, *way_index_builder, json_handler);
+            } else {
+                osmium::apply(reader, location_handler, json_handler);
             }
+        });
+    }
+}
 
-            if (l_p.second) { // output as polygon
-                JSONFeature feature{attr_names()};
-                if (with_id()) {
-                    feature.add_id("wp", way.id());
-                }
-                feature.add_polygon(way);
-                feature.add_properties(way);
-                feature.append_to(buffer());
-            }
-        } catch (const osmium::geometry_error&) {
-            report_geometry_problem(way, "geometry_error");
-        } catch (const osmium::invalid_location&) {
-            report_geometry_problem(way, "invalid_location");
+/**
+ * The blocks minjur needs: all blocks with nodes, because their locations
+ * are needed for the ways, and blocks with ways that can be in the tiles
+ * (all of them if tiles is nullptr). Blocks with only relations are never
+ * needed.
+ */
+std::vector<pbf_block> select_blocks(const PBFBlockIndex& index, const TileIndex* tiles) {
+    std::vector<pbf_block> blocks;
+    for (const auto& block : index.blocks()) {
+        if ((block.types & osmium::osm_entity_bits::node) ||
+            ((block.types & osmium::osm_entity_bits::way) &&
+             (!tiles || !block.box.valid() || tiles->intersects(block.box)))) {
+            blocks.push_back(block);
         }
-        maybe_flush();
     }
 
-}; // class JSONNoAreaHandler
+    return blocks;
+}
 
 /* ================================================== */
 
 void print_help() {
     std::cout << "minjur [OPTIONS] INFILE\n\n"
-              << "Output is always to stdout.\n"
+              << "Output is to stdout unless --output is set.\n"
               << "\nOptions:\n"
               << "  -d, --dump=FILE            Dump location cache to file after run\n"
+              << "  -D, --tmp-dir=DIR          Directory for temporary files (default: $TMPDIR or /tmp)\n"
               << "  -e, --error-file=FILE      Write errors to file\n"
+              << "  -B, --buffer-size=MB       Size of output buffers in MBytes (default: 1)\n"
+              << "  -c, --precision=N          Number of decimal places of coordinates (default: 7)\n"
               << "  -h, --help                 This help message\n"
               << "  -v, --version              Display version\n"
               << "  -i, --with-id              Add unique id to each feature\n"
+              << "  -I, --index=FILE           Skip blocks not needed using block index\n"
               << "  -l, --location-store=TYPE  Set location store\n"
               << "  -L, --list-location-stores Show available location stores\n"
+              << "  -M, --memory=MB            Memory for --external-join and --way-index in MBytes (default: 1024)\n"
               << "  -n, --nodes=sparse|dense   Are node IDs sparse or dense?\n"
+              << "  -x, --external-join        Join node locations on disk instead of using a location store\n"
+              << "  -o, --output=FILE          Write output to FILE, compressed if it ends in .gz\n"
+              << "  -P, --output-prefix=PATH   Write output to shard files starting with PATH\n"
+              << "  -Q, --queue-depth=N        Number of output buffers queued for writing (default: 2)\n"
+              << "  -s, --shards=N             Number of shard files when sharding by id\n"
+              << "  -S, --shard-by=id|type     Put features in shards by id or by type (default: id)\n"
               << "  -p, --polygons             Create polygons from closed ways\n"
-              << "  -t, --tilefile=FILE        File with tiles to filter\n"
+              << "  -A, --area-rules=FILE      Read rules deciding which closed ways are polygons from FILE\n"
+              << "  -t, --tilefile=FILE        File with tiles to filter (text or binary)\n"
+              << "  -T, --threads=N            Number of threads creating GeoJSON (default: 1)\n"
+              << "  -W, --way-index=FILE       Write index from nodes to the ways using them to file\n"
+              << "  -2, --two-pass             Only store locations of nodes used in ways\n"
               << "  -z, --zoom=ZOOM            Zoom level for tiles (default: 15)\n"
-              << "  -a, --attr-prefix=PREFIX   Optional prefix for attributes, defaults to '@'\n";
-}
-
-tileset_type read_tiles_list(const std::string& filename) {
-    tileset_type tiles;
-    if (!filename.empty()) {
-        std::ifstream file{filename};
-        if (! file.is_open()) {
-            std::cerr << "can't open file file\n";
-            std::exit(1);
-        }
-        std::uint32_t z;
-        std::uint32_t x;
-        std::uint32_t y;
-        while (file) {
-            file >> z;
-            file >> x;
-            file >> y;
-            tiles.emplace(z, x, y);
-        }
-    }
-    return tiles;
+              << "  -a, --attr-prefix=PREFIX   Optional prefix for attributes, defaults to '@'\n"
+              << "  -k, --keep-tags=FILE       Only write tags with the keys listed in FILE\n"
+              << "  -K, --drop-tags=FILE       Don't write tags with the keys listed in FILE\n"
+              << "  -m, --attributes=LIST      Attributes to write (default: id,type,version,changeset,uid,user,timestamp)\n"
+              << "  -F, --filter=EXPR          Only write objects with tags matching EXPR, e.g. 'highway=* and not area=yes'\n";
 }
 
 void print_version() {
@@ -292,32 +206,62 @@ int main(int argc, char* argv[]) {
 
     static struct option long_options[] = {
         {"dump",                 required_argument, 0, 'd'},
+        {"tmp-dir",              required_argument, 0, 'D'},
         {"error-file",           required_argument, 0, 'e'},
+        {"buffer-size",          required_argument, 0, 'B'},
+        {"precision",            required_argument, 0, 'c'},
         {"help",                       no_argument, 0, 'h'},
         {"version",                    no_argument, 0, 'v'},
         {"with-id",                    no_argument, 0, 'i'},
+        {"index",                required_argument, 0, 'I'},
         {"location-store",       required_argument, 0, 'l'},
         {"list-location-stores",       no_argument, 0, 'L'},
+        {"memory",               required_argument, 0, 'M'},
         {"nodes",                required_argument, 0, 'n'},
+        {"external-join",              no_argument, 0, 'x'},
+        {"output",               required_argument, 0, 'o'},
+        {"output-prefix",        required_argument, 0, 'P'},
+        {"queue-depth",          required_argument, 0, 'Q'},
+        {"shards",               required_argument, 0, 's'},
+        {"shard-by",             required_argument, 0, 'S'},
         {"polygons",                   no_argument, 0, 'p'},
+        {"area-rules",           required_argument, 0, 'A'},
         {"tilefile",             required_argument, 0, 't'},
+        {"threads",              required_argument, 0, 'T'},
+        {"way-index",            required_argument, 0, 'W'},
+        {"two-pass",                   no_argument, 0, '2'},
         {"zoom",                 required_argument, 0, 'z'},
         {"attr-prefix",          required_argument, 0, 'a'},
+        {"keep-tags",            required_argument, 0, 'k'},
+        {"drop-tags",            required_argument, 0, 'K'},
+        {"attributes",           required_argument, 0, 'm'},
+        {"filter",               required_argument, 0, 'F'},
         {0, 0, 0, 0}
     };
 
     std::string location_store;
     std::string locations_dump_file;
+    std::string way_index_file;
+    std::string index_file;
     std::string error_file;
     std::string tile_file_name;
+    std::string area_rules_file;
+    std::string keep_tags_file;
+    std::string drop_tags_file;
     std::string attr_prefix = "@";
     bool create_polygons = false;
     unsigned int zoom = 15;
     bool nodes_dense = false;
     bool with_id = false;
+    int num_threads = 1;
+    bool two_pass = false;
+    bool external_join = false;
+    int memory_mb = 1024;
+    std::string tmp_dir = std::getenv("TMPDIR") ? std::getenv("TMPDIR") : "/tmp";
+    output_options output;
 
     while (true) {
-        int c = getopt_long(argc, argv, "d:e:hivl:Ln:pt:z:a:", long_options, 0);
+        int c = getopt_long(argc, argv, "d:D:e:B:c:hiI:vl:LM:n:xo:pA:P:Q:s:S:t:T:W:2z:a:k:K:m:F:", long_options, 0);
         if (c == -1) {
             break;
         }
@@ -326,9 +270,30 @@ int main(int argc, char* argv[]) {
             case 'd':
                 locations_dump_file = optarg;
                 break;
+            case 'D':
+                tmp_dir = optarg;
+                break;
             case 'e':
                 error_file = optarg;
                 break;
+            case 'B': {
+                    const int size = std::atoi(optarg);
+                    if (size < 1) {
+                        std::cerr << "Set --buffer-size, -B to a number larger than 0\n";
+                        std::exit(1);
+                    }
+                    output.buffer_size = static_cast<std::size_t>(size) * 1024 * 1024;
+                }
+                break;
+            case 'c': {
+                    const int precision = std::atoi(optarg);
+                    if (precision < 0 || precision > static_cast<int>(max_coordinate_precision)) {
+                        std::cerr << "Set --precision, -c to a number between 0 and " << max_coordinate_precision << "\n";
+                        std::exit(1);
+                    }
+                    output.coordinate_precision = static_cast<unsigned int>(precision);
+                }
+                break;
             case 'h':
                 print_help();
                 std::exit(0);
@@ -338,6 +303,9 @@ int main(int argc, char* argv[]) {
             case 'i':
                 with_id = true;
                 break;
+            case 'I':
+                index_file = optarg;
+                break;
             case 'l':
                 location_store = optarg;
                 break;
@@ -347,6 +315,16 @@ int main(int argc, char* argv[]) {
                     std::cout << "  " << map_type << "\n";
                 }
                 std::exit(0);
+            case 'M':
+                memory_mb = std::atoi(optarg);
+                if (memory_mb < 1) {
+                    std::cerr << "Set --memory, -M to a number larger than 0\n";
+                    std::exit(1);
+                }
+                break;
+            case 'x':
+                external_join = true;
+                break;
             case 'n':
                 if (!std::strcmp(optarg, "sparse")) {
                     nodes_dense = false;
@@ -360,20 +338,105 @@ int main(int argc, char* argv[]) {
             case 'p':
                 create_polygons = true;
                 break;
+            case 'A':
+                area_rules_file = optarg;
+                break;
             case 't':
                 tile_file_name = optarg;
                 break;
-            case 'z':
-                zoom = static_cast<unsigned int>(std::atoi(optarg));
+            case 'o':
+                output.filename = optarg;
+                break;
+            case 'P':
+                output.shard_prefix = optarg;
+                break;
+            case 'Q': {
+                    const int depth = std::atoi(optarg);
+                    if (depth < 1) {
+                        std::cerr << "Set --queue-depth, -Q to a number larger than 0\n";
+                        std::exit(1);
+                    }
+                    output.queue_depth = static_cast<std::size_t>(depth);
+                }
+                break;
+            case 's': {
+                    const int shards = std::atoi(optarg);
+                    if (shards < 1) {
+                        std::cerr << "Set --shards, -s to a number larger than 0\n";
+                        std::exit(1);
+                    }
+                    output.shards = static_cast<std::size_t>(shards);
+                }
+                break;
+            case 'S':
+                if (!std::strcmp(optarg, "id")) {
+                    output.shard_by = shard_type::id;
+                } else if (!std::strcmp(optarg, "type")) {
+                    output.shard_by = shard_type::type;
+                } else {
+                    std::cerr << "Set --shard-by, -S to 'id' or 'type'\n";
+                    std::exit(1);
+                }
+                break;
+            case 'T':
+                num_threads = std::atoi(optarg);
+                if (num_threads < 1) {
+                    std::cerr << "Set --threads, -T to a number larger than 0\n";
+                    std::exit(1);
+                }
+                break;
+            case 'W':
+                way_index_file = optarg;
+                break;
+            case '2':
+                two_pass = true;
+                break;
+            case 'z': {
+                    const int z = std::atoi(optarg);
+                    if (z < 0 || z > static_cast<int>(max_tile_zoom)) {
+                        std::cerr << "Set --zoom, -z to a number between 0 and " << max_tile_zoom << "\n";
+                        std::exit(1);
+                    }
+                    zoom = static_cast<unsigned int>(z);
+                }
                 break;
             case 'a':
                 attr_prefix = optarg;
                 break;
+            case 'k':
+                keep_tags_file = optarg;
+                break;
+            case 'K':
+                drop_tags_file = optarg;
+                break;
+            case 'm':
+                try {
+                    output.properties.attributes = parse_attribute_list(optarg);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << e.what() << " in --attributes, -m\n";
+                    std::exit(1);
+                }
+                break;
+            case 'F':
+                try {
+                    output.filter = ObjectFilter{optarg};
+                } catch (const std::runtime_error& e) {
+                    std::cerr << e.what() << "\n";
+                    std::exit(1);
+                }
+                break;
             default:
                 std::exit(1);
         }
     }
 
+    try {
+        read_tag_keys(output.properties, keep_tags_file, drop_tags_file);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << "\n";
+        std::exit(1);
+    }
+
     if (location_store.empty()) {
         location_store = nodes_dense ? "dense" : "sparse";
 
@@ -384,7 +447,42 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    std::cerr << "Using the '" << location_store << "' location store. Use -l or -n to change this.\n";
+    if (external_join && (two_pass || !locations_dump_file.empty())) {
+        std::cerr << "Can not use --dump, -d or --two-pass, -2 with --external-join, -x\n";
+        std::exit(1);
+    }
+
+    if (two_pass && !locations_dump_file.empty()) {
+        std::cerr << "Can not use --dump, -d with --two-pass, -2, the dump would miss nodes not in ways\n";
+        std::exit(1);
+    }
+
+    if (!index_file.empty() && !way_index_file.empty()) {
+        std::cerr << "Can not use --index, -I with --way-index, -W, the way index needs all ways\n";
+        std::exit(1);
+    }
+
+    output.compression_threads = static_cast<std::size_t>(num_threads);
+
+    if (!output.shard_prefix.empty()) {
+        if (!output.filename.empty()) {
+            std::cerr << "Use either --output, -o or --output-prefix, -P\n";
+            std::exit(1);
+        }
+        if (output.shard_by == shard_type::id && output.shards == 0) {
+            std::cerr << "Set --shards, -s when sharding by id\n";
+            std::exit(1);
+        }
+    } else if (output.shards > 0 || output.shard_by == shard_type::type) {
+        std::cerr << "Set --output-prefix, -P for sharded output\n";
+        std::exit(1);
+    }
+
+    if (external_join) {
+        std::cerr << "Using external join with " << memory_mb << " MBytes of memory and temporary files in '" << tmp_dir << "'.\n";
+    } else {
+        std::cerr << "Using the '" << location_store << "' location store. Use -l or -n to change this.\n";
+    }
 
     std::string input_filename;
     const int remaining_args = argc - optind;
@@ -396,36 +494,159 @@ int main(int argc, char* argv[]) {
         std::exit(1);
     }
 
-    tileset_type tiles{read_tiles_list(tile_file_name)};
+    tileset_type tiles{zoom};
+    if (!tile_file_name.empty()) {
+        std::size_t ignored = 0;
+        try {
+            tiles = read_tile_list(tile_file_name, zoom, ignored);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << "\n";
+            std::exit(1);
+        }
+        if (ignored) {
+            std::cerr << "Ignored " << ignored << " tiles not on zoom level " << zoom << ".\n";
+        }
+    }
+
+    // With a tile file only objects in its tiles are written, even if it
+    // has no tiles on the zoom level.
+    const TileIndex* tile_filter = tile_file_name.empty() ? nullptr : &tiles;
+
+    AreaClassifier areas = default_area_rules();
+    if (!area_rules_file.empty()) {
+        try {
+            areas = read_area_rules(area_rules_file);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << "\n";
+            std::exit(1);
+        }
+    }
+
+    InputFile input{input_filename};
+    if (!index_file.empty()) {
+        try {
+            PBFBlockIndex pbf_index = PBFBlockIndex::read(index_file, input_filename);
+            auto blocks = select_blocks(pbf_index, tile_filter);
+            std::cerr << "Reading " << blocks.size() << " of " << pbf_index.blocks().size() << " blocks.\n";
+            input.use_blocks(std::move(pbf_index), std::move(blocks));
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << "\n";
+            std::exit(1);
+        }
+    }
+
+    std::unique_ptr<index_type> index;
+    if (!external_join) {
+        index = map_factory.create_map(location_store);
+    }
 
-    osmium::io::Reader reader{input_filename};
+    // Ways not matching --filter don't need node locations, unless they
+    // go into the way index.
+    const ObjectFilter no_filter;
+    const ObjectFilter& way_filter = way_index_file.empty() ? output.filter : no_filter;
+
+    IdBitmap referenced_nodes;
+    std::unique_ptr<index_type> filtered_index;
+    std::unique_ptr<ExternalJoin> join;
+    if (external_join) {
+        std::cerr << "First pass: Reading ways...\n";
+        join.reset(new ExternalJoin{static_cast<std::size_t>(memory_mb) * 1024 * 1024, tmp_dir, static_cast<std::size_t>(num_threads)});
+        FilteredWaysHandler<ExternalJoin> filtered_join{*join, way_filter};
+        input.read(osmium::osm_entity_bits::way, [&filtered_join](osmium::io::Reader& way_reader) {
+            osmium::apply(way_reader, filtered_join);
+        });
+        std::cerr << "Sorting node references...\n";
+        join->start_join();
+    } else if (two_pass) {
+        std::cerr << "First pass: Reading ways...\n";
+        ReferencedNodesHandler referenced_nodes_handler{referenced_nodes};
+        FilteredWaysHandler<ReferencedNodesHandler> filtered_handler{referenced_nodes_handler, way_filter};
+        input.read(osmium::osm_entity_bits::way, [&filtered_handler](osmium::io::Reader& way_reader) {
+            osmium::apply(way_reader, filtered_handler);
+        });
+        std::cerr << "Found " << referenced_nodes.size() << " nodes referenced by ways.\n";
+
+        filtered_index.reset(new FilteredLocationStore{*index, referenced_nodes});
+    }
 
-    std::unique_ptr<index_type> index = map_factory.create_map(location_store);
-    location_handler_type location_handler{*index};
-    location_handler.ignore_errors();
+    JSONNoAreaHandler json_handler{zoom, error_file, attr_prefix, with_id, create_polygons, areas, tile_filter, output};
+    try {
+        json_handler.open_output();
+    } catch (const std::system_error& e) {
+        std::cerr << e.what() << "\n";
+        std::exit(1);
+    }
 
-    JSONNoAreaHandler json_handler{zoom, error_file, attr_prefix, with_id, create_polygons, tiles};
+    const auto create_handler = [&]() {
+        return std::unique_ptr<JSONNoAreaHandler>{new JSONNoAreaHandler{zoom, "", attr_prefix, with_id, create_polygons, areas, tile_filter, output}};
+    };
 
-    osmium::apply(reader, location_handler, json_handler);
-    reader.close();
+    // The way index needs the ways ordered by ID, processing stops with an
+    // error if they are not.
+    std::unique_ptr<WayIndexBuilder> way_index_builder;
+    if (!way_index_file.empty()) {
+        try {
+            way_index_builder.reset(new WayIndexBuilder{way_index_file, static_cast<std::size_t>(memory_mb) * 1024 * 1024, tmp_dir, static_cast<std::size_t>(num_threads)});
+        } catch (const std::system_error& e) {
+            std::cerr << e.what() << "\n";
+            std::exit(1);
+        }
+    }
+
+    osmium::io::Header header;
+    try {
+        if (join) {
+            FilteredWaysHandler<ExternalJoin> filtered_join{*join, way_filter};
+            process(input, header, filtered_join, way_index_builder.get(), json_handler, static_cast<std::size_t>(num_threads), create_handler);
+        } else {
+            location_handler_type location_handler{filtered_index ? *filtered_index : *index};
+            location_handler.ignore_errors();
+            FilteredWaysHandler<location_handler_type> filtered_location_handler{location_handler, way_filter};
+            process(input, header, filtered_location_handler, way_index_builder.get(), json_handler, static_cast<std::size_t>(num_threads), create_handler);
+        }
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << "\n";
+        std::exit(1);
+    }
+    try {
+        json_handler.close_output();
+    } catch (const std::system_error& e) {
+        std::cerr << e.what() << "\n";
+        std::exit(1);
+    }
+
+    std::cerr << "Wrote " << json_handler.feature_count() << " features, "
+              << json_handler.feature_allocation_count() << " of them needed memory allocations.\n";
+    std::cerr << "Output stalled waiting for the consumer for " << json_handler.output_stall_time() << " seconds.\n";
 
     if (json_handler.geometry_error_count()) {
-        std::cerr << "Number of geometry errors (not written to output): " << json_handler.geometry_error_count() << "\n";
+        std::cerr << "Number of geometry errors (not written to output): " << json_handler.geometry_error_count()
+                  << " (" << json_handler.rejected_geometry_count() << " found before creating the geometry)\n";
+    }
+
+    std::uint64_t replication_sequence = 0;
+    std::uint64_t replication_timestamp = 0;
+    get_replication_info(header, replication_sequence, replication_timestamp);
+
+    if (way_index_builder) {
+        std::cerr << "Writing way index to '" << way_index_file << "'...\n";
+        try {
+            way_index_builder->finish(replication_sequence, replication_timestamp);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << "\n";
+            std::exit(1);
+        }
     }
 
     if (!locations_dump_file.empty()) {
         std::cerr << "Writing locations store to '" << locations_dump_file << "'...\n";
-        const int locations_fd = open(locations_dump_file.c_str(), O_WRONLY | O_CREAT, 0644);
-        if (locations_fd < 0) {
-            std::cerr << "Can not open file: " << std::strerror(errno) << "\n";
+        try {
+            write_location_dump(locations_dump_file, *index, location_dump_kind_for_store(location_store),
+                                replication_sequence, replication_timestamp, static_cast<std::size_t>(num_threads));
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << "\n";
             std::exit(1);
         }
-        if (location_store.substr(0, 5) == "dense") {
-            index->dump_as_array(locations_fd);
-        } else {
-            index->dump_as_list(locations_fd);
-        }
-        close(locations_fd);
     }
 
     std::cerr << "Done.\n";
@@ -0,0 +1,265 @@
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "object_filter.hpp"
+
+namespace {
+
+    constexpr std::size_t max_tests = 64;
+
+    struct parsed_test {
+        std::string key;
+        std::string value;
+        bool any_value;
+    };
+
+    // Postfix program with the indexes of the tests for test operations
+    // and these for the others.
+    enum parsed_op : int {
+        parsed_not = -1,
+        parsed_and = -2,
+        parsed_or  = -3
+    };
+
+    /**
+     * Recursive descent parser for the filter expressions:
+     *
+     *     or_expr  := and_expr ("or" and_expr)*
+     *     and_expr := not_expr ("and" not_expr)*
+     *     not_expr := "not" not_expr | "(" or_expr ")" | test
+     *     test     := STRING [("=" | "!=") STRING]
+     */
+    class FilterParser {
+
+        const std::string& m_expression;
+        std::size_t m_pos;
+
+    public:
+
+        std::vector<parsed_test> tests;
+        std::vector<int> program;
+
+    private:
+
+        [[noreturn]] void error(const char* message) const {
+            throw std::runtime_error{"Invalid filter expression '" + m_expression + "': " +
+                                     message + " at position " + std::to_string(m_pos + 1)};
+        }
+
+        static bool is_space(char c) noexcept {
+            return std::isspace(static_cast<unsigned char>(c)) != 0;
+        }
+
+        static bool is_special(char c) noexcept {
+            return is_space(c) || c == '(' || c == ')' || c == '"';
+        }
+
+        bool at_end() const noexcept {
+            return m_pos == m_expression.size();
+        }
+
+        void skip_space() noexcept {
+            while (!at_end() && is_space(m_expression[m_pos])) {
+                ++m_pos;
+            }
+        }
+
+        bool accept(char c) noexcept {
+            skip_space();
+            if (!at_end() && m_expression[m_pos] == c) {
+                ++m_pos;
+                return true;
+            }
+            return false;
+        }
+
+        bool accept_keyword(const char* keyword) noexcept {
+            skip_space();
+            const std::size_t length = std::char_traits<char>::length(keyword);
+            if (m_expression.compare(m_pos, length, keyword) != 0) {
+                return false;
+            }
+            const std::size_t end = m_pos + length;
+            if (end < m_expression.size() && !is_special(m_expression[end])) {
+                return false;
+            }
+            m_pos = end;
+            return true;
+        }
+
+        // Read a quoted string or a word ending before whitespace, a
+        // parenthesis, a quote, or, for keys, "=" or "!=".
+        std::string read_string(bool key, bool& quoted) {
+            skip_space();
+            std::string str;
+            quoted = accept('"');
+            if (quoted) {
+                while (!at_end() && m_expression[m_pos] != '"') {
+                    str += m_expression[m_pos++];
+                }
+                if (!accept('"')) {
+                    error("missing closing quote");
+                }
+                return str;
+            }
+            while (!at_end()) {
+                const char c = m_expression[m_pos];
+                if (is_special(c) || (key && (c == '=' || (c == '!' && m_expression.compare(m_pos, 2, "!=") == 0)))) {
+                    break;
+                }
+                str += c;
+                ++m_pos;
+            }
+            return str;
+        }
+
+        int add_test(parsed_test&& test) {
+            for (std::size_t i = 0; i < tests.size(); ++i) {
+                const parsed_test& t = tests[i];
+                if (t.key == test.key && t.any_value == test.any_value && t.value == test.value) {
+                    return static_cast<int>(i);
+                }
+            }
+            if (tests.size() == max_tests) {
+                error("more than 64 different tag tests");
+            }
+            tests.push_back(std::move(test));
+            return static_cast<int>(tests.size() - 1);
+        }
+
+        void parse_test() {
+            bool quoted;
+            parsed_test test{read_string(true, quoted), "", true};
+            if (test.key.empty() && !quoted) {
+                error("expected tag test");
+            }
+
+            bool negated = false;
+            if (accept('=') || (negated = accept('!'))) {
+                if (negated && !accept('=')) {
+                    error("expected '='");
+                }
+                test.value = read_string(false, quoted);
+                test.any_value = !quoted && test.value == "*";
+                if (test.any_value) {
+                    test.value.clear();
+                } else if (test.value.empty() && !quoted) {
+                    error("expected tag value");
+                }
+            }
+
+            program.push_back(add_test(std::move(test)));
+            if (negated) {
+                program.push_back(parsed_not);
+            }
+        }
+
+        void parse_not() {
+            if (accept_keyword("not")) {
+                parse_not();
+                program.push_back(parsed_not);
+            } else if (accept('(')) {
+                parse_or();
+                if (!accept(')')) {
+                    error("expected ')'");
+                }
+            } else {
+                parse_test();
+            }
+        }
+
+        void parse_and() {
+            parse_not();
+            while (accept_keyword("and")) {
+                parse_not();
+                program.push_back(parsed_and);
+            }
+        }
+
+        void parse_or() {
+            parse_and();
+            while (accept_keyword("or")) {
+                parse_and();
+                program.push_back(parsed_or);
+            }
+        }
+
+    public:
+
+        explicit FilterParser(const std::string& expression) :
+            m_expression(expression),
+            m_pos(0) {
+            parse_or();
+            skip_space();
+            if (!at_end()) {
+                error("unexpected input");
+            }
+
+            // The stack of the program is kept in 64 bits.
+            int depth = 0;
+            for (const int op : program) {
+                if (op >= 0) {
+                    ++depth;
+                } else if (op != parsed_not) {
+                    --depth;
+                }
+                if (depth > 64) {
+                    m_pos = 0;
+                    error("nested too deeply");
+                }
+            }
+        }
+
+    }; // class FilterParser
+
+} // anonymous namespace
+
+ObjectFilter::ObjectFilter(const std::string& expression) {
+    FilterParser parser{expression};
+
+    // Sort the tests by the index of their key, the bits in the results
+    // stay in the order of the tests in the expression.
+    std::vector<std::uint32_t> key_indexes;
+    for (const auto& test : parser.tests) {
+        key_indexes.push_back(m_keys.insert(test.key.c_str()));
+    }
+
+    std::vector<std::uint8_t> order;
+    for (std::size_t i = 0; i < parser.tests.size(); ++i) {
+        order.push_back(static_cast<std::uint8_t>(i));
+    }
+    std::stable_sort(order.begin(), order.end(), [&key_indexes](std::uint8_t a, std::uint8_t b) {
+        return key_indexes[a] < key_indexes[b];
+    });
+
+    m_key_tests.assign(m_keys.size() + 1, 0);
+    for (const auto i : order) {
+        m_tests.push_back(tag_test{key_indexes[i], parser.tests[i].value, parser.tests[i].any_value});
+        m_test_bits.push_back(i);
+        ++m_key_tests[key_indexes[i] + 1];
+    }
+    for (std::size_t i = 1; i < m_key_tests.size(); ++i) {
+        m_key_tests[i] += m_key_tests[i - 1];
+    }
+
+    for (const int parsed : parser.program) {
+        switch (parsed) {
+            case parsed_not:
+                m_program.push_back(op{op_type::op_not, 0});
+                break;
+            case parsed_and:
+                m_program.push_back(op{op_type::op_and, 0});
+                break;
+            case parsed_or:
+                m_program.push_back(op{op_type::op_or, 0});
+                break;
+            default:
+                m_program.push_back(op{op_type::test, static_cast<std::uint8_t>(parsed)});
+        }
+    }
+}
+
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <osmium/handler.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/tag.hpp>
+#include <osmium/osm/way.hpp>
+
+#include "key_set.hpp"
+
+/**
+ * Selects objects by their tags with an expression like
+ * "highway=* and not area=yes". The expression is made of tag tests
+ * combined with "and", "or", "not", and parentheses:
+ *
+ *     KEY or KEY=*     the object has a tag with this key
+ *     KEY=VALUE        the object has this tag
+ *     KEY!=VALUE       the object doesn't have this tag
+ *
+ * Keys and values containing spaces or any of ()=!" must be put in double
+ * quotes, so must keys named "and", "or", or "not".
+ *
+ * The expression is compiled into a list of tag tests and a postfix
+ * program. Matching looks up each tag of the object once in a KeySet of
+ * the keys used in the tests, sets a bit for every test it passes, and
+ * then runs the program on those bits. There can be at most 64 different
+ * tag tests.
+ */
+class ObjectFilter {
+
+    struct tag_test {
+        std::uint32_t key_index;
+        std::string value;
+        bool any_value;
+    };
+
+    enum class op_type : std::uint8_t {
+        test,
+        op_not,
+        op_and,
+        op_or
+    };
+
+    struct op {
+        op_type type;
+        std::uint8_t test;
+    };
+
+    KeySet m_keys;
+
+    // The tests sorted by key, the tests for the key with index i are
+    // m_tests[m_key_tests[i]] to m_tests[m_key_tests[i + 1] - 1].
+    std::vector<tag_test> m_tests;
+    std::vector<std::uint32_t> m_key_tests;
+
+    // Bit in the test results for every test in m_tests.
+    std::vector<std::uint8_t> m_test_bits;
+
+    std::vector<op> m_program;
+
+public:
+
+    /**
+     * Create filter matching everything.
+     */
+    ObjectFilter() = default;
+
+    /**
+     * @throws std::runtime_error if the expression is invalid.
+     */
+    explicit ObjectFilter(const std::string& expression);
+
+    bool empty() const noexcept {
+        return m_program.empty();
+    }
+
+    bool match(const osmium::TagList& tags) const noexcept {
+        if (empty()) {
+            return true;
+        }
+
+        std::uint64_t results = 0;
+        for (const auto& tag : tags) {
+            std::uint32_t index;
+            if (!m_keys.find(tag.key(), index)) {
+                continue;
+            }
+            for (std::uint32_t i = m_key_tests[index]; i < m_key_tests[index + 1]; ++i) {
+                const tag_test& test = m_tests[i];
+                if (test.any_value || test.value == tag.value()) {
+                    results |= std::uint64_t(1) << m_test_bits[i];
+                }
+            }
+        }
+
+        // The stack of the program is kept in the bits of an integer,
+        // its depth was checked when compiling.
+        std::uint64_t stack = 0;
+        for (const op& o : m_program) {
+            switch (o.type) {
+                case op_type::test:
+                    stack = (stack << 1) | ((results >> o.test) & 1);
+                    break;
+                case op_type::op_not:
+                    stack ^= 1;
+                    break;
+                case op_type::op_and:
+                    stack = (stack >> 1) & (stack | ~std::uint64_t(1));
+                    break;
+                case op_type::op_or:
+                    stack = (stack >> 1) | (stack & 1);
+                    break;
+            }
+        }
+        return stack & 1;
+    }
+
+}; // class ObjectFilter
+
+/**
+ * Passes all nodes, but only the ways matching the filter, to the
+ * handler. Used to skip looking up the locations of ways that won't be
+ * written anyway. Ways are skipped in the same way on every pass over
+ * the input, so this works with handlers counting ways.
+ */
+template <typename THandler>
+class FilteredWaysHandler : public osmium::handler::Handler {
+
+    THandler& m_handler;
+    const ObjectFilter& m_filter;
+
+public:
+
+    FilteredWaysHandler(THandler& handler, const ObjectFilter& filter) :
+        m_handler(handler),
+        m_filter(filter) {
+    }
+
+    void node(const osmium::Node& node) {
+        m_handler.node(node);
+    }
+
+    void way(osmium::Way& way) {
+        if (m_filter.match(way.tags())) {
+            m_handler.way(way);
+        }
+    }
+
+}; // class FilteredWaysHandler
+
@@ -0,0 +1,231 @@
+
+#include <cerrno>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+#include <zlib.h>
+
+#include "output_writer.hpp"
+
+namespace {
+
+    int write_all(int fd, const char* data, std::size_t size) {
+        while (size > 0) {
+            const auto written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno;
+            }
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+        return 0;
+    }
+
+} // anonymous namespace
+
+void gzip_compress(const std::string& data, std::string& out) {
+    if (data.size() > std::numeric_limits<uInt>::max()) {
+        throw std::length_error{"Output buffer too large for compression"};
+    }
+
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+
+    // 15 bits window size, +16 for gzip header and trailer
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error{"Can not initialize compression"};
+    }
+
+    out.resize(deflateBound(&stream, static_cast<uLong>(data.size())));
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    stream.avail_out = static_cast<uInt>(out.size());
+
+    const int result = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    if (result != Z_STREAM_END) {
+        throw std::runtime_error{"Compression of output failed"};
+    }
+}
+
+OutputWriter::OutputWriter(int fd, std::size_t queue_depth, std::size_t compression_threads) :
+    m_fd(fd),
+    m_compress(compression_threads > 0),
+    m_slots(queue_depth > 0 ? queue_depth : 1),
+    m_first(0),
+    m_count(0),
+    m_mutex(),
+    m_slot_filled(),
+    m_slot_ready(),
+    m_slot_freed(),
+    m_stall_time(),
+    m_exception(),
+    m_done(false),
+    m_compression_threads(),
+    m_thread(&OutputWriter::run, this) {
+    for (std::size_t i = 0; i < compression_threads; ++i) {
+        m_compression_threads.emplace_back(&OutputWriter::run_compression, this);
+    }
+}
+
+OutputWriter::~OutputWriter() {
+    stop();
+}
+
+// Must be called with the lock held.
+OutputWriter::slot* OutputWriter::next_to_compress() {
+    for (std::size_t i = 0; i < m_count; ++i) {
+        slot& s = m_slots[(m_first + i) % m_slots.size()];
+        if (s.state == slot_state::filled) {
+            return &s;
+        }
+    }
+    return nullptr;
+}
+
+void OutputWriter::run_compression() {
+    std::unique_lock<std::mutex> lock{m_mutex};
+    while (true) {
+        slot* s = nullptr;
+        m_slot_filled.wait(lock, [this, &s] {
+            s = next_to_compress();
+            return s || m_done;
+        });
+        if (!s) {
+            return;
+        }
+
+        s->state = slot_state::compressing;
+        lock.unlock();
+        std::exception_ptr exception;
+        try {
+            gzip_compress(s->data, s->compressed);
+        } catch (...) {
+            exception = std::current_exception();
+        }
+        lock.lock();
+        if (exception) {
+            // The writer thread stops when it gets to this slot, so
+            // nothing after the last complete member is written.
+            if (!m_exception) {
+                m_exception = exception;
+            }
+            s->state = slot_state::failed;
+        } else {
+            s->state = slot_state::ready;
+        }
+        m_slot_ready.notify_one();
+    }
+}
+
+void OutputWriter::run() {
+    std::unique_lock<std::mutex> lock{m_mutex};
+    while (true) {
+        m_slot_ready.wait(lock, [this] {
+            return (m_done && m_count == 0) ||
+                   (m_count > 0 && (m_slots[m_first].state == slot_state::ready ||
+                                    m_slots[m_first].state == slot_state::failed));
+        });
+        if (m_count == 0) {
+            return;
+        }
+        if (m_slots[m_first].state == slot_state::failed) {
+            // m_exception is set already, wake up a waiting submit().
+            m_slot_freed.notify_all();
+            return;
+        }
+
+        // The slot stays counted as filled while it is written, so
+        // submit() will not touch it.
+        slot& s = m_slots[m_first];
+        const std::string& data = m_compress ? s.compressed : s.data;
+        lock.unlock();
+        const int error = write_all(m_fd, data.data(), data.size());
+        s.data.clear();
+        s.compressed.clear();
+        lock.lock();
+
+        s.state = slot_state::empty;
+        m_first = (m_first + 1) % m_slots.size();
+        --m_count;
+        if (error && !m_exception) {
+            m_exception = std::make_exception_ptr(std::system_error{error, std::system_category(), "Error writing output"});
+        }
+        m_slot_freed.notify_one();
+        if (error) {
+            return;
+        }
+    }
+}
+
+void OutputWriter::check_error() const {
+    if (m_exception) {
+        std::rethrow_exception(m_exception);
+    }
+}
+
+void OutputWriter::submit(std::string& data) {
+    std::unique_lock<std::mutex> lock{m_mutex};
+    check_error();
+
+    if (m_count == m_slots.size()) {
+        const auto start = std::chrono::steady_clock::now();
+        m_slot_freed.wait(lock, [this] {
+            return m_exception || m_count < m_slots.size();
+        });
+        m_stall_time += std::chrono::steady_clock::now() - start;
+        check_error();
+    }
+
+    slot& s = m_slots[(m_first + m_count) % m_slots.size()];
+    using std::swap;
+    swap(data, s.data);
+    ++m_count;
+
+    if (m_compress) {
+        s.state = slot_state::filled;
+        m_slot_filled.notify_one();
+    } else {
+        s.state = slot_state::ready;
+        m_slot_ready.notify_one();
+    }
+}
+
+void OutputWriter::stop() {
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_done = true;
+    }
+    m_slot_filled.notify_all();
+    m_slot_ready.notify_one();
+    for (auto& thread : m_compression_threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void OutputWriter::close() {
+    stop();
+    check_error();
+}
+
+double OutputWriter::stall_time() const {
+    return std::chrono::duration<double>(m_stall_time).count();
+}
+
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "object_filter.hpp"
+#include "property_options.hpp"
+
+enum class shard_type {
+    id,
+    type
+};
+
+/**
+ * Options for the output of the JSON handlers.
+ */
+struct output_options {
+
+    /// Output file name, stdout if empty. Compressed if it ends in ".gz".
+    std::string filename;
+
+    /// If set, output goes to several files starting with this prefix.
+    std::string shard_prefix;
+
+    /// Choose shard by (hashed) object ID or by feature type.
+    shard_type shard_by = shard_type::id;
+
+    /// Number of shards when sharding by ID.
+    std::size_t shards = 0;
+
+    /// Buffered output is written out when it grows larger than this.
+    std::size_t buffer_size = 1024 * 1024;
+
+    /// Number of full buffers that can wait for the writer thread.
+    std::size_t queue_depth = 2;
+
+    /// Number of threads compressing the output.
+    std::size_t compression_threads = 1;
+
+    /// Number of decimal places of coordinates (0 to 7).
+    unsigned int coordinate_precision = 7;
+
+    /// Attributes and tags written into the feature properties.
+    property_options properties;
+
+    /// Only objects with tags matching this filter are written.
+    ObjectFilter filter;
+
+    std::size_t num_shards() const noexcept {
+        if (shard_prefix.empty()) {
+            return 1;
+        }
+        // one shard for each of n, w, wl, wp, and a
+        return shard_by == shard_type::type ? 5 : shards;
+    }
+
+}; // struct output_options
+
+/**
+ * Compress data into a complete gzip member (with header and trailer)
+ * in out. Concatenated members form a valid gzip file.
+ */
+void gzip_compress(const std::string& data, std::string& out);
+
+/**
+ * Writes buffers to a file descriptor on a separate thread, so the
+ * caller can go on creating output while earlier buffers are written.
+ *
+ * The buffers are kept in a ring of queue_depth slots. Submitting a buffer
+ * swaps it with the string in a free slot, so the memory of written
+ * buffers is reused. If all slots are full, submit() blocks until the
+ * writer thread catches up. The time spent waiting is available as
+ * stall_time().
+ *
+ * If compression_threads is not zero, each buffer is compressed into a
+ * separate gzip member by one of that many compression threads before
+ * being written. Buffers are always written in the order they were
+ * submitted.
+ */
+class OutputWriter {
+
+    enum class slot_state {
+        empty,
+        filled,
+        compressing,
+        ready,
+        failed
+    };
+
+    struct slot {
+        std::string data;
+        std::string compressed;
+        slot_state state = slot_state::empty;
+    };
+
+    int m_fd;
+    bool m_compress;
+    std::vector<slot> m_slots;
+    std::size_t m_first;
+    std::size_t m_count;
+    std::mutex m_mutex;
+    std::condition_variable m_slot_filled;
+    std::condition_variable m_slot_ready;
+    std::condition_variable m_slot_freed;
+    std::chrono::steady_clock::duration m_stall_time;
+    std::exception_ptr m_exception;
+    bool m_done;
+    std::vector<std::thread> m_compression_threads;
+    std::thread m_thread;
+
+    slot* next_to_compress();
+
+    void run_compression();
+
+    void run();
+
+    void check_error() const;
+
+    void stop();
+
+public:
+
+    OutputWriter(int fd, std::size_t queue_depth, std::size_t compression_threads = 0);
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    ~OutputWriter();
+
+    /**
+     * Queue the contents of data for writing. Afterwards data is empty,
+     * but will usually have some capacity from an earlier buffer.
+     *
+     * @throws std::system_error if writing an earlier buffer failed.
+     */
+    void submit(std::string& data);
+
+    /**
+     * Write everything still queued and stop the writer thread.
+     *
+     * @throws std::system_error if writing failed.
+     */
+    void close();
+
+    /**
+     * Time in seconds submit() had to wait for a free slot.
+     */
+    double stall_time() const;
+
+}; // class OutputWriter
+
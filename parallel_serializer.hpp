@@ -0,0 +1,195 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/visitor.hpp>
+
+#include "json_handler.hpp"
+
+/**
+ * Creates the GeoJSON for whole osmium buffers on a pool of worker threads.
+ * Every worker has its own handler collecting the output in memory (the
+ * worker handlers must not have their output opened). The
+ * outputs are handed to the main handler in the order the buffers were
+ * submitted, so the result is the same as when running single-threaded.
+ *
+ * Everything needed to create the geometries (ie. the node locations on
+ * the ways) must be in the buffers when they are submitted.
+ */
+template <typename THandler>
+class ParallelSerializer {
+
+    using work_type = std::pair<std::uint64_t, osmium::memory::Buffer>;
+
+    THandler& m_main_handler;
+    std::vector<std::unique_ptr<THandler>> m_handlers;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_work_available;
+    std::condition_variable m_work_done;
+
+    std::deque<work_type> m_work;
+    std::map<std::uint64_t, handler_output> m_done;
+    std::exception_ptr m_exception;
+    std::uint64_t m_submitted;
+    std::uint64_t m_written;
+    std::size_t m_max_in_flight;
+    bool m_shutdown;
+
+    void run_worker(THandler& handler) {
+        while (true) {
+            work_type work;
+            {
+                std::unique_lock<std::mutex> lock{m_mutex};
+                m_work_available.wait(lock, [this] {
+                    return m_shutdown || !m_work.empty();
+                });
+                if (m_work.empty()) {
+                    return;
+                }
+                work = std::move(m_work.front());
+                m_work.pop_front();
+            }
+
+            handler_output output;
+            std::exception_ptr exception;
+            try {
+                osmium::apply(work.second, handler);
+                handler.take_output(output);
+            } catch (...) {
+                exception = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock{m_mutex};
+                if (exception && !m_exception) {
+                    m_exception = exception;
+                }
+                m_done.emplace(work.first, std::move(output));
+            }
+            m_work_done.notify_one();
+        }
+    }
+
+    // Hand all outputs that are next in line to the main handler. Must be
+    // called with the lock held, it is released while writing.
+    void write_done(std::unique_lock<std::mutex>& lock) {
+        while (true) {
+            if (m_exception) {
+                std::rethrow_exception(m_exception);
+            }
+            const auto it = m_done.find(m_written);
+            if (it == m_done.end()) {
+                return;
+            }
+            const handler_output output{std::move(it->second)};
+            m_done.erase(it);
+            ++m_written;
+
+            lock.unlock();
+            m_main_handler.add_output(output);
+            lock.lock();
+        }
+    }
+
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            m_shutdown = true;
+        }
+        m_work_available.notify_all();
+        for (auto& thread : m_threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+
+public:
+
+    /**
+     * Start num_threads workers. The handler for each worker is created
+     * by calling create_handler() which must return a
+     * std::unique_ptr<THandler>.
+     */
+    template <typename TFunc>
+    ParallelSerializer(THandler& main_handler, std::size_t num_threads, TFunc&& create_handler) :
+        m_main_handler(main_handler),
+        m_handlers(),
+        m_threads(),
+        m_mutex(),
+        m_work_available(),
+        m_work_done(),
+        m_work(),
+        m_done(),
+        m_exception(),
+        m_submitted(0),
+        m_written(0),
+        m_max_in_flight(num_threads * 2),
+        m_shutdown(false) {
+        for (std::size_t i = 0; i < num_threads; ++i) {
+            m_handlers.push_back(create_handler());
+        }
+        for (auto& handler : m_handlers) {
+            m_threads.emplace_back(&ParallelSerializer::run_worker, this, std::ref(*handler));
+        }
+    }
+
+    ParallelSerializer(const ParallelSerializer&) = delete;
+    ParallelSerializer& operator=(const ParallelSerializer&) = delete;
+
+    ~ParallelSerializer() {
+        shutdown();
+    }
+
+    /**
+     * Queue a buffer for serialization. Blocks while too many buffers are
+     * in flight, writing finished output in the meantime.
+     */
+    void submit(osmium::memory::Buffer&& buffer) {
+        std::unique_lock<std::mutex> lock{m_mutex};
+        m_work.emplace_back(m_submitted++, std::move(buffer));
+        m_work_available.notify_one();
+
+        while (true) {
+            write_done(lock);
+            if (m_submitted - m_written < m_max_in_flight) {
+                return;
+            }
+            m_work_done.wait(lock);
+        }
+    }
+
+    /**
+     * Wait for all submitted buffers to be serialized and written and stop
+     * the workers.
+     */
+    void finish() {
+        {
+            std::unique_lock<std::mutex> lock{m_mutex};
+            while (true) {
+                write_done(lock);
+                if (m_written == m_submitted) {
+                    break;
+                }
+                m_work_done.wait(lock);
+            }
+        }
+        shutdown();
+    }
+
+}; // class ParallelSerializer
+
@@ -0,0 +1,433 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+#include <osmium/handler.hpp>
+#include <osmium/index/index.hpp>
+#include <osmium/osm.hpp>
+#include <osmium/visitor.hpp>
+
+#include "pbf_index.hpp"
+
+namespace {
+
+    const char pbf_index_magic[8] = {'M', 'J', 'P', 'B', 'F', 'I', 'D', 'X'};
+    const std::uint32_t pbf_index_version = 1;
+    const std::uint64_t pbf_index_header_size = 64;
+
+    // The PBF format limits blob headers to 64 kB and blobs to 32 MB.
+    const std::uint32_t max_blob_header_size = 64 * 1024;
+    const std::uint64_t max_blob_size = 32 * 1024 * 1024;
+
+    struct pbf_index_header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t reserved;
+        std::uint64_t file_size;
+        std::int64_t file_mtime;
+        std::uint64_t num_blocks;
+        std::uint64_t header_offset;
+        std::uint64_t header_size;
+    };
+
+    static_assert(sizeof(pbf_index_header) == 56, "unexpected PBF index header size");
+    static_assert(sizeof(pbf_block) == 56, "unexpected size of pbf_block");
+
+    class file_descriptor {
+
+        int m_fd;
+
+    public:
+
+        explicit file_descriptor(const std::string& filename, int flags = O_RDONLY) :
+            m_fd(::open(filename.c_str(), flags, 0644)) {
+            if (m_fd < 0) {
+                throw std::system_error{errno, std::system_category(), "Can not open '" + filename + "'"};
+            }
+        }
+
+        file_descriptor(const file_descriptor&) = delete;
+        file_descriptor& operator=(const file_descriptor&) = delete;
+
+        ~file_descriptor() {
+            ::close(m_fd);
+        }
+
+        int get() const noexcept {
+            return m_fd;
+        }
+
+    }; // class file_descriptor
+
+    void pread_all(int fd, void* buffer, std::size_t size, std::uint64_t offset) {
+        char* data = static_cast<char*>(buffer);
+        while (size > 0) {
+            const auto length = ::pread(fd, data, size, static_cast<off_t>(offset));
+            if (length <= 0) {
+                if (length < 0 && errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error{length < 0 ? errno : EIO, std::system_category(), "Error reading PBF file"};
+            }
+            data += length;
+            size -= static_cast<std::size_t>(length);
+            offset += static_cast<std::uint64_t>(length);
+        }
+    }
+
+    void write_all(int fd, const void* buffer, std::size_t size) {
+        const char* data = static_cast<const char*>(buffer);
+        while (size > 0) {
+            const auto written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error{errno, std::system_category(), "Error writing PBF index"};
+            }
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+    }
+
+    bool read_varint(const char*& data, const char* end, std::uint64_t& value) noexcept {
+        value = 0;
+        for (unsigned int shift = 0; data != end && shift < 64; shift += 7) {
+            const auto byte = static_cast<unsigned char>(*data++);
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Get the type and data size from a BlobHeader message. Only field 1
+    // (type, string) and field 3 (datasize, int32) are needed, everything
+    // else is skipped.
+    bool parse_blob_header(const std::string& message, std::string& type, std::uint64_t& datasize) {
+        const char* data = message.data();
+        const char* const end = data + message.size();
+        bool has_type = false;
+        bool has_datasize = false;
+
+        while (data != end) {
+            std::uint64_t key;
+            if (!read_varint(data, end, key)) {
+                return false;
+            }
+            std::uint64_t value;
+            switch (key & 0x7) {
+                case 0: // varint
+                    if (!read_varint(data, end, value)) {
+                        return false;
+                    }
+                    if (key >> 3 == 3) {
+                        datasize = value;
+                        has_datasize = true;
+                    }
+                    break;
+                case 2: // length delimited
+                    if (!read_varint(data, end, value) || value > static_cast<std::uint64_t>(end - data)) {
+                        return false;
+                    }
+                    if (key >> 3 == 1) {
+                        type.assign(data, static_cast<std::size_t>(value));
+                        has_type = true;
+                    }
+                    data += value;
+                    break;
+                default:
+                    return false;
+            }
+        }
+
+        return has_type && has_datasize;
+    }
+
+    /**
+     * Collects types, ID range and bounding box of the objects in a block.
+     * The bounding box is only known if all objects have locations, so not
+     * for blocks with relations or with ways if there are no locations.
+     */
+    class BlockStatsHandler : public osmium::handler::Handler {
+
+        pbf_block& m_block;
+        const osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>* m_locations;
+        bool m_box_known;
+
+        void add(const osmium::OSMObject& object, osmium::osm_entity_bits::type type) {
+            m_block.types |= type;
+            m_block.min_id = std::min(m_block.min_id, object.id());
+            m_block.max_id = std::max(m_block.max_id, object.id());
+        }
+
+    public:
+
+        BlockStatsHandler(pbf_block& block, const osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>* locations) :
+            m_block(block),
+            m_locations(locations),
+            m_box_known(true) {
+            m_block.types = osmium::osm_entity_bits::nothing;
+            m_block.min_id = std::numeric_limits<osmium::object_id_type>::max();
+            m_block.max_id = std::numeric_limits<osmium::object_id_type>::min();
+            m_block.box = osmium::Box{};
+        }
+
+        void node(const osmium::Node& node) {
+            add(node, osmium::osm_entity_bits::node);
+            m_block.box.extend(node.location());
+        }
+
+        void way(const osmium::Way& way) {
+            add(way, osmium::osm_entity_bits::way);
+            if (!m_locations) {
+                m_box_known = false;
+                return;
+            }
+            for (const auto& node_ref : way.nodes()) {
+                try {
+                    m_block.box.extend(m_locations->get(node_ref.positive_ref()));
+                } catch (const osmium::not_found&) {
+                }
+            }
+        }
+
+        void relation(const osmium::Relation& relation) {
+            add(relation, osmium::osm_entity_bits::relation);
+            m_box_known = false;
+        }
+
+        /**
+         * Call after all objects of the block were seen.
+         */
+        void finish() {
+            if (!m_box_known) {
+                m_block.box = osmium::Box{};
+            }
+        }
+
+    }; // class BlockStatsHandler
+
+    bool file_stat(const std::string& filename, std::uint64_t& size, std::int64_t& mtime) {
+        struct stat st;
+        if (::stat(filename.c_str(), &st) != 0) {
+            return false;
+        }
+        size = static_cast<std::uint64_t>(st.st_size);
+        mtime = static_cast<std::int64_t>(st.st_mtime);
+        return true;
+    }
+
+} // anonymous namespace
+
+std::string PBFBlockIndex::read_data(const std::string& filename, const std::vector<pbf_block>& blocks, std::size_t begin, std::size_t end) const {
+    const file_descriptor fd{filename};
+
+    std::uint64_t size = m_header_size;
+    for (std::size_t i = begin; i < end; ++i) {
+        size += blocks[i].size;
+    }
+
+    std::string data(static_cast<std::size_t>(size), '\0');
+    char* out = &data[0];
+    pread_all(fd.get(), out, static_cast<std::size_t>(m_header_size), m_header_offset);
+    out += m_header_size;
+    for (std::size_t i = begin; i < end; ++i) {
+        pread_all(fd.get(), out, static_cast<std::size_t>(blocks[i].size), blocks[i].offset);
+        out += blocks[i].size;
+    }
+
+    return data;
+}
+
+PBFBlockIndex PBFBlockIndex::build(const std::string& filename,
+                                   const osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>* locations,
+                                   std::size_t num_threads) {
+    PBFBlockIndex index;
+    if (!file_stat(filename, index.m_file_size, index.m_file_mtime)) {
+        throw std::runtime_error{"Can not read '" + filename + "': " + std::strerror(errno)};
+    }
+
+    // Find the blocks by reading the blob headers.
+    {
+        const file_descriptor fd{filename};
+        std::uint64_t offset = 0;
+        while (offset < index.m_file_size) {
+            if (index.m_file_size - offset < 4) {
+                throw std::runtime_error{"'" + filename + "' is not a valid PBF file"};
+            }
+            unsigned char length_bytes[4];
+            pread_all(fd.get(), length_bytes, sizeof(length_bytes), offset);
+            const std::uint32_t length = (std::uint32_t(length_bytes[0]) << 24) | (std::uint32_t(length_bytes[1]) << 16) |
+                                         (std::uint32_t(length_bytes[2]) << 8) | std::uint32_t(length_bytes[3]);
+            if (length > max_blob_header_size || index.m_file_size - offset - 4 < length) {
+                throw std::runtime_error{"'" + filename + "' is not a valid PBF file"};
+            }
+
+            std::string message(length, '\0');
+            pread_all(fd.get(), &message[0], length, offset + 4);
+            std::string type;
+            std::uint64_t datasize = 0;
+            if (!parse_blob_header(message, type, datasize) || datasize > max_blob_size ||
+                index.m_file_size - offset - 4 - length < datasize) {
+                throw std::runtime_error{"'" + filename + "' is not a valid PBF file"};
+            }
+
+            const std::uint64_t size = 4 + length + datasize;
+            if (type == "OSMHeader") {
+                index.m_header_offset = offset;
+                index.m_header_size = size;
+            } else if (type == "OSMData") {
+                index.m_blocks.push_back(pbf_block{offset, size, 0, 0, 0, 0, osmium::Box{}});
+            }
+            offset += size;
+        }
+
+        if (index.m_header_size == 0) {
+            throw std::runtime_error{"'" + filename + "' is not a valid PBF file (no header block)"};
+        }
+    }
+
+    // Read the contents of every block. Each block is decoded separately
+    // so that the objects can be attributed to it.
+    std::atomic<std::size_t> next_block{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < std::max(num_threads, std::size_t(1)); ++t) {
+        threads.emplace_back([&]() {
+            try {
+                for (std::size_t i = next_block++; i < index.m_blocks.size(); i = next_block++) {
+                    const std::vector<pbf_block> block{index.m_blocks[i]};
+                    index.read_blocks(filename, block, osmium::osm_entity_bits::nwr, [&](osmium::io::Reader& reader) {
+                        BlockStatsHandler handler{index.m_blocks[i], locations};
+                        osmium::apply(reader, handler);
+                        handler.finish();
+                    });
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock{error_mutex};
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next_block = index.m_blocks.size();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    return index;
+}
+
+PBFBlockIndex PBFBlockIndex::read(const std::string& index_filename) {
+    const int fd = ::open(index_filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error{"Can not open PBF index '" + index_filename + "': " + std::strerror(errno)};
+    }
+
+    PBFBlockIndex index;
+    try {
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            throw std::runtime_error{"Can not read PBF index '" + index_filename + "': " + std::strerror(errno)};
+        }
+        const auto size = static_cast<std::uint64_t>(st.st_size);
+
+        pbf_index_header header;
+        if (size < pbf_index_header_size) {
+            throw std::runtime_error{"PBF index '" + index_filename + "' is corrupt or incomplete"};
+        }
+        pread_all(fd, &header, sizeof(header), 0);
+        if (std::memcmp(header.magic, pbf_index_magic, sizeof(header.magic)) != 0 ||
+            header.version != pbf_index_version ||
+            size != pbf_index_header_size + header.num_blocks * sizeof(pbf_block)) {
+            throw std::runtime_error{"PBF index '" + index_filename + "' is corrupt or incomplete"};
+        }
+
+        index.m_file_size = header.file_size;
+        index.m_file_mtime = header.file_mtime;
+        index.m_header_offset = header.header_offset;
+        index.m_header_size = header.header_size;
+        index.m_blocks.resize(static_cast<std::size_t>(header.num_blocks));
+        pread_all(fd, index.m_blocks.data(), index.m_blocks.size() * sizeof(pbf_block), pbf_index_header_size);
+    } catch (const std::system_error& e) {
+        ::close(fd);
+        throw std::runtime_error{"Can not read PBF index '" + index_filename + "': " + e.what()};
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+
+    return index;
+}
+
+PBFBlockIndex PBFBlockIndex::read(const std::string& index_filename, const std::string& filename) {
+    PBFBlockIndex index = read(index_filename);
+    if (!index.matches(filename)) {
+        throw std::runtime_error{"PBF index '" + index_filename + "' doesn't match '" + filename + "', create it again with minjur-index"};
+    }
+    return index;
+}
+
+void PBFBlockIndex::write(const std::string& index_filename) const {
+    const std::string tmp_filename = index_filename + ".tmp";
+    {
+        const file_descriptor fd{tmp_filename, O_WRONLY | O_CREAT | O_TRUNC};
+        try {
+            char header_data[pbf_index_header_size];
+            std::memset(header_data, 0, sizeof(header_data));
+
+            pbf_index_header header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, pbf_index_magic, sizeof(header.magic));
+            header.version = pbf_index_version;
+            header.file_size = m_file_size;
+            header.file_mtime = m_file_mtime;
+            header.num_blocks = m_blocks.size();
+            header.header_offset = m_header_offset;
+            header.header_size = m_header_size;
+            std::memcpy(header_data, &header, sizeof(header));
+
+            write_all(fd.get(), header_data, sizeof(header_data));
+            write_all(fd.get(), m_blocks.data(), m_blocks.size() * sizeof(pbf_block));
+            if (::fsync(fd.get()) != 0) {
+                throw std::system_error{errno, std::system_category(), "Error writing PBF index"};
+            }
+        } catch (...) {
+            ::unlink(tmp_filename.c_str());
+            throw;
+        }
+    }
+
+    if (std::rename(tmp_filename.c_str(), index_filename.c_str()) != 0) {
+        const int error = errno;
+        ::unlink(tmp_filename.c_str());
+        throw std::system_error{error, std::system_category(), "Can not rename PBF index to '" + index_filename + "'"};
+    }
+}
+
+bool PBFBlockIndex::matches(const std::string& filename) const {
+    std::uint64_t size;
+    std::int64_t mtime;
+    return file_stat(filename, size, mtime) && size == m_file_size && mtime == m_file_mtime;
+}
+
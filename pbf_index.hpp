@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <osmium/index/map.hpp>
+#include <osmium/io/any_input.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/types.hpp>
+
+/**
+ * Description of one data block of a PBF file.
+ */
+struct pbf_block {
+
+    /// Offset of the block (the length of its blob header) in the file.
+    std::uint64_t offset;
+
+    /// Size of the block including its blob header.
+    std::uint64_t size;
+
+    /// Types of the objects in the block (osmium::osm_entity_bits).
+    std::uint32_t types;
+
+    std::uint32_t reserved;
+
+    /// Smallest and largest ID of the objects in the block.
+    osmium::object_id_type min_id;
+    osmium::object_id_type max_id;
+
+    /// Bounding box of the objects in the block. Invalid if unknown, which
+    /// it is for blocks with relations, or with ways if the index was
+    /// built without node locations.
+    osmium::Box box;
+
+}; // struct pbf_block
+
+/**
+ * Index of the data blocks of a PBF file. It is kept in a sidecar file
+ * (by default the name of the PBF file with ".idx" appended) so that
+ * programs can read only the blocks they need.
+ *
+ * The index file starts with a 64 byte header (only the first 56 bytes
+ * are used, the rest is zero). All numbers are in native byte order:
+ *
+ *     magic "MJPBFIDX"          8 bytes
+ *     format version (1)        32 bit
+ *     reserved                  32 bit
+ *     size of the PBF file      64 bit
+ *     mtime of the PBF file     64 bit, seconds since epoch
+ *     number of blocks          64 bit
+ *     offset of header block    64 bit
+ *     size of header block      64 bit
+ *
+ * It is followed by a pbf_block struct (56 bytes) for each data block in
+ * the order of the blocks in the PBF file.
+ */
+class PBFBlockIndex {
+
+    std::uint64_t m_file_size;
+    std::int64_t m_file_mtime;
+    std::uint64_t m_header_offset;
+    std::uint64_t m_header_size;
+    std::vector<pbf_block> m_blocks;
+
+    std::string read_data(const std::string& filename, const std::vector<pbf_block>& blocks, std::size_t begin, std::size_t end) const;
+
+public:
+
+    PBFBlockIndex() :
+        m_file_size(0),
+        m_file_mtime(0),
+        m_header_offset(0),
+        m_header_size(0),
+        m_blocks() {
+    }
+
+    /**
+     * Build the index by reading every block of the PBF file, on
+     * num_threads threads. If locations is not nullptr, the bounding
+     * boxes of blocks with ways are calculated from the locations of the
+     * way nodes. Their get() must work from several threads at the same
+     * time.
+     *
+     * @throws std::runtime_error if the file can't be read or is not a
+     *         PBF file.
+     */
+    static PBFBlockIndex build(const std::string& filename,
+                               const osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>* locations,
+                               std::size_t num_threads);
+
+    /**
+     * @throws std::runtime_error if the index file can't be read or is
+     *         invalid.
+     */
+    static PBFBlockIndex read(const std::string& index_filename);
+
+    /**
+     * Read the index and check that it belongs to the current version of
+     * the PBF file.
+     *
+     * @throws std::runtime_error if the index file can't be read, is
+     *         invalid, or doesn't match the PBF file.
+     */
+    static PBFBlockIndex read(const std::string& index_filename, const std::string& filename);
+
+    /**
+     * @throws std::system_error if the index file can't be written.
+     */
+    void write(const std::string& index_filename) const;
+
+    /**
+     * Does the index belong to the current version of the PBF file?
+     * Compares the size and modification time of the file.
+     */
+    bool matches(const std::string& filename) const;
+
+    const std::vector<pbf_block>& blocks() const noexcept {
+        return m_blocks;
+    }
+
+    /**
+     * Read the given blocks (from this index, in file order) from the PBF
+     * file in batches of about batch_size bytes. For each batch func is
+     * called with a reader for a PBF file in memory containing the header
+     * block and the blocks of the batch. If there are no blocks, func is
+     * called once with a reader for a file with only the header block.
+     *
+     * @throws std::runtime_error if the file can't be read.
+     */
+    template <typename TFunc>
+    void read_blocks(const std::string& filename,
+                     const std::vector<pbf_block>& blocks,
+                     osmium::osm_entity_bits::type read_types,
+                     TFunc&& func,
+                     std::size_t batch_size = 64 * 1024 * 1024) const {
+        std::size_t begin = 0;
+        do {
+            std::size_t end = begin;
+            std::uint64_t size = 0;
+            while (end < blocks.size() && (end == begin || size + blocks[end].size <= batch_size)) {
+                size += blocks[end].size;
+                ++end;
+            }
+
+            const std::string data = read_data(filename, blocks, begin, end);
+            osmium::io::Reader reader{osmium::io::File{data.data(), data.size(), "pbf"}, read_types};
+            func(reader);
+            reader.close();
+
+            begin = end;
+        } while (begin < blocks.size());
+    }
+
+}; // class PBFBlockIndex
+
+/**
+ * Default name of the index file for a PBF file.
+ */
+inline std::string pbf_index_filename(const std::string& filename) {
+    return filename + ".idx";
+}
+
@@ -0,0 +1,82 @@
+
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "property_options.hpp"
+
+namespace {
+
+    // In the order of the bits in property_options::attribute.
+    const char* const attribute_list_names[] = { "id", "type", "version", "changeset", "uid", "user", "timestamp" };
+
+} // anonymous namespace
+
+unsigned int parse_attribute_list(const std::string& list) {
+    unsigned int attributes = 0;
+
+    std::size_t start = 0;
+    while (start < list.size()) {
+        std::size_t end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        const std::string name = list.substr(start, end - start);
+
+        bool found = false;
+        for (unsigned int i = 0; i < sizeof(attribute_list_names) / sizeof(attribute_list_names[0]); ++i) {
+            if (name == attribute_list_names[i]) {
+                attributes |= 1u << i;
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            throw std::runtime_error{"Unknown attribute '" + name + "'"};
+        }
+
+        start = end + 1;
+    }
+
+    return attributes;
+}
+
+KeySet read_key_list(const std::string& filename) {
+    std::ifstream file{filename};
+    if (!file) {
+        throw std::runtime_error{"Can not open key list '" + filename + "'"};
+    }
+
+    KeySet keys;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        keys.insert(line.c_str());
+    }
+
+    if (file.bad()) {
+        throw std::runtime_error{"Error reading key list '" + filename + "'"};
+    }
+
+    return keys;
+}
+
+void read_tag_keys(property_options& options, const std::string& keep_tags_file, const std::string& drop_tags_file) {
+    if (!keep_tags_file.empty() && !drop_tags_file.empty()) {
+        throw std::runtime_error{"Use only one of --keep-tags and --drop-tags"};
+    }
+    if (!keep_tags_file.empty()) {
+        options.tags = property_options::tag_mode::keep;
+        options.tag_keys = std::make_shared<const KeySet>(read_key_list(keep_tags_file));
+    } else if (!drop_tags_file.empty()) {
+        options.tags = property_options::tag_mode::drop;
+        options.tag_keys = std::make_shared<const KeySet>(read_key_list(drop_tags_file));
+    }
+}
+
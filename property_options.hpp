@@ -0,0 +1,80 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "key_set.hpp"
+
+/**
+ * Which attributes and tags are written into the properties of features.
+ */
+struct property_options {
+
+    enum attribute : unsigned int {
+        attribute_id        = 0x01,
+        attribute_type      = 0x02,
+        attribute_version   = 0x04,
+        attribute_changeset = 0x08,
+        attribute_uid       = 0x10,
+        attribute_user      = 0x20,
+        attribute_timestamp = 0x40
+    };
+
+    static constexpr unsigned int all_attributes = 0x7f;
+
+    /// Attributes that are only there if the input has metadata.
+    static constexpr unsigned int metadata_attributes = attribute_version | attribute_changeset | attribute_uid | attribute_user | attribute_timestamp;
+
+    enum class tag_mode {
+        all,
+        keep,
+        drop
+    };
+
+    /// Bit set of the attributes written.
+    unsigned int attributes = all_attributes;
+
+    /// Write all tags, only those with keys in tag_keys, or all others.
+    tag_mode tags = tag_mode::all;
+
+    std::shared_ptr<const KeySet> tag_keys;
+
+    bool write_tag(const char* key) const noexcept {
+        switch (tags) {
+            case tag_mode::keep:
+                return tag_keys->contains(key);
+            case tag_mode::drop:
+                return !tag_keys->contains(key);
+            default:
+                break;
+        }
+        return true;
+    }
+
+}; // struct property_options
+
+/**
+ * Parse a comma separated list of attribute names (id, type, version,
+ * changeset, uid, user, timestamp) into a bit set for
+ * property_options::attributes. An empty list means no attributes.
+ *
+ * @throws std::runtime_error if there is an unknown name in the list.
+ */
+unsigned int parse_attribute_list(const std::string& list);
+
+/**
+ * Read a file with one key on each line. Empty lines and lines starting
+ * with "#" are ignored.
+ *
+ * @throws std::runtime_error if the file can't be read.
+ */
+KeySet read_key_list(const std::string& filename);
+
+/**
+ * Set up the tag filter of the options from the files given with
+ * --keep-tags and --drop-tags. Nothing is changed if both are empty.
+ *
+ * @throws std::runtime_error if both are set or the file can't be read.
+ */
+void read_tag_keys(property_options& options, const std::string& keep_tags_file, const std::string& drop_tags_file);
+
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <osmium/geom/tile.hpp>
+#include <osmium/handler.hpp>
+#include <osmium/index/index.hpp>
+#include <osmium/index/map.hpp>
+#include <osmium/osm.hpp>
+
+#include "location_dump.hpp"
+#include "tile_index.hpp"
+#include "way_index.hpp"
+
+/**
+ * Collects the tiles changed by a change file. The new locations of the
+ * nodes are added right away, the IDs of all nodes in the change file and
+ * of all nodes used by ways in the change file are collected and their
+ * old locations are looked up in one sorted sweep over the old index in
+ * add_old_locations(). The new locations of nodes used by ways are in the
+ * change file (if they changed) or the same as the old locations.
+ */
+class TileDiffHandler : public osmium::handler::Handler {
+
+    int m_zoom;
+    const WayIndex* m_way_index;
+
+    std::vector<osmium::unsigned_object_id_type> m_ids;
+
+    TileIndex m_dirty_tiles;
+
+    void add_location(const osmium::Location& location) {
+        if (location.valid()) {
+            m_dirty_tiles.insert(osmium::geom::Tile{static_cast<std::uint32_t>(m_zoom), location});
+        }
+    }
+
+    // Add all tiles in the box.
+    void add_box(const osmium::Box& box) {
+        if (!box.valid()) {
+            return;
+        }
+        const osmium::geom::Tile bottom_left{static_cast<std::uint32_t>(m_zoom), box.bottom_left()};
+        const osmium::geom::Tile top_right{static_cast<std::uint32_t>(m_zoom), box.top_right()};
+        for (std::uint32_t x = std::min(bottom_left.x, top_right.x); x <= std::max(bottom_left.x, top_right.x); ++x) {
+            for (std::uint32_t y = std::min(bottom_left.y, top_right.y); y <= std::max(bottom_left.y, top_right.y); ++y) {
+                m_dirty_tiles.insert(x, y);
+            }
+        }
+    }
+
+public:
+
+    /**
+     * If way_index is not nullptr, the tiles of all ways using a node in
+     * the change file are added, too.
+     */
+    TileDiffHandler(int zoom, const WayIndex* way_index) :
+        m_zoom(zoom),
+        m_way_index(way_index),
+        m_ids(),
+        m_dirty_tiles(static_cast<std::uint32_t>(zoom)) {
+    }
+
+    void node(const osmium::Node& node) {
+        m_ids.push_back(node.positive_id());
+        add_location(node.location());
+
+        if (m_way_index) {
+            // The pieces of ways with the node now also reach its new
+            // location.
+            m_way_index->for_each_way(node.positive_id(), [&](const osmium::Box& piece_box) {
+                osmium::Box box{piece_box};
+                box.extend(node.location());
+                add_box(box);
+            });
+        }
+    }
+
+    void way(const osmium::Way& way) {
+        for (const auto& node_ref : way.nodes()) {
+            m_ids.push_back(node_ref.positive_ref());
+        }
+    }
+
+    /**
+     * Add the tiles of the old locations of all nodes seen. Call after
+     * the change file was read.
+     *
+     * @throws std::runtime_error if the location dump is corrupted.
+     */
+    void add_old_locations(const osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>& old_index) {
+        std::sort(m_ids.begin(), m_ids.end());
+        m_ids.erase(std::unique(m_ids.begin(), m_ids.end()), m_ids.end());
+
+        const auto* checked_index = dynamic_cast<const CheckedFileArray*>(&old_index);
+        if (checked_index) {
+            for (const auto& location : checked_index->get_sorted(m_ids)) {
+                add_location(location);
+            }
+        } else {
+            for (const auto id : m_ids) {
+                try {
+                    add_location(old_index.get(id));
+                } catch (const osmium::not_found&) {
+                }
+            }
+        }
+
+        std::vector<osmium::unsigned_object_id_type>{}.swap(m_ids);
+    }
+
+    const TileIndex& dirty_tiles() const noexcept {
+        return m_dirty_tiles;
+    }
+
+}; // class TileDiffHandler
+
+/**
+ * Collects the node changes in a change file to update a location dump.
+ */
+class NodeChangeHandler : public osmium::handler::Handler {
+
+    struct node_change {
+        osmium::unsigned_object_id_type id;
+        osmium::object_version_type version;
+        osmium::Location location;
+    };
+
+    std::vector<node_change> m_changes;
+
+public:
+
+    void node(const osmium::Node& node) {
+        m_changes.push_back(node_change{node.positive_id(), node.version(), node.visible() ? node.location() : osmium::Location{}});
+    }
+
+    /**
+     * The changes ordered by ID with only the newest version of each node.
+     */
+    std::vector<location_change> changes() {
+        std::stable_sort(m_changes.begin(), m_changes.end(), [](const node_change& a, const node_change& b) {
+            return std::tie(a.id, a.version) < std::tie(b.id, b.version);
+        });
+
+        std::vector<location_change> changes;
+        for (const auto& change : m_changes) {
+            if (!changes.empty() && changes.back().first == change.id) {
+                changes.back().second = change.location;
+            } else {
+                changes.emplace_back(change.id, change.location);
+            }
+        }
+        return changes;
+    }
+
+}; // class NodeChangeHandler
+
+/**
+ * Collects the way changes in a change file to update a way index.
+ */
+class WayChangeHandler : public osmium::handler::Handler {
+
+    struct way_version {
+        osmium::unsigned_object_id_type id;
+        osmium::object_version_type version;
+        bool visible;
+        std::vector<osmium::NodeRef> nodes;
+    };
+
+    std::vector<way_version> m_ways;
+
+public:
+
+    void way(const osmium::Way& way) {
+        m_ways.push_back(way_version{way.positive_id(), way.version(), way.visible(),
+                                     std::vector<osmium::NodeRef>(way.nodes().cbegin(), way.nodes().cend())});
+    }
+
+    /**
+     * The changes ordered by ID with only the newest version of each way.
+     * The locations of the nodes are taken from node_changes (as returned
+     * by NodeChangeHandler::changes()) or, if they didn't change, from the
+     * old index.
+     *
+     * @throws std::runtime_error if the location dump is corrupted.
+     */
+    std::vector<way_change> changes(const std::vector<location_change>& node_changes,
+                                     const osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>& old_index) {
+        std::stable_sort(m_ways.begin(), m_ways.end(), [](const way_version& a, const way_version& b) {
+            return std::tie(a.id, a.version) < std::tie(b.id, b.version);
+        });
+
+        std::vector<way_change> changes;
+        for (auto& way : m_ways) {
+            if (changes.empty() || changes.back().id != way.id) {
+                changes.push_back(way_change{way.id, false, {}});
+            }
+            changes.back().deleted = !way.visible;
+            changes.back().nodes = way.visible ? std::move(way.nodes) : std::vector<osmium::NodeRef>{};
+        }
+        std::vector<way_version>{}.swap(m_ways);
+
+        std::vector<osmium::unsigned_object_id_type> ids;
+        for (const auto& change : changes) {
+            for (const auto& node_ref : change.nodes) {
+                ids.push_back(node_ref.positive_ref());
+            }
+        }
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+        std::vector<osmium::Location> locations;
+        const auto* checked_index = dynamic_cast<const CheckedFileArray*>(&old_index);
+        if (checked_index) {
+            locations = checked_index->get_sorted(ids);
+        } else {
+            locations.reserve(ids.size());
+            for (const auto id : ids) {
+                try {
+                    locations.push_back(old_index.get(id));
+                } catch (const osmium::not_found&) {
+                    locations.emplace_back();
+                }
+            }
+        }
+
+        auto node_change = node_changes.cbegin();
+        for (std::size_t i = 0; i < ids.size(); ++i) {
+            for (; node_change != node_changes.cend() && node_change->first < ids[i]; ++node_change) {
+            }
+            if (node_change != node_changes.cend() && node_change->first == ids[i]) {
+                locations[i] = node_change->second;
+            }
+        }
+
+        for (auto& change : changes) {
+            for (auto& node_ref : change.nodes) {
+                const auto it = std::lower_bound(ids.cbegin(), ids.cend(), node_ref.positive_ref());
+                node_ref.set_location(locations[static_cast<std::size_t>(it - ids.cbegin())]);
+            }
+        }
+
+        return changes;
+    }
+
+}; // class WayChangeHandler
+
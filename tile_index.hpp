@@ -0,0 +1,284 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <osmium/geom/tile.hpp>
+#include <osmium/osm/box.hpp>
+
+/// Highest zoom level osmium::geom::Tile supports.
+constexpr std::uint32_t max_tile_zoom = 30;
+
+/**
+ * Set of tiles on a single zoom level optimized for fast lookups.
+ *
+ * Up to zoom level max_dense_zoom a bitmap with one bit for every tile is
+ * used (2 MBytes on zoom level 12). For higher zoom levels the tiles are
+ * kept in an open addressing hash table with linear probing.
+ */
+class TileIndex {
+
+    static constexpr std::uint32_t max_dense_zoom = 12;
+
+    // Keys in the hash table are (x << 32 | y) + 1, so 0 marks empty slots.
+    static constexpr std::uint64_t empty_key = 0;
+
+    std::uint32_t m_zoom;
+    std::size_t m_size;
+
+    // Bounding box of all tiles for quickly rejecting boxes.
+    std::uint32_t m_min_x;
+    std::uint32_t m_max_x;
+    std::uint32_t m_min_y;
+    std::uint32_t m_max_y;
+
+    std::vector<std::uint64_t> m_bits;
+    std::vector<std::uint64_t> m_table;
+    unsigned int m_table_bits;
+
+    bool dense() const noexcept {
+        return m_zoom <= max_dense_zoom;
+    }
+
+    static std::uint64_t make_key(std::uint32_t x, std::uint32_t y) noexcept {
+        return ((static_cast<std::uint64_t>(x) << 32) | y) + 1;
+    }
+
+    std::size_t slot(std::uint64_t key) const noexcept {
+        return static_cast<std::size_t>((key * 0x9e3779b97f4a7c15ULL) >> (64 - m_table_bits));
+    }
+
+    bool insert_key(std::uint64_t key) {
+        const std::size_t mask = m_table.size() - 1;
+        for (std::size_t i = slot(key); ; i = (i + 1) & mask) {
+            if (m_table[i] == key) {
+                return false;
+            }
+            if (m_table[i] == empty_key) {
+                m_table[i] = key;
+                return true;
+            }
+        }
+    }
+
+    void grow() {
+        std::vector<std::uint64_t> old_table(m_table.size() * 2);
+        old_table.swap(m_table);
+        ++m_table_bits;
+        for (const auto key : old_table) {
+            if (key != empty_key) {
+                insert_key(key);
+            }
+        }
+    }
+
+public:
+
+    explicit TileIndex(std::uint32_t zoom = 15) :
+        m_zoom(zoom),
+        m_size(0),
+        m_min_x(std::numeric_limits<std::uint32_t>::max()),
+        m_max_x(0),
+        m_min_y(std::numeric_limits<std::uint32_t>::max()),
+        m_max_y(0),
+        m_bits(),
+        m_table(),
+        m_table_bits(10) {
+        if (dense()) {
+            m_bits.resize(((std::uint64_t(1) << (2 * zoom)) + 63) / 64);
+        } else {
+            m_table.resize(std::size_t(1) << m_table_bits);
+        }
+    }
+
+    std::uint32_t zoom() const noexcept {
+        return m_zoom;
+    }
+
+    bool empty() const noexcept {
+        return m_size == 0;
+    }
+
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    /**
+     * Is x, y a tile on the zoom level of the index?
+     */
+    bool valid(std::uint32_t x, std::uint32_t y) const noexcept {
+        return (static_cast<std::uint64_t>(x) >> m_zoom) == 0 &&
+               (static_cast<std::uint64_t>(y) >> m_zoom) == 0;
+    }
+
+    /**
+     * Add a tile. The tile must be valid().
+     */
+    void insert(std::uint32_t x, std::uint32_t y) {
+        m_min_x = std::min(m_min_x, x);
+        m_max_x = std::max(m_max_x, x);
+        m_min_y = std::min(m_min_y, y);
+        m_max_y = std::max(m_max_y, y);
+
+        if (dense()) {
+            const std::uint64_t n = (static_cast<std::uint64_t>(x) << m_zoom) | y;
+            const std::uint64_t bit = std::uint64_t(1) << (n & 63);
+            if (!(m_bits[n >> 6] & bit)) {
+                m_bits[n >> 6] |= bit;
+                ++m_size;
+            }
+            return;
+        }
+
+        if ((m_size + 1) * 2 > m_table.size()) {
+            grow();
+        }
+        if (insert_key(make_key(x, y))) {
+            ++m_size;
+        }
+    }
+
+    /**
+     * Add a tile. Tiles on other zoom levels are ignored.
+     *
+     * @returns true if the tile is on the zoom level of the index.
+     * @throws std::invalid_argument if x or y is out of range.
+     */
+    bool insert(const osmium::geom::Tile& tile) {
+        if (tile.z != m_zoom) {
+            return false;
+        }
+        if (!valid(tile.x, tile.y)) {
+            throw std::invalid_argument{"Tile x or y out of range for zoom level"};
+        }
+        insert(tile.x, tile.y);
+        return true;
+    }
+
+    bool contains(std::uint32_t x, std::uint32_t y) const noexcept {
+        if (!valid(x, y)) {
+            return false;
+        }
+
+        if (dense()) {
+            const std::uint64_t n = (static_cast<std::uint64_t>(x) << m_zoom) | y;
+            return (m_bits[n >> 6] >> (n & 63)) & 1;
+        }
+
+        const std::uint64_t key = make_key(x, y);
+        const std::size_t mask = m_table.size() - 1;
+        for (std::size_t i = slot(key); ; i = (i + 1) & mask) {
+            if (m_table[i] == key) {
+                return true;
+            }
+            if (m_table[i] == empty_key) {
+                return false;
+            }
+        }
+    }
+
+    bool contains(const osmium::geom::Tile& tile) const noexcept {
+        return tile.z == m_zoom && contains(tile.x, tile.y);
+    }
+
+    /**
+     * Does the index contain any tile with x in [x1, x2] and y in [y1, y2]?
+     */
+    bool intersects(std::uint32_t x1, std::uint32_t y1, std::uint32_t x2, std::uint32_t y2) const noexcept {
+        const std::uint32_t min_x = std::max(x1, m_min_x);
+        const std::uint32_t max_x = std::min(x2, m_max_x);
+        const std::uint32_t min_y = std::max(y1, m_min_y);
+        const std::uint32_t max_y = std::min(y2, m_max_y);
+        if (m_size == 0 || min_x > max_x || min_y > max_y) {
+            return false;
+        }
+
+        if (dense()) {
+            // The tiles of one column are consecutive bits.
+            for (std::uint64_t x = min_x; x <= max_x; ++x) {
+                const std::uint64_t first = (x << m_zoom) | min_y;
+                const std::uint64_t last = (x << m_zoom) | max_y;
+                for (std::uint64_t n = first; n <= last; n = (n | 63) + 1) {
+                    std::uint64_t word = m_bits[n >> 6] >> (n & 63);
+                    if ((last >> 6) == (n >> 6) && (last & 63) != 63) {
+                        word &= (std::uint64_t(1) << ((last & 63) - (n & 63) + 1)) - 1;
+                    }
+                    if (word) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        // Check whatever is less work: all tiles in the box or all tiles
+        // in the index.
+        const std::uint64_t area = std::uint64_t(max_x - min_x + 1) * (max_y - min_y + 1);
+        if (area <= m_size) {
+            for (std::uint32_t x = min_x; x <= max_x; ++x) {
+                for (std::uint32_t y = min_y; y <= max_y; ++y) {
+                    if (contains(x, y)) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        return std::any_of(m_table.begin(), m_table.end(), [&](std::uint64_t key) {
+            if (key == empty_key) {
+                return false;
+            }
+            const auto x = static_cast<std::uint32_t>((key - 1) >> 32);
+            const auto y = static_cast<std::uint32_t>((key - 1) & 0xffffffff);
+            return x >= min_x && x <= max_x && y >= min_y && y <= max_y;
+        });
+    }
+
+    /**
+     * Does any tile of the index overlap the box? The box must be valid.
+     */
+    bool intersects(const osmium::Box& box) const {
+        const osmium::geom::Tile bottom_left{m_zoom, box.bottom_left()};
+        const osmium::geom::Tile top_right{m_zoom, box.top_right()};
+        return intersects(std::min(bottom_left.x, top_right.x), std::min(bottom_left.y, top_right.y),
+                          std::max(bottom_left.x, top_right.x), std::max(bottom_left.y, top_right.y));
+    }
+
+    /**
+     * All tiles in the index sorted by x, then y.
+     */
+    std::vector<osmium::geom::Tile> sorted_tiles() const {
+        std::vector<osmium::geom::Tile> tiles;
+        tiles.reserve(m_size);
+
+        if (dense()) {
+            const std::uint64_t mask = (std::uint64_t(1) << m_zoom) - 1;
+            for (std::size_t i = 0; i < m_bits.size(); ++i) {
+                for (std::uint64_t word = m_bits[i]; word; word &= word - 1) {
+                    const std::uint64_t n = (std::uint64_t(i) << 6) + static_cast<std::uint64_t>(__builtin_ctzll(word));
+                    tiles.emplace_back(m_zoom, static_cast<std::uint32_t>(n >> m_zoom), static_cast<std::uint32_t>(n & mask));
+                }
+            }
+            return tiles;
+        }
+
+        std::vector<std::uint64_t> keys;
+        keys.reserve(m_size);
+        std::copy_if(m_table.begin(), m_table.end(), std::back_inserter(keys), [](std::uint64_t key) {
+            return key != empty_key;
+        });
+        std::sort(keys.begin(), keys.end());
+        for (const auto key : keys) {
+            tiles.emplace_back(m_zoom, static_cast<std::uint32_t>((key - 1) >> 32), static_cast<std::uint32_t>((key - 1) & 0xffffffff));
+        }
+        return tiles;
+    }
+
+}; // class TileIndex
+
@@ -0,0 +1,227 @@
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+#include "tile_list.hpp"
+
+namespace {
+
+    const char binary_magic[] = "MJTL";
+    const std::size_t magic_size = 4;
+    const std::size_t header_size = 16;
+    const char binary_version = 1;
+
+    std::uint64_t tile_to_quadkey(std::uint32_t x, std::uint32_t y) noexcept {
+        std::uint64_t key = 0;
+        for (unsigned int i = 0; i < 32; ++i) {
+            key |= static_cast<std::uint64_t>((x >> i) & 1) << (2 * i);
+            key |= static_cast<std::uint64_t>((y >> i) & 1) << (2 * i + 1);
+        }
+        return key;
+    }
+
+    void quadkey_to_tile(std::uint64_t key, std::uint32_t& x, std::uint32_t& y) noexcept {
+        x = 0;
+        y = 0;
+        for (unsigned int i = 0; i < 32; ++i) {
+            x |= static_cast<std::uint32_t>((key >> (2 * i)) & 1) << i;
+            y |= static_cast<std::uint32_t>((key >> (2 * i + 1)) & 1) << i;
+        }
+    }
+
+    void append_varint(std::string& out, std::uint64_t value) {
+        while (value >= 0x80) {
+            out += static_cast<char>((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        out += static_cast<char>(value);
+    }
+
+    void read_text(const std::string& filename, TileIndex& tiles, std::size_t& ignored) {
+        std::ifstream file{filename};
+        if (!file.is_open()) {
+            throw std::runtime_error{"Can not open tile list '" + filename + "'"};
+        }
+        std::string line;
+        std::size_t line_number = 0;
+        while (std::getline(file, line)) {
+            ++line_number;
+            std::istringstream fields{line};
+            std::uint32_t z;
+            std::uint32_t x;
+            std::uint32_t y;
+            std::string rest;
+            if (!(fields >> z)) {
+                if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                    continue;
+                }
+            } else if (fields >> x >> y && !(fields >> rest) &&
+                       z <= max_tile_zoom && (x >> z) == 0 && (y >> z) == 0) {
+                if (!tiles.insert(osmium::geom::Tile{z, x, y})) {
+                    ++ignored;
+                }
+                continue;
+            }
+            throw std::runtime_error{"Invalid tile in tile list '" + filename + "' on line " + std::to_string(line_number)};
+        }
+    }
+
+    void read_binary(const char* data, std::size_t size, TileIndex& tiles) {
+        if (size < header_size || data[4] != binary_version) {
+            throw std::runtime_error{"Invalid binary tile list"};
+        }
+
+        const std::uint32_t zoom = static_cast<unsigned char>(data[5]);
+        std::uint64_t count = 0;
+        for (int i = 7; i >= 0; --i) {
+            count = (count << 8) | static_cast<unsigned char>(data[8 + i]);
+        }
+
+        if (zoom > max_tile_zoom) {
+            throw std::runtime_error{"Invalid binary tile list: zoom level out of range"};
+        }
+
+        // Unlike in text tile lists all tiles are on the same zoom level,
+        // ignoring them would leave nothing to filter with.
+        if (zoom != tiles.zoom()) {
+            throw std::runtime_error{"Binary tile list is for zoom level " + std::to_string(zoom) +
+                                     ", not " + std::to_string(tiles.zoom())};
+        }
+
+        // Every tile needs at least one byte.
+        if (count > size - header_size) {
+            throw std::runtime_error{"Invalid binary tile list: truncated data"};
+        }
+
+        const char* it = data + header_size;
+        const char* const end = data + size;
+        const std::uint64_t max_key = (std::uint64_t(1) << (2 * zoom)) - 1;
+        std::uint64_t key = 0;
+        for (std::uint64_t n = 0; n < count; ++n) {
+            std::uint64_t delta = 0;
+            for (unsigned int shift = 0; ; shift += 7) {
+                if (it == end || shift > 63) {
+                    throw std::runtime_error{"Invalid binary tile list: truncated data"};
+                }
+                const auto byte = static_cast<unsigned char>(*it++);
+                delta |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) {
+                    break;
+                }
+            }
+            if (delta > max_key - key) {
+                throw std::runtime_error{"Invalid binary tile list: tile out of range"};
+            }
+            key += delta;
+            std::uint32_t x;
+            std::uint32_t y;
+            quadkey_to_tile(key, x, y);
+            tiles.insert(x, y);
+        }
+    }
+
+} // anonymous namespace
+
+TileIndex read_tile_list(const std::string& filename, std::uint32_t zoom, std::size_t& ignored) {
+    TileIndex tiles{zoom};
+    ignored = 0;
+
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error{"Can not open tile list '" + filename + "': " + std::strerror(errno)};
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error{"Can not read tile list '" + filename + "': " + std::strerror(errno)};
+    }
+    const auto size = static_cast<std::size_t>(st.st_size);
+
+    char magic[magic_size] = {};
+    if (size < magic_size || ::read(fd, magic, magic_size) != static_cast<ssize_t>(magic_size) ||
+        std::memcmp(magic, binary_magic, magic_size) != 0) {
+        ::close(fd);
+        read_text(filename, tiles, ignored);
+        return tiles;
+    }
+
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error{"Can not map tile list '" + filename + "': " + std::strerror(errno)};
+    }
+
+    try {
+        read_binary(static_cast<const char*>(data), size, tiles);
+    } catch (...) {
+        ::munmap(data, size);
+        throw;
+    }
+    ::munmap(data, size);
+
+    return tiles;
+}
+
+void write_tile_list(int fd, const TileIndex& tiles, tile_list_format format) {
+    std::string out;
+
+    if (format == tile_list_format::text) {
+        const std::string zoom = std::to_string(tiles.zoom()) + " ";
+        for (const auto& tile : tiles.sorted_tiles()) {
+            out += zoom;
+            out += std::to_string(tile.x);
+            out += ' ';
+            out += std::to_string(tile.y);
+            out += '\n';
+        }
+    } else {
+        std::vector<std::uint64_t> keys;
+        keys.reserve(tiles.size());
+        for (const auto& tile : tiles.sorted_tiles()) {
+            keys.push_back(tile_to_quadkey(tile.x, tile.y));
+        }
+        std::sort(keys.begin(), keys.end());
+
+        out.append(binary_magic, magic_size);
+        out += binary_version;
+        out += static_cast<char>(tiles.zoom());
+        out.append(2, '\0');
+        const std::uint64_t count = keys.size();
+        for (int i = 0; i < 8; ++i) {
+            out += static_cast<char>((count >> (8 * i)) & 0xff);
+        }
+
+        std::uint64_t last = 0;
+        for (const auto key : keys) {
+            append_varint(out, key - last);
+            last = key;
+        }
+    }
+
+    const char* data = out.data();
+    std::size_t size = out.size();
+    while (size > 0) {
+        const auto written = ::write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error{errno, std::system_category(), "Error writing tile list"};
+        }
+        data += written;
+        size -= static_cast<std::size_t>(written);
+    }
+}
+
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "tile_index.hpp"
+
+/**
+ * Tile lists are written by minjur-generate-tilelist and read by minjur.
+ *
+ * The text format has one tile per line as "ZOOM X Y".
+ *
+ * The binary format starts with a 16 byte header: the magic "MJTL", a
+ * format version byte (1), the zoom level byte, two reserved zero bytes
+ * and the number of tiles as 64 bit little endian integer. Then, for
+ * each tile in ascending order of their quadkeys (x and y bits
+ * interleaved), the difference to the quadkey of the previous tile
+ * encoded as varint (7 bits per byte, least significant group first).
+ * Neighbouring tiles have neighbouring quadkeys, so most tiles need only
+ * one or two bytes.
+ */
+enum class tile_list_format {
+    text,
+    binary
+};
+
+/**
+ * Read a tile list in text or binary format (detected automatically).
+ * Tiles in a text tile list not on the given zoom level are ignored,
+ * their number is returned in ignored.
+ *
+ * @throws std::runtime_error if the file can't be read, is invalid, or
+ *         is a binary tile list for another zoom level.
+ */
+TileIndex read_tile_list(const std::string& filename, std::uint32_t zoom, std::size_t& ignored);
+
+/**
+ * Write all tiles in the index to the file descriptor.
+ *
+ * @throws std::system_error if writing fails.
+ */
+void write_tile_list(int fd, const TileIndex& tiles, tile_list_format format);
+
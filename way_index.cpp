@@ -0,0 +1,449 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+#include "way_index.hpp"
+
+namespace {
+
+    const char way_index_magic[8] = {'M', 'J', 'W', 'A', 'Y', 'I', 'D', 'X'};
+    const std::uint32_t way_index_version = 2;
+    const std::uint64_t way_index_header_size = 64;
+
+    struct way_index_header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t reserved;
+        std::uint64_t num_pieces;
+        std::uint64_t pieces_offset;
+        std::uint64_t num_refs;
+        std::uint64_t refs_offset;
+        std::uint64_t replication_sequence;
+        std::uint64_t replication_timestamp;
+    };
+
+    static_assert(sizeof(way_index_header) == 64, "unexpected way index header size");
+    static_assert(sizeof(osmium::Box) == 16, "unexpected size of osmium::Box");
+    static_assert(sizeof(way_piece) == 24, "unexpected size of way_piece");
+    static_assert(sizeof(node_way_ref) == 16, "unexpected size of node_way_ref");
+
+    void write_all(int fd, const void* buffer, std::size_t size) {
+        const char* data = static_cast<const char*>(buffer);
+        while (size > 0) {
+            const auto written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error{errno, std::system_category(), "Error writing way index"};
+            }
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+    }
+
+    way_index_header make_header(std::uint64_t num_pieces, std::uint64_t replication_sequence, std::uint64_t replication_timestamp) {
+        way_index_header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, way_index_magic, sizeof(header.magic));
+        header.version = way_index_version;
+        header.num_pieces = num_pieces;
+        header.pieces_offset = way_index_header_size;
+        header.refs_offset = way_index_header_size + num_pieces * sizeof(way_piece);
+        header.replication_sequence = replication_sequence;
+        header.replication_timestamp = replication_timestamp;
+        return header;
+    }
+
+    // Write the header of a complete temporary way index file, close it
+    // and move it into place. The file descriptor is always closed.
+    void commit_file(int fd, const way_index_header& header, const std::string& tmp_filename, const std::string& filename) {
+        try {
+            // The header area is not written if there are no ways.
+            if (::ftruncate(fd, static_cast<off_t>(header.refs_offset + header.num_refs * sizeof(node_way_ref))) != 0 ||
+                ::fsync(fd) != 0) {
+                throw std::system_error{errno, std::system_category(), "Error writing way index"};
+            }
+            if (::lseek(fd, 0, SEEK_SET) < 0) {
+                throw std::system_error{errno, std::system_category(), "Error writing way index"};
+            }
+            write_all(fd, &header, sizeof(header));
+            if (::fsync(fd) != 0) {
+                throw std::system_error{errno, std::system_category(), "Error writing way index"};
+            }
+        } catch (...) {
+            ::close(fd);
+            ::unlink(tmp_filename.c_str());
+            throw;
+        }
+
+        if (::close(fd) != 0) {
+            const int error = errno;
+            ::unlink(tmp_filename.c_str());
+            throw std::system_error{error, std::system_category(), "Error writing way index"};
+        }
+        if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+            const int error = errno;
+            ::unlink(tmp_filename.c_str());
+            throw std::system_error{error, std::system_category(), "Can not rename way index to '" + filename + "'"};
+        }
+    }
+
+    // Buffers node references and writes them in large blocks.
+    class RefWriter {
+
+        int m_fd;
+        std::vector<node_way_ref> m_refs;
+        std::uint64_t m_count;
+
+    public:
+
+        explicit RefWriter(int fd) :
+            m_fd(fd),
+            m_refs(),
+            m_count(0) {
+            m_refs.reserve(64 * 1024);
+        }
+
+        void add(const node_way_ref& ref) {
+            m_refs.push_back(ref);
+            if (m_refs.size() == m_refs.capacity()) {
+                flush();
+            }
+        }
+
+        void flush() {
+            write_all(m_fd, m_refs.data(), m_refs.size() * sizeof(node_way_ref));
+            m_count += m_refs.size();
+            m_refs.clear();
+        }
+
+        std::uint64_t count() const noexcept {
+            return m_count;
+        }
+
+    }; // class RefWriter
+
+    // Consecutive pieces of the old index with the same fate in an
+    // update: they start at new_first in the new index, or are dropped
+    // because their way was changed.
+    struct piece_run {
+        std::uint64_t old_first;
+        std::uint64_t new_first;
+        bool kept;
+    };
+
+} // anonymous namespace
+
+WayIndexBuilder::WayIndexBuilder(const std::string& filename, std::size_t memory, const std::string& tmp_dir, std::size_t num_threads) :
+    m_filename(filename),
+    m_tmp_filename(filename + ".tmp"),
+    m_fd(::open(m_tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)),
+    m_pieces(),
+    m_num_pieces(0),
+    m_last_way_id(0),
+    m_refs(memory, tmp_dir, num_threads) {
+    if (m_fd < 0) {
+        throw std::system_error{errno, std::system_category(), "Can not open way index '" + m_tmp_filename + "'"};
+    }
+    if (::lseek(m_fd, static_cast<off_t>(way_index_header_size), SEEK_SET) < 0) {
+        const int error = errno;
+        ::close(m_fd);
+        ::unlink(m_tmp_filename.c_str());
+        throw std::system_error{error, std::system_category(), "Error writing way index"};
+    }
+    m_pieces.reserve(64 * 1024);
+}
+
+WayIndexBuilder::~WayIndexBuilder() {
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        ::unlink(m_tmp_filename.c_str());
+    }
+}
+
+void WayIndexBuilder::write_pieces() {
+    write_all(m_fd, m_pieces.data(), m_pieces.size() * sizeof(way_piece));
+    m_pieces.clear();
+}
+
+void WayIndexBuilder::way(const osmium::Way& way) {
+    const osmium::unsigned_object_id_type id = way.positive_id();
+    if (m_num_pieces > 0 && id <= m_last_way_id) {
+        throw std::runtime_error{"Ways must be ordered by ID for the way index"};
+    }
+    m_last_way_id = id;
+
+    for_each_way_piece(way.nodes().cbegin(), way.nodes().cend(), [&](const osmium::NodeRef* first, const osmium::NodeRef* last, const osmium::Box& box) {
+        for (auto it = first; ; ++it) {
+            m_refs.add(node_way_ref{it->positive_ref(), m_num_pieces});
+            if (it == last) {
+                break;
+            }
+        }
+
+        m_pieces.push_back(way_piece{id, box});
+        if (m_pieces.size() == m_pieces.capacity()) {
+            write_pieces();
+        }
+        ++m_num_pieces;
+    });
+}
+
+void WayIndexBuilder::finish(std::uint64_t replication_sequence, std::uint64_t replication_timestamp) {
+    write_pieces();
+
+    way_index_header header = make_header(m_num_pieces, replication_sequence, replication_timestamp);
+
+    // Closed ways use their first node twice, only keep one reference.
+    m_refs.sort();
+    RefWriter refs{m_fd};
+    node_way_ref ref;
+    node_way_ref last{0, 0};
+    bool first = true;
+    while (m_refs.next(ref)) {
+        if (!first && ref == last) {
+            continue;
+        }
+        first = false;
+        last = ref;
+        refs.add(ref);
+    }
+    refs.flush();
+    header.num_refs = refs.count();
+
+    const int fd = m_fd;
+    m_fd = -1;
+    commit_file(fd, header, m_tmp_filename, m_filename);
+}
+
+WayIndex::WayIndex(const std::string& filename) :
+    m_data(nullptr),
+    m_data_size(0),
+    m_pieces(nullptr),
+    m_num_pieces(0),
+    m_refs(nullptr),
+    m_num_refs(0),
+    m_replication_sequence(0),
+    m_replication_timestamp(0) {
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error{"Can not open way index '" + filename + "': " + std::strerror(errno)};
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error{"Can not read way index '" + filename + "': " + std::strerror(errno)};
+    }
+    const auto size = static_cast<std::uint64_t>(st.st_size);
+
+    way_index_header header;
+    if (size < way_index_header_size || ::pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+        ::close(fd);
+        throw std::runtime_error{"Way index '" + filename + "' is corrupt or incomplete"};
+    }
+
+    if (std::memcmp(header.magic, way_index_magic, sizeof(header.magic)) == 0 && header.version != way_index_version) {
+        ::close(fd);
+        throw std::runtime_error{"Way index '" + filename + "' has format version " + std::to_string(header.version) +
+                                 ", rebuild it with minjur --way-index"};
+    }
+
+    if (std::memcmp(header.magic, way_index_magic, sizeof(header.magic)) != 0 ||
+        header.pieces_offset != way_index_header_size ||
+        header.refs_offset != header.pieces_offset + header.num_pieces * sizeof(way_piece) ||
+        header.refs_offset + header.num_refs * sizeof(node_way_ref) != size) {
+        ::close(fd);
+        throw std::runtime_error{"Way index '" + filename + "' is corrupt or incomplete"};
+    }
+
+    m_data = ::mmap(nullptr, static_cast<std::size_t>(size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m_data == MAP_FAILED) {
+        m_data = nullptr;
+        throw std::runtime_error{"Can not map way index '" + filename + "': " + std::strerror(errno)};
+    }
+    m_data_size = static_cast<std::size_t>(size);
+
+    const char* data = static_cast<const char*>(m_data);
+    m_pieces = reinterpret_cast<const way_piece*>(data + header.pieces_offset);
+    m_num_pieces = header.num_pieces;
+    m_refs = reinterpret_cast<const node_way_ref*>(data + header.refs_offset);
+    m_num_refs = header.num_refs;
+    m_replication_sequence = header.replication_sequence;
+    m_replication_timestamp = header.replication_timestamp;
+}
+
+WayIndex::~WayIndex() noexcept {
+    if (m_data) {
+        ::munmap(m_data, m_data_size);
+    }
+}
+
+void check_way_index(const WayIndex& way_index, const location_dump_info& dump_info) {
+    if (way_index.replication_sequence() != dump_info.replication_sequence) {
+        throw std::runtime_error{"Way index is for replication sequence " + std::to_string(way_index.replication_sequence()) +
+                                 ", but the location dump for " + std::to_string(dump_info.replication_sequence) +
+                                 ". Update both with the same change files or rebuild them with minjur"};
+    }
+}
+
+void update_way_index(const std::string& filename,
+                      const std::vector<way_change>& way_changes,
+                      const std::vector<location_change>& node_changes,
+                      std::uint64_t replication_sequence,
+                      std::uint64_t replication_timestamp) {
+    const WayIndex old_index{filename};
+    const way_piece* const old_pieces = old_index.pieces();
+    const std::uint64_t num_old_pieces = old_index.num_pieces();
+
+    // The pieces of unchanged ways with moved nodes now also reach the new
+    // locations. Boxes never shrink here, but they only have to contain
+    // the pieces, not fit them.
+    std::vector<std::pair<std::uint64_t, osmium::Location>> extensions;
+    for (const auto& change : node_changes) {
+        if (change.second.valid()) {
+            old_index.for_each_piece(change.first, [&](std::uint64_t piece) {
+                extensions.emplace_back(piece, change.second);
+            });
+        }
+    }
+    std::sort(extensions.begin(), extensions.end(), [](const std::pair<std::uint64_t, osmium::Location>& a, const std::pair<std::uint64_t, osmium::Location>& b) {
+        return a.first < b.first;
+    });
+
+    const std::string tmp_filename = filename + ".tmp";
+    const int fd = ::open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::system_error{errno, std::system_category(), "Can not open way index '" + tmp_filename + "'"};
+    }
+
+    std::vector<piece_run> runs;
+    std::vector<node_way_ref> new_refs;
+    std::uint64_t num_pieces = 0;
+
+    try {
+        if (::lseek(fd, static_cast<off_t>(way_index_header_size), SEEK_SET) < 0) {
+            throw std::system_error{errno, std::system_category(), "Error writing way index"};
+        }
+
+        std::vector<way_piece> pieces;
+        pieces.reserve(64 * 1024);
+        const auto add_piece = [&](const way_piece& piece) {
+            pieces.push_back(piece);
+            if (pieces.size() == pieces.capacity()) {
+                write_all(fd, pieces.data(), pieces.size() * sizeof(way_piece));
+                pieces.clear();
+            }
+            ++num_pieces;
+        };
+
+        const auto add_way = [&](const way_change& change) {
+            if (change.deleted) {
+                return;
+            }
+            for_each_way_piece(change.nodes.cbegin(), change.nodes.cend(), [&](std::vector<osmium::NodeRef>::const_iterator first, std::vector<osmium::NodeRef>::const_iterator last, const osmium::Box& box) {
+                for (auto it = first; ; ++it) {
+                    new_refs.push_back(node_way_ref{it->positive_ref(), num_pieces});
+                    if (it == last) {
+                        break;
+                    }
+                }
+                add_piece(way_piece{change.id, box});
+            });
+        };
+
+        auto change = way_changes.cbegin();
+        auto extension = extensions.cbegin();
+        std::uint64_t old_piece = 0;
+        while (old_piece < num_old_pieces) {
+            const osmium::unsigned_object_id_type id = old_pieces[old_piece].way_id;
+            for (; change != way_changes.cend() && change->id < id; ++change) {
+                add_way(*change);
+            }
+
+            const bool replaced = change != way_changes.cend() && change->id == id;
+            // Ways created since the last run shift the following pieces.
+            if (runs.empty() || runs.back().kept == replaced ||
+                (!replaced && old_piece - runs.back().old_first != num_pieces - runs.back().new_first)) {
+                runs.push_back(piece_run{old_piece, num_pieces, !replaced});
+            }
+
+            for (; old_piece < num_old_pieces && old_pieces[old_piece].way_id == id; ++old_piece) {
+                if (replaced) {
+                    continue;
+                }
+                way_piece piece = old_pieces[old_piece];
+                for (; extension != extensions.cend() && extension->first <= old_piece; ++extension) {
+                    if (extension->first == old_piece) {
+                        piece.box.extend(extension->second);
+                    }
+                }
+                add_piece(piece);
+            }
+
+            if (replaced) {
+                add_way(*change);
+                ++change;
+            }
+        }
+        for (; change != way_changes.cend(); ++change) {
+            add_way(*change);
+        }
+        write_all(fd, pieces.data(), pieces.size() * sizeof(way_piece));
+    } catch (...) {
+        ::close(fd);
+        ::unlink(tmp_filename.c_str());
+        throw;
+    }
+
+    way_index_header header = make_header(num_pieces,
+                                          replication_sequence ? replication_sequence : old_index.replication_sequence(),
+                                          replication_timestamp ? replication_timestamp : old_index.replication_timestamp());
+
+    // Merge the references of the unchanged ways, renumbered to their new
+    // pieces, with the references of the changed ways.
+    std::sort(new_refs.begin(), new_refs.end());
+    new_refs.erase(std::unique(new_refs.begin(), new_refs.end()), new_refs.end());
+
+    try {
+        RefWriter refs{fd};
+        auto new_ref = new_refs.cbegin();
+        const node_way_ref* const old_end = old_index.refs() + old_index.num_refs();
+        for (const node_way_ref* old_ref = old_index.refs(); old_ref != old_end; ++old_ref) {
+            if (old_ref->way >= num_old_pieces) {
+                continue;
+            }
+            const auto run = std::prev(std::upper_bound(runs.cbegin(), runs.cend(), old_ref->way, [](std::uint64_t piece, const piece_run& r) {
+                return piece < r.old_first;
+            }));
+            if (!run->kept) {
+                continue;
+            }
+            const node_way_ref ref{old_ref->node, old_ref->way - run->old_first + run->new_first};
+            for (; new_ref != new_refs.cend() && *new_ref < ref; ++new_ref) {
+                refs.add(*new_ref);
+            }
+            refs.add(ref);
+        }
+        for (; new_ref != new_refs.cend(); ++new_ref) {
+            refs.add(*new_ref);
+        }
+        refs.flush();
+        header.num_refs = refs.count();
+    } catch (...) {
+        ::close(fd);
+        ::unlink(tmp_filename.c_str());
+        throw;
+    }
+
+    commit_file(fd, header, tmp_filename, filename);
+}
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <osmium/handler.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/node_ref.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+
+#include "external_sort.hpp"
+#include "location_dump.hpp"
+
+/**
+ * The way index maps node IDs to the bounding boxes of the pieces of the
+ * ways using those nodes. It is written by minjur --way-index, updated by
+ * --update-dump together with the location dump, and used by
+ * minjur-generate-tilelist to find the tiles of the ways that change when
+ * a node moves.
+ *
+ * Ways are split into pieces of up to max_piece_nodes nodes, consecutive
+ * pieces share one node. A piece also ends before its box would get
+ * larger than max_piece_extent in either direction (unless it only has
+ * one segment). When a node moves, only the segments next to it change,
+ * they are in the pieces with that node. Boxes of pieces stay small even
+ * for long ways like coastlines or boundaries.
+ *
+ * The file starts with a 64 byte header. All numbers are in native byte
+ * order:
+ *
+ *     magic "MJWAYIDX"          8 bytes
+ *     format version (2)        32 bit
+ *     reserved                  32 bit
+ *     number of pieces          64 bit
+ *     pieces offset (64)        64 bit
+ *     number of references      64 bit
+ *     references offset         64 bit
+ *     replication sequence      64 bit, 0 if unknown
+ *     replication timestamp     64 bit, seconds since epoch, 0 if unknown
+ *
+ * The pieces section contains the way ID and bounding box of each piece
+ * ordered by way ID and the position of the piece in the way. The
+ * references section contains (node ID, piece number) pairs (64 bit
+ * each) sorted by node ID and piece number.
+ *
+ * The header is written last, so a file that wasn't written completely is
+ * never accepted.
+ */
+struct node_way_ref {
+    osmium::unsigned_object_id_type node;
+    std::uint64_t way;
+};
+
+inline bool operator<(const node_way_ref& a, const node_way_ref& b) noexcept {
+    return a.node < b.node || (a.node == b.node && a.way < b.way);
+}
+
+inline bool operator==(const node_way_ref& a, const node_way_ref& b) noexcept {
+    return a.node == b.node && a.way == b.way;
+}
+
+struct way_piece {
+    osmium::unsigned_object_id_type way_id;
+    osmium::Box box;
+};
+
+constexpr std::size_t max_piece_nodes = 16;
+
+// 0.05 degrees, about 5 tiles on zoom level 15.
+constexpr std::int32_t max_piece_extent = 500000;
+
+/**
+ * Split the nodes in [begin, end) into pieces and call
+ * func(first, last, box) for each piece with the nodes in [first, last]
+ * and their bounding box. Nodes without valid location don't count for
+ * the extent.
+ */
+template <typename TIter, typename TFunc>
+void for_each_way_piece(TIter begin, TIter end, TFunc&& func) {
+    if (begin == end) {
+        return;
+    }
+
+    TIter first = begin;
+    osmium::Box box;
+    box.extend(first->location());
+    std::size_t count = 1;
+    for (TIter it = std::next(begin); it != end; ++it) {
+        osmium::Box extended{box};
+        extended.extend(it->location());
+        const bool too_large = extended.valid() &&
+                               (extended.top_right().x() - extended.bottom_left().x() > max_piece_extent ||
+                                extended.top_right().y() - extended.bottom_left().y() > max_piece_extent);
+        if (count > 1 && (count == max_piece_nodes || too_large)) {
+            const TIter last = std::prev(it);
+            func(first, last, box);
+            first = last;
+            box = osmium::Box{};
+            box.extend(last->location());
+            box.extend(it->location());
+            count = 2;
+        } else {
+            box = extended;
+            ++count;
+        }
+    }
+    func(first, std::prev(end), box);
+}
+
+/**
+ * Handler writing the way index. Apply it after the location handler so
+ * that the ways have their node locations, then call finish(). The ways
+ * must be ordered by ID.
+ */
+class WayIndexBuilder : public osmium::handler::Handler {
+
+    std::string m_filename;
+    std::string m_tmp_filename;
+    int m_fd;
+
+    std::vector<way_piece> m_pieces;
+    std::uint64_t m_num_pieces;
+    osmium::unsigned_object_id_type m_last_way_id;
+    ExternalSorter<node_way_ref> m_refs;
+
+    void write_pieces();
+
+public:
+
+    /**
+     * @param filename Name of the way index file.
+     * @param memory Maximum number of bytes for sorting the node
+     *               references in memory.
+     * @param tmp_dir Directory for the temporary files.
+     * @param num_threads Number of threads used for sorting.
+     *
+     * @throws std::system_error if the file can't be created.
+     */
+    WayIndexBuilder(const std::string& filename, std::size_t memory, const std::string& tmp_dir, std::size_t num_threads);
+
+    WayIndexBuilder(const WayIndexBuilder&) = delete;
+    WayIndexBuilder& operator=(const WayIndexBuilder&) = delete;
+
+    ~WayIndexBuilder();
+
+    /**
+     * @throws std::runtime_error if the ways are not ordered by ID.
+     */
+    void way(const osmium::Way& way);
+
+    /**
+     * Write the sorted node references and the header.
+     *
+     * @throws std::system_error if writing fails.
+     */
+    void finish(std::uint64_t replication_sequence, std::uint64_t replication_timestamp);
+
+}; // class WayIndexBuilder
+
+/**
+ * Read-only access to a way index file. The file is mapped into memory.
+ */
+class WayIndex {
+
+    void* m_data;
+    std::size_t m_data_size;
+    const way_piece* m_pieces;
+    std::uint64_t m_num_pieces;
+    const node_way_ref* m_refs;
+    std::uint64_t m_num_refs;
+    std::uint64_t m_replication_sequence;
+    std::uint64_t m_replication_timestamp;
+
+public:
+
+    /**
+     * @throws std::runtime_error if the file can't be read or is invalid.
+     */
+    explicit WayIndex(const std::string& filename);
+
+    WayIndex(const WayIndex&) = delete;
+    WayIndex& operator=(const WayIndex&) = delete;
+
+    ~WayIndex() noexcept;
+
+    const way_piece* pieces() const noexcept {
+        return m_pieces;
+    }
+
+    std::uint64_t num_pieces() const noexcept {
+        return m_num_pieces;
+    }
+
+    const node_way_ref* refs() const noexcept {
+        return m_refs;
+    }
+
+    std::uint64_t num_refs() const noexcept {
+        return m_num_refs;
+    }
+
+    std::uint64_t replication_sequence() const noexcept {
+        return m_replication_sequence;
+    }
+
+    std::uint64_t replication_timestamp() const noexcept {
+        return m_replication_timestamp;
+    }
+
+    /**
+     * Call func(piece_number) for every piece of a way using the node.
+     */
+    template <typename TFunc>
+    void for_each_piece(osmium::unsigned_object_id_type id, TFunc&& func) const {
+        const node_way_ref* end = m_refs + m_num_refs;
+        for (const node_way_ref* ref = std::lower_bound(m_refs, end, node_way_ref{id, 0}); ref != end && ref->node == id; ++ref) {
+            if (ref->way < m_num_pieces) {
+                func(ref->way);
+            }
+        }
+    }
+
+    /**
+     * Call func(box) with the bounding box of every piece of a way using
+     * the node. The box is invalid if none of the nodes of the piece had a
+     * location.
+     */
+    template <typename TFunc>
+    void for_each_way(osmium::unsigned_object_id_type id, TFunc&& func) const {
+        for_each_piece(id, [&](std::uint64_t piece) {
+            func(m_pieces[piece].box);
+        });
+    }
+
+}; // class WayIndex
+
+/**
+ * A way created, modified or deleted by a change file. The node refs have
+ * the new locations of the nodes.
+ */
+struct way_change {
+    osmium::unsigned_object_id_type id;
+    bool deleted;
+    std::vector<osmium::NodeRef> nodes;
+};
+
+/**
+ * Check that the way index belongs to the location dump.
+ *
+ * @throws std::runtime_error if the way index and the location dump are
+ *         from different replication sequences.
+ */
+void check_way_index(const WayIndex& way_index, const location_dump_info& dump_info);
+
+/**
+ * Apply the changes of a change file to an existing way index. Ways in
+ * way_changes, which must be ordered by ID with only one change for each
+ * ID, are added, replaced, or removed. The boxes of the pieces of all
+ * other ways using nodes in node_changes are extended to the new
+ * locations. The index is rewritten to a temporary file which replaces
+ * it when complete. The replication sequence and timestamp are only
+ * updated if they are not 0.
+ *
+ * @throws std::runtime_error if the index is invalid or can't be written.
+ */
+void update_way_index(const std::string& filename,
+                      const std::vector<way_change>& way_changes,
+                      const std::vector<location_change>& node_changes,
+                      std::uint64_t replication_sequence,
+                      std::uint64_t replication_timestamp);